@@ -1,35 +1,49 @@
+#include <cpu_locals.h>
 #include <dev/device.h>
+#include <errno.h>
 #include <fs/vfs.h>
+#include <lock.h>
 #include <mm/kheap.h>
+#include <mm/pmm.h>
+#include <mm/scratch.h>
+#include <mm/vmm.h>
+#include <rcu.h>
 #include <stdint.h>
 #include <string.h>
-#include <vec.h>
 
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
 
-vec_t(device_t *) devices;
+// Looked up without a lock, see rcu.h. Devices are never removed.
+static rcu_array_t *devices = NULL;
+static lock_t devices_lock = {0};
 
-int init_devices() {
-  devices.data = kmalloc(sizeof(device_t *));
-  return 0;
-}
+int init_devices() { return 0; }
 
 int device_add(device_t *dev) {
-  vec_push(&devices, dev);
-  return devices.length - 1;
+  LOCK(devices_lock);
+  int index = rcu_array_push(&devices, dev);
+  UNLOCK(devices_lock);
+  return index;
 }
 
 device_t *device_get_by_id(uint32_t id) {
-  for (size_t i = 0; i < (size_t)devices.length; i++)
-    if (devices.data[i]->id == id)
-      return devices.data[i];
-  return NULL;
+  uint64_t rflags = rcu_read_lock();
+  rcu_array_t *table = RCU_READ(devices);
+
+  device_t *dev;
+  for (size_t i = 0; (dev = rcu_array_get(table, i)); i++)
+    if (dev->id == id)
+      break;
+
+  rcu_read_unlock(rflags);
+  return dev;
 }
 
 ssize_t device_read(device_t *dev, size_t start, size_t count, uint8_t *buf) {
   if (S_ISBLK(dev->type)) {
     if (start % dev->block_size) {
-      uint8_t *nbuf = kmalloc(dev->block_size);
+      scratch_scope_t scope = scratch_begin();
+      uint8_t *nbuf = scratch_alloc(dev->block_size);
 
       size_t len = MIN(dev->block_size - (start % dev->block_size), count);
 
@@ -41,7 +55,7 @@ ssize_t device_read(device_t *dev, size_t start, size_t count, uint8_t *buf) {
       buf += len;
       start += len;
 
-      kfree(nbuf);
+      scratch_end(scope);
 
       if (!count)
         return 0;
@@ -63,10 +77,11 @@ ssize_t device_read(device_t *dev, size_t start, size_t count, uint8_t *buf) {
     size_t end = count % dev->block_size;
 
     if (end) {
-      uint8_t *nbuf = kmalloc(dev->block_size);
+      scratch_scope_t scope = scratch_begin();
+      uint8_t *nbuf = scratch_alloc(dev->block_size);
       dev->read(dev, start / dev->block_size, 1, nbuf);
       memcpy(buf, nbuf + (start % dev->block_size), end);
-      kfree(nbuf);
+      scratch_end(scope);
     }
 
     return 0;
@@ -79,7 +94,8 @@ ssize_t device_read(device_t *dev, size_t start, size_t count, uint8_t *buf) {
 ssize_t device_write(device_t *dev, size_t start, size_t count, uint8_t *buf) {
   if (S_ISBLK(dev->type)) {
     if (start % dev->block_size) {
-      uint8_t *nbuf = kmalloc(dev->block_size);
+      scratch_scope_t scope = scratch_begin();
+      uint8_t *nbuf = scratch_alloc(dev->block_size);
 
       size_t len = MIN(dev->block_size - (start % dev->block_size), count);
 
@@ -91,7 +107,7 @@ ssize_t device_write(device_t *dev, size_t start, size_t count, uint8_t *buf) {
       buf += len;
       start += len;
 
-      kfree(nbuf);
+      scratch_end(scope);
 
       if (!count)
         return 0;
@@ -113,11 +129,12 @@ ssize_t device_write(device_t *dev, size_t start, size_t count, uint8_t *buf) {
     size_t end = count % dev->block_size;
 
     if (end) {
-      uint8_t *nbuf = kmalloc(dev->block_size);
+      scratch_scope_t scope = scratch_begin();
+      uint8_t *nbuf = scratch_alloc(dev->block_size);
       dev->read(dev, start / dev->block_size, 1, nbuf);
       memcpy(nbuf, buf, end);
       dev->write(dev, start / dev->block_size, 1, nbuf);
-      kfree(nbuf);
+      scratch_end(scope);
     }
 
     return 0;
@@ -127,4 +144,168 @@ ssize_t device_write(device_t *dev, size_t start, size_t count, uint8_t *buf) {
   return 1;
 }
 
-device_t *device_get(uint32_t id) { return devices.data[id]; }
+size_t iov_length(iovec_t *iov, size_t count) {
+  size_t length = 0;
+  for (size_t i = 0; i < count; i++)
+    length += iov[i].iov_len;
+  return length;
+}
+
+// Cuts iov down to length bytes, returns how many buffers are left
+size_t iov_truncate(iovec_t *iov, size_t count, size_t length) {
+  for (size_t i = 0; i < count; i++) {
+    if (iov[i].iov_len >= length) {
+      iov[i].iov_len = length;
+      return i + 1;
+    }
+    length -= iov[i].iov_len;
+  }
+  return count;
+}
+
+// Where the device sees addr, 0 if it can't. For a user process only its
+// own mappings will do, and only writable ones when the device writes to
+// them, never the kernel's memory. Kernel threads can hand over the direct
+// map.
+static uintptr_t device_dma_address(uintptr_t addr, int to_memory) {
+  proc_t *proc = get_locals()->current_thread->parent;
+
+  if (!proc->user)
+    return (addr >= PHYS_MEM_OFFSET && addr < KERNEL_MEM_OFFSET)
+             ? addr - PHYS_MEM_OFFSET
+             : 0;
+
+  if (addr >= 0x800000000000)
+    return 0;
+
+  LOCK(proc->lock);
+  uintptr_t page = vmm_range_page(proc->pagemap, addr, to_memory);
+  UNLOCK(proc->lock);
+
+  return page ? page + addr % PAGE_SIZE : 0;
+}
+
+// Splits iov into physically contiguous segments, joining neighbours back
+// up. NULL if the device can't reach some of it. DMA moves whole words, so
+// odd addresses and lengths can't go this way either.
+static dma_segment_t *device_dma_map(iovec_t *iov, size_t count,
+                                     size_t *segment_count, int to_memory) {
+  size_t max = 0;
+  for (size_t i = 0; i < count; i++) {
+    uintptr_t addr = (uintptr_t)iov[i].iov_base;
+    if (addr % 2 || iov[i].iov_len % 2)
+      return NULL;
+    max += (addr % PAGE_SIZE + iov[i].iov_len + PAGE_SIZE - 1) / PAGE_SIZE;
+  }
+
+  dma_segment_t *segments = kmalloc(max * sizeof(dma_segment_t));
+  size_t n = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    uintptr_t addr = (uintptr_t)iov[i].iov_base;
+    size_t left = iov[i].iov_len;
+
+    while (left) {
+      size_t length = MIN(PAGE_SIZE - addr % PAGE_SIZE, left);
+      uintptr_t phys = device_dma_address(addr, to_memory);
+      if (!phys) {
+        kfree(segments);
+        return NULL;
+      }
+
+      if (n && segments[n - 1].phys + segments[n - 1].length == phys)
+        segments[n - 1].length += length;
+      else
+        segments[n++] = (dma_segment_t){.phys = phys, .length = length};
+
+      addr += length;
+      left -= length;
+    }
+  }
+
+  *segment_count = n;
+  return segments;
+}
+
+// Block devices that can scatter-gather get all of it as one transfer when
+// it's whole blocks. Anything else goes a buffer at a time.
+static ssize_t device_transfer(device_t *dev, size_t start, iovec_t *iov,
+                               size_t count, int write) {
+  size_t total = iov_length(iov, count);
+  if (!total)
+    return 0;
+
+  size_t done = 0;
+
+  if (S_ISBLK(dev->type) && (write ? dev->writev : dev->readv) &&
+      !(start % dev->block_size) && !(total % dev->block_size)) {
+    size_t segment_count;
+    dma_segment_t *segments =
+      device_dma_map(iov, count, &segment_count, !write);
+
+    if (segments) {
+      ssize_t ret =
+        write ? dev->writev(dev, start / dev->block_size, segments,
+                            segment_count)
+              : dev->readv(dev, start / dev->block_size, segments,
+                           segment_count);
+      kfree(segments);
+
+      // -EINVAL or short when the device couldn't take the segments as
+      // they are, the rest goes a buffer at a time
+      if (ret < 0 && ret != -EINVAL)
+        return ret;
+      if ((size_t)ret == total)
+        return ret;
+      if (ret > 0)
+        done = ret;
+    }
+  }
+
+  size_t skip = done;
+  for (size_t i = 0; i < count; i++) {
+    size_t length = iov[i].iov_len;
+    if (skip >= length) {
+      skip -= length;
+      continue;
+    }
+
+    uint8_t *base = (uint8_t *)iov[i].iov_base + skip;
+    length -= skip;
+    skip = 0;
+
+    ssize_t ret = write ? device_write(dev, start + done, length, base)
+                        : device_read(dev, start + done, length, base);
+
+    // Only character devices say how much they moved
+    if (!S_ISCHR(dev->type)) {
+      done += length;
+      continue;
+    }
+
+    if (ret < 0)
+      return done ? (ssize_t)done : ret;
+    done += ret;
+    if ((size_t)ret < length)
+      break;
+  }
+
+  return done;
+}
+
+// Returns how much was read, unlike device_read
+ssize_t device_readv(device_t *dev, size_t start, iovec_t *iov, size_t count) {
+  return device_transfer(dev, start, iov, count, 0);
+}
+
+ssize_t device_writev(device_t *dev, size_t start, iovec_t *iov,
+                      size_t count) {
+  return device_transfer(dev, start, iov, count, 1);
+}
+
+device_t *device_get(uint32_t id) {
+  uint64_t rflags = rcu_read_lock();
+  device_t *dev = rcu_array_get(RCU_READ(devices), id);
+  rcu_read_unlock(rflags);
+  return dev;
+}
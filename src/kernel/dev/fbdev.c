@@ -30,7 +30,7 @@ void *fb_mmap(device_t *dev, pagemap_t *pg, syscall_file_t *sfile, void *addr,
     .virt_addr = (uintptr_t)addr,
   };
 
-  vec_push(&pg->ranges, mmap_range);
+  vmm_add_range(pg, mmap_range);
 
   return (void *)vmm_virt_to_phys(&kernel_pagemap, (uintptr_t)framebuffer);
 }
@@ -0,0 +1,84 @@
+#include <dev/device.h>
+#include <dev/kheapstat.h>
+#include <fs/vfs.h>
+#include <mm/kheap.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+// Reads return a kheap_stats_t followed by one kheap_site_stats_t per call
+// site. Every read takes a fresh snapshot, so read it all in one go.
+
+ssize_t kheapstat_read(device_t *dev, size_t start, size_t count,
+                       uint8_t *buf) {
+  (void)dev;
+
+  size_t size = sizeof(kheap_stats_t) +
+                sizeof(kheap_site_stats_t) * KHEAP_STATS_SITES;
+  uint8_t *snapshot = kmalloc(size);
+
+  size_t sites = kheap_stats_snapshot(
+    (kheap_stats_t *)snapshot,
+    (kheap_site_stats_t *)(snapshot + sizeof(kheap_stats_t)),
+    KHEAP_STATS_SITES);
+  size = sizeof(kheap_stats_t) + sizeof(kheap_site_stats_t) * sites;
+
+  if (start >= size) {
+    kfree(snapshot);
+    return 0;
+  }
+
+  count = MIN(count, size - start);
+  memcpy(buf, snapshot + start, count);
+
+  kfree(snapshot);
+
+  return count;
+}
+
+ssize_t kheapstat_write(device_t *dev, size_t start, size_t count,
+                        uint8_t *buf) {
+  (void)dev;
+  (void)start;
+  (void)count;
+  (void)buf;
+  return 0;
+}
+
+uint64_t kheapstat_ioctl(device_t *dev, uint64_t cmd, void *arg) {
+  (void)dev;
+  (void)cmd;
+  (void)arg;
+  return -1;
+}
+
+static device_t kheapstat = (device_t){
+  .block_count = 0,
+  .block_size = 0,
+  .fs = NULL,
+  .id = 1012,
+  .name = "kheapstat",
+  .private_data = NULL,
+  .read = kheapstat_read,
+  .write = kheapstat_write,
+  .ioctl = kheapstat_ioctl,
+  .type = S_IFCHR,
+};
+
+int init_kheapstat(char *mount_place) {
+  char *str = kcalloc(strlen(mount_place) + 12);
+  strcpy(str, mount_place);
+
+  if (str[strlen(str) - 1] != '/')
+    str[strlen(str)] = '/';
+
+  strcat(str, "kheapstat");
+
+  device_add(&kheapstat);
+
+  int val = (vfs_mknod(str, 0444 | S_IFCHR, 0, 0, &kheapstat)) ? 0 : 1;
+  kfree(str);
+  return val;
+}
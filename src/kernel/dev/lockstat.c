@@ -0,0 +1,87 @@
+#include <dev/device.h>
+#include <dev/lockstat.h>
+#include <fs/vfs.h>
+#include <lock.h>
+#include <mm/kheap.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+#define LOCKSTAT_MAX 256
+
+// Reads return one lock_stat_t per ticket lock that keeps counters. Every
+// read takes a fresh snapshot, so read it all in one go.
+
+ssize_t lockstat_read(device_t *dev, size_t start, size_t count,
+                      uint8_t *buf) {
+  (void)dev;
+
+  lock_stat_t *snapshot = kmalloc(sizeof(lock_stat_t) * LOCKSTAT_MAX);
+  size_t size =
+    sizeof(lock_stat_t) * lock_stats_snapshot(snapshot, LOCKSTAT_MAX);
+
+  if (start >= size) {
+    kfree(snapshot);
+    return 0;
+  }
+
+  count = MIN(count, size - start);
+  memcpy(buf, (uint8_t *)snapshot + start, count);
+
+  kfree(snapshot);
+
+  return count;
+}
+
+ssize_t lockstat_write(device_t *dev, size_t start, size_t count,
+                       uint8_t *buf) {
+  (void)dev;
+  (void)start;
+  (void)count;
+  (void)buf;
+  return 0;
+}
+
+uint64_t lockstat_ioctl(device_t *dev, uint64_t cmd, void *arg) {
+  (void)dev;
+  (void)arg;
+
+  switch (cmd) {
+    case IOCTL_LOCKSTAT_RESET:
+      lock_stats_reset();
+      return 0;
+  }
+
+  return -1;
+}
+
+static device_t lockstat = (device_t){
+  .block_count = 0,
+  .block_size = 0,
+  .fs = NULL,
+  .id = 1014,
+  .name = "lockstat",
+  .private_data = NULL,
+  .read = lockstat_read,
+  .write = lockstat_write,
+  .ioctl = lockstat_ioctl,
+  .type = S_IFCHR,
+};
+
+int init_lockstat(char *mount_place) {
+  char *str = kcalloc(strlen(mount_place) + 12);
+  strcpy(str, mount_place);
+
+  if (str[strlen(str) - 1] != '/')
+    str[strlen(str)] = '/';
+
+  strcat(str, "lockstat");
+
+  device_add(&lockstat);
+
+  int val = (vfs_mknod(str, 0444 | S_IFCHR, 0, 0, &lockstat)) ? 0 : 1;
+  kfree(str);
+  return val;
+}
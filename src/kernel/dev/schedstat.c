@@ -0,0 +1,96 @@
+#include <dev/device.h>
+#include <dev/schedstat.h>
+#include <fs/vfs.h>
+#include <mm/kheap.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <tasking/scheduler.h>
+#include <tasking/smp.h>
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+// Reads return a sched_stats_t, one sched_cpu_stats_t per CPU and then one
+// sched_thread_stats_t per thread. Every read takes a fresh snapshot, so
+// read it all in one go.
+
+ssize_t schedstat_read(device_t *dev, size_t start, size_t count,
+                       uint8_t *buf) {
+  (void)dev;
+
+  size_t cpus_size = sizeof(sched_cpu_stats_t) * smp_cpu_count;
+  size_t size = sizeof(sched_stats_t) + cpus_size +
+                sizeof(sched_thread_stats_t) * SCHED_STATS_THREADS;
+  uint8_t *snapshot = kmalloc(size);
+
+  size_t threads = sched_stats_snapshot(
+    (sched_stats_t *)snapshot,
+    (sched_cpu_stats_t *)(snapshot + sizeof(sched_stats_t)),
+    (sched_thread_stats_t *)(snapshot + sizeof(sched_stats_t) + cpus_size),
+    SCHED_STATS_THREADS);
+  size = sizeof(sched_stats_t) + cpus_size +
+         sizeof(sched_thread_stats_t) * threads;
+
+  if (start >= size) {
+    kfree(snapshot);
+    return 0;
+  }
+
+  count = MIN(count, size - start);
+  memcpy(buf, snapshot + start, count);
+
+  kfree(snapshot);
+
+  return count;
+}
+
+ssize_t schedstat_write(device_t *dev, size_t start, size_t count,
+                        uint8_t *buf) {
+  (void)dev;
+  (void)start;
+  (void)count;
+  (void)buf;
+  return 0;
+}
+
+uint64_t schedstat_ioctl(device_t *dev, uint64_t cmd, void *arg) {
+  (void)dev;
+  (void)arg;
+
+  switch (cmd) {
+    case IOCTL_SCHEDSTAT_RESET:
+      sched_stats_reset();
+      return 0;
+  }
+
+  return -1;
+}
+
+static device_t schedstat = (device_t){
+  .block_count = 0,
+  .block_size = 0,
+  .fs = NULL,
+  .id = 1013,
+  .name = "schedstat",
+  .private_data = NULL,
+  .read = schedstat_read,
+  .write = schedstat_write,
+  .ioctl = schedstat_ioctl,
+  .type = S_IFCHR,
+};
+
+int init_schedstat(char *mount_place) {
+  char *str = kcalloc(strlen(mount_place) + 12);
+  strcpy(str, mount_place);
+
+  if (str[strlen(str) - 1] != '/')
+    str[strlen(str)] = '/';
+
+  strcat(str, "schedstat");
+
+  device_add(&schedstat);
+
+  int val = (vfs_mknod(str, 0444 | S_IFCHR, 0, 0, &schedstat)) ? 0 : 1;
+  kfree(str);
+  return val;
+}
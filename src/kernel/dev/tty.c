@@ -1,6 +1,7 @@
 #include <dev/device.h>
 #include <dev/tty.h>
 #include <drivers/ps2.h>
+#include <errno.h>
 #include <fb/fb.h>
 #include <fs/vfs.h>
 #include <lock.h>
@@ -9,6 +10,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <tasking/scheduler.h>
 
 ssize_t tty_write(device_t *dev, size_t start, size_t count, uint8_t *buf) {
   (void)start;
@@ -26,8 +28,13 @@ ssize_t tty_read(device_t *dev, size_t start, size_t count, uint8_t *buf) {
   size_t init_count = count;
   while (count) {
     char c = getchar();
-    if (!c)
-      continue;
+    if (!c) {
+      if (!sched_interrupted())
+        continue;
+      if (count == init_count)
+        return -EINTR;
+      break;
+    }
     putchar(c);
     buf[init_count - count] = c;
     count--;
@@ -35,7 +42,8 @@ ssize_t tty_read(device_t *dev, size_t start, size_t count, uint8_t *buf) {
       break;
   }
 
-  buf[init_count - count + 1] = 0;
+  if (count)
+    buf[init_count - count] = 0;
 
   return init_count - count;
 }
@@ -2,6 +2,7 @@
 #include <dev/device.h>
 #include <drivers/ahci.h>
 #include <drivers/mbr.h>
+#include <errno.h>
 #include <fs/vfs.h>
 #include <klog.h>
 #include <mm/kheap.h>
@@ -35,6 +36,14 @@
 #define ATA_CMD_WRITE_DMA_EX 0x35
 
 #define HBA_PXIS_TFES (1 << 30)
+
+// The command table is one page, dbc is 22 bits and the count 16
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+#define AHCI_PRDT_MAX ((PAGE_SIZE - sizeof(hba_cmd_tbl_t)) / \
+                       sizeof(hba_prdt_entry_t) + 1)
+#define AHCI_PRDT_BYTES_MAX (4 * 1024 * 1024)
+#define AHCI_SECTORS_MAX 0xffff
 #define ATA_DEV_BUSY 0x80
 #define ATA_DEV_DRQ 0x08
 
@@ -295,6 +304,159 @@ ssize_t sata_write(device_t *dev, size_t start, size_t count, uint8_t *buf) {
   return count * 512;
 }
 
+// As many of the segments as fit in one command, from seg_offset bytes into
+// the first one. Returns the sectors it covered.
+static ssize_t sata_issue(hba_port_t *port, uint64_t start,
+                          dma_segment_t *segments, size_t count,
+                          size_t *seg, size_t *seg_offset, int write) {
+  port->is = (uint32_t)-1;
+
+  int8_t slot = ahci_find_cmdslot(port);
+  if (slot == -1)
+    return -EIO;
+
+  hba_cmd_header_t *cmd_header =
+    (hba_cmd_header_t *)((uintptr_t)(port->clb + PHYS_MEM_OFFSET));
+  cmd_header += slot;
+
+  hba_cmd_tbl_t *cmd_table =
+    (hba_cmd_tbl_t *)((uintptr_t)cmd_header->ctba + PHYS_MEM_OFFSET);
+  memset(cmd_table, 0, PAGE_SIZE);
+
+  size_t entries = 0;
+  size_t bytes = 0;
+  size_t max_bytes = AHCI_SECTORS_MAX * 512;
+
+  while (*seg < count && entries < AHCI_PRDT_MAX && bytes < max_bytes) {
+    size_t length = segments[*seg].length - *seg_offset;
+    length = MIN(length, AHCI_PRDT_BYTES_MAX);
+    length = MIN(length, max_bytes - bytes);
+    uintptr_t phys = segments[*seg].phys + *seg_offset;
+
+    cmd_table->prdt_entry[entries].dba = (uint32_t)phys;
+    cmd_table->prdt_entry[entries].dbau = (uint32_t)(phys >> 32);
+    cmd_table->prdt_entry[entries].dbc = length - 1;
+    cmd_table->prdt_entry[entries].i = 1;
+    entries++;
+    bytes += length;
+
+    *seg_offset += length;
+    if (*seg_offset == segments[*seg].length) {
+      (*seg)++;
+      *seg_offset = 0;
+    }
+  }
+
+  // Leave a partial sector at the end for the next command
+  size_t tail = bytes % 512;
+  bytes -= tail;
+  while (tail) {
+    size_t last = cmd_table->prdt_entry[entries - 1].dbc + 1;
+    size_t cut = MIN(last, tail);
+
+    if (*seg_offset)
+      *seg_offset -= cut;
+    else
+      *seg_offset = segments[--(*seg)].length - cut;
+
+    if (cut == last)
+      memset(&cmd_table->prdt_entry[--entries], 0, sizeof(hba_prdt_entry_t));
+    else
+      cmd_table->prdt_entry[entries - 1].dbc -= cut;
+    tail -= cut;
+  }
+
+  // Too many small buffers to make up a sector. device_transfer takes it
+  // from here a buffer at a time.
+  if (!entries)
+    return -EINVAL;
+
+  uint32_t sectors = bytes / 512;
+
+  cmd_header->cfl = sizeof(fis_reg_host_to_device_t) / sizeof(uint32_t);
+  cmd_header->w = write;
+  cmd_header->c = write;
+  cmd_header->p = write;
+  cmd_header->prdtl = entries;
+
+  fis_reg_host_to_device_t *cmd_fis =
+    (fis_reg_host_to_device_t *)(&cmd_table->cfis);
+
+  cmd_fis->fis_type = FIS_TYPE_REG_HOST_TO_DEVICE;
+  cmd_fis->c = 1;
+  cmd_fis->command = write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX;
+
+  cmd_fis->lba0 = (uint8_t)start;
+  cmd_fis->lba1 = (uint8_t)(start >> 8);
+  cmd_fis->lba2 = (uint8_t)(start >> 16);
+  cmd_fis->device = 1 << 6;
+
+  cmd_fis->lba3 = (uint8_t)(start >> 24);
+  cmd_fis->lba4 = (uint8_t)(start >> 32);
+  cmd_fis->lba5 = (uint8_t)(start >> 40);
+
+  cmd_fis->countl = (sectors & 0xFF);
+  cmd_fis->counth = (sectors >> 8);
+
+  for (uint32_t spin = 0; spin < 1000000; spin++) {
+    if (!(port->tfd & (ATA_DEV_BUSY | ATA_DEV_DRQ)))
+      break;
+  }
+  if ((port->tfd & (ATA_DEV_BUSY | ATA_DEV_DRQ)))
+    return -EIO;
+
+  port->ci = (1 << slot);
+
+  while (1) {
+    if (!(port->ci & (1 << slot)))
+      break;
+    if (port->is & HBA_PXIS_TFES)
+      return -EIO;
+  }
+
+  if (port->is & HBA_PXIS_TFES)
+    return -EIO;
+
+  return sectors;
+}
+
+// One command per AHCI_PRDT_MAX segments instead of one per buffer
+static ssize_t sata_transfer(device_t *dev, size_t start,
+                             dma_segment_t *segments, size_t count,
+                             int write) {
+  ahci_private_data_t *data = dev->private_data;
+  uint64_t start64 = (uint64_t)start;
+
+  if (data->part)
+    start64 += data->part->sector_start;
+
+  size_t seg = 0;
+  size_t seg_offset = 0;
+  size_t total = 0;
+
+  while (seg < count) {
+    ssize_t sectors = sata_issue(data->port, start64, segments, count, &seg,
+                                 &seg_offset, write);
+    if (sectors < 0)
+      return total ? (ssize_t)total : sectors;
+
+    start64 += sectors;
+    total += sectors * 512;
+  }
+
+  return total;
+}
+
+ssize_t sata_readv(device_t *dev, size_t start, dma_segment_t *segments,
+                   size_t count) {
+  return sata_transfer(dev, start, segments, count, 0);
+}
+
+ssize_t sata_writev(device_t *dev, size_t start, dma_segment_t *segments,
+                    size_t count) {
+  return sata_transfer(dev, start, segments, count, 1);
+}
+
 void ahci_init_abars() {
   for (size_t j = 0; j < (size_t)abars.length; j++) {
     hba_mem_t *abar = (hba_mem_t *)abars.data[j];
@@ -341,6 +503,8 @@ void ahci_init_abars() {
             .block_size = 512,
             .read = sata_read,
             .write = sata_write,
+            .readv = sata_readv,
+            .writev = sata_writev,
           };
 
           *((ahci_private_data_t *)main_dev->private_data) =
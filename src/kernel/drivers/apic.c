@@ -67,6 +67,8 @@ void lapic_send_ipi(uint8_t lapic_id, uint8_t vect) {
 
 void init_lapic() { lapic_enable(0xff); }
 
+static uint64_t tsc_freq = 0;
+
 void lapic_timer_get_freq() {
   lapic_timer_stop();
 
@@ -74,17 +76,28 @@ void lapic_timer_get_freq() {
   lapic_write(LAPIC_REG_TIMER_DIV, 0);
 
   uint64_t initial_pit_tick = (uint64_t)pit_read_count();
+  uint64_t initial_tsc = rdtsc();
 
   lapic_write(LAPIC_REG_TIMER_INITCNT, (uint32_t)0xfffff);
   while (lapic_read(LAPIC_REG_TIMER_CURCNT) != 0)
     ;
 
   uint64_t final_pit_tick = (uint64_t)pit_read_count();
+  uint64_t final_tsc = rdtsc();
 
   uint64_t pit_ticks = initial_pit_tick - final_pit_tick;
   cpu_locals_t *local = get_locals();
   local->lapic_timer_freq = (0xfffff / pit_ticks) * 1193182;
 
+  // Each CPU's measurement comes out a little different, and sched_time
+  // would jump whenever a thread moved. The TSC is shared, so the first
+  // calibration stands for every CPU.
+  uint64_t measured = (final_tsc - initial_tsc) * 1193182 / pit_ticks;
+  uint64_t expected = 0;
+  __atomic_compare_exchange_n(&tsc_freq, &expected, measured, 0,
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  local->tsc_freq = LOCKED_READ(tsc_freq);
+
   lapic_timer_stop();
 }
 
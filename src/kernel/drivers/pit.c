@@ -4,6 +4,7 @@
 #include <drivers/pit.h>
 #include <stdint.h>
 #include <sys/irq.h>
+#include <tasking/scheduler.h>
 
 static volatile uint64_t timer_ticks = 0;
 
@@ -19,11 +20,9 @@ void pit_handler(uint64_t rsp) {
   timer_ticks++;
 }
 
-void pit_sleep(uint64_t ticks) {
-  uint64_t rest_ticks = timer_ticks + ticks;
-  while (timer_ticks < rest_ticks)
-    ;
-}
+// The PIT interrupt isn't hooked up, so this sleeps on the timer wheel.
+// ticks are milliseconds.
+void pit_sleep(uint64_t ticks) { sched_sleep(sched_time() + ticks * 1000); }
 
 uint16_t pit_read_count() {
   outb(0x43, 0);
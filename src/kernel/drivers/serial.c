@@ -45,21 +45,21 @@ int serial_init_port(uint16_t base, uint16_t divisor) {
 }
 
 int serial_is_transmit_fifo_empty(uint32_t base) {
-  LOCK(serial_lock);
+  uint64_t rflags = spin_lock_irqsave(&serial_lock);
 
   int out = inb(SERIAL_LINE_STATUS(base)) & 20;
 
-  UNLOCK(serial_lock);
+  spin_unlock_irqrestore(&serial_lock, rflags);
 
   return out;
 }
 
 void serial_write_byte_port(uint16_t base, char byte) {
-  LOCK(serial_lock);
+  uint64_t rflags = spin_lock_irqsave(&serial_lock);
 
   outb(SERIAL_DATA_PORT(base), byte);
 
-  UNLOCK(serial_lock);
+  spin_unlock_irqrestore(&serial_lock, rflags);
 }
 
 void serial_write_port(uint16_t base, char *buf, size_t len) {
@@ -77,14 +77,14 @@ void serial_print_port(uint16_t base, char *buf) {
 }
 
 int init_serial() {
-  LOCK(serial_lock);
+  uint64_t rflags = spin_lock_irqsave(&serial_lock);
 
   serial_init_port(SERIAL_COM1_BASE, 3);
   /* init_serial_port(SERIAL_COM2_BASE, 3); */
   /* init_serial_port(SERIAL_COM3_BASE, 3); */
   /* init_serial_port(SERIAL_COM4_BASE, 3); */
 
-  UNLOCK(serial_lock);
+  spin_unlock_irqrestore(&serial_lock, rflags);
 
   return 0;
 }
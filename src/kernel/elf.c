@@ -31,14 +31,19 @@ char elf_ident[4] = {0x7f, 'E', 'L', 'F'};
 
 uint8_t elf_run_binary(char *path, pagemap_t *pagemap, uintptr_t *entry) {
   fs_file_t *file = vfs_open(path);
+  if (!file)
+    return 1;
+
   uint8_t *buffer = kmalloc(file->length);
   vfs_read(file, buffer, 0, file->length);
+  vfs_close(file);
 
   elf_header_t *header = (elf_header_t *)buffer;
-  if (header->type != ELF_EXECUTABLE)
-    return 1;
-  if (memcmp((void *)header->identifier, elf_ident, 4))
+  if (header->type != ELF_EXECUTABLE ||
+      memcmp((void *)header->identifier, elf_ident, 4)) {
+    kfree(buffer);
     return 1;
+  }
 
   elf_header_t *elf_header = (elf_header_t *)buffer;
   elf_prog_header_t *prog_header = (void *)(buffer + elf_header->prog_head_off);
@@ -85,5 +90,7 @@ uint8_t elf_run_binary(char *path, pagemap_t *pagemap, uintptr_t *entry) {
   if (entry)
     *entry = elf_header->entry;
 
+  kfree(buffer);
+
   return 0;
 }
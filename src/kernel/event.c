@@ -1,33 +1,107 @@
+#include <cpu_locals.h>
 #include <event.h>
 #include <lock.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <tasking/scheduler.h>
+#include <vec.h>
+
+static void event_remove_listener(event_t *event, thread_t *thread) {
+  for (int i = 0; i < event->listeners.length; i++)
+    if (event->listeners.data[i].thread == thread) {
+      vec_splice(&event->listeners, i, 1);
+      return;
+    }
+}
+
+// The event locks are never taken from interrupt context, but waking a
+// thread takes a run queue lock, and those are. Interrupts stay off for as
+// long as an event lock is held so the timer can't land in the middle.
+static int event_wait(event_t **events, size_t count, int block,
+                      uint64_t deadline) {
+  uint64_t rflags = lock_irq_save();
+  thread_t *thread = get_locals()->current_thread;
 
-int event_await(event_t **events, size_t count, int block) {
   for (size_t i = 0; i < count; i++)
     LOCK(events[i]->lock);
 
   for (size_t i = 0; i < count; i++)
     if (events[i]->pending) {
       events[i]->pending--;
+      for (size_t j = 0; j < count; j++)
+        UNLOCK(events[j]->lock);
+      lock_irq_restore(rflags);
       return i;
     }
 
-  for (size_t i = 0; i < count; i++)
+  if (!block) {
+    for (size_t i = 0; i < count; i++)
+      UNLOCK(events[i]->lock);
+    lock_irq_restore(rflags);
+    return -1;
+  }
+
+  // Nobody can trigger us until the locks are dropped, so the thread is
+  // off its run queue before any waker can see it
+  thread->which_event = (size_t)-1;
+  sched_block(thread, deadline);
+
+  for (size_t i = 0; i < count; i++) {
+    vec_push(&events[i]->listeners, ((event_listener_t){thread, i}));
     UNLOCK(events[i]->lock);
+  }
 
-  if (!block)
-    return -1;
+  sched_wait(thread);
 
-  while (1)
-    for (size_t i = 0; i < count; i++)
-      if (events[i]->pending) {
-        events[i]->pending--;
-        return i;
-      }
+  // Whichever event didn't wake us still has us listed
+  for (size_t i = 0; i < count; i++) {
+    LOCK(events[i]->lock);
+    event_remove_listener(events[i], thread);
+    UNLOCK(events[i]->lock);
+  }
+
+  lock_irq_restore(rflags);
+
+  return (int)thread->which_event;
+}
+
+// Returns the index of the event that fired, or -1 if none did and block
+// is 0
+int event_await(event_t **events, size_t count, int block) {
+  return event_wait(events, count, block, 0);
+}
+
+// Like a blocking event_await, but gives up with -1 after timeout
+// microseconds
+int event_await_timeout(event_t **events, size_t count, uint64_t timeout) {
+  if (!timeout)
+    return event_wait(events, count, 0, 0);
+  return event_wait(events, count, 1, sched_time() + timeout);
 }
 
-void event_trigger(event_t *event) {
+// Wakes the longest waiting thread, or all of them. A trigger that wakes
+// nobody is remembered for the next event_await.
+void event_trigger(event_t *event, int all) {
+  uint64_t rflags = lock_irq_save();
+  size_t woken = 0;
+
   LOCK(event->lock);
-  event->pending++;
+
+  while (event->listeners.length) {
+    event_listener_t listener = event->listeners.data[0];
+    vec_splice(&event->listeners, 0, 1);
+
+    // Listeners of threads that already woke up elsewhere are skipped
+    if (sched_wake(listener.thread, listener.which)) {
+      woken++;
+      if (!all)
+        break;
+    }
+  }
+
+  if (!woken)
+    event->pending++;
+
   UNLOCK(event->lock);
+  lock_irq_restore(rflags);
 }
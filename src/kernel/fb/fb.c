@@ -5,6 +5,7 @@
 #include <mm/pmm.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
 uint32_t *framebuffer;
 uint16_t fb_height;
@@ -26,21 +27,21 @@ int init_fb(struct stivale2_struct_tag_framebuffer *framebuffer_info) {
 }
 
 void fb_set_bg(uint32_t bg_col) {
-  LOCK(fb_lock);
+  uint64_t rflags = spin_lock_irqsave(&fb_lock);
   curr_bg_col = bg_col;
-  UNLOCK(fb_lock);
+  spin_unlock_irqrestore(&fb_lock, rflags);
 }
 
 void fb_set_fg(uint32_t fg_col) {
-  LOCK(fb_lock);
+  uint64_t rflags = spin_lock_irqsave(&fb_lock);
   curr_fg_col = fg_col;
-  UNLOCK(fb_lock);
+  spin_unlock_irqrestore(&fb_lock, rflags);
 }
 
 void fb_putpixel(size_t x, size_t y, uint32_t colour) {
-  LOCK(fb_lock);
+  uint64_t rflags = spin_lock_irqsave(&fb_lock);
   framebuffer[y * fb_width + x] = colour;
-  UNLOCK(fb_lock);
+  spin_unlock_irqrestore(&fb_lock, rflags);
 }
 
 void putnc(int x, int y, char c, uint32_t fgc, uint32_t bgc) {
@@ -55,10 +56,12 @@ void putnc(int x, int y, char c, uint32_t fgc, uint32_t bgc) {
 }
 
 void knewline() {
-  for (size_t i = 0; i < (fb_width * fb_height); i++)
-    framebuffer[i] = (framebuffer + fb_width * FONT_HEIGHT)[i];
-  for (size_t i = 0; i < (fb_width * fb_height); i++)
-    framebuffer[i] = (framebuffer + fb_width * FONT_HEIGHT)[i];
+  size_t row = fb_width * FONT_HEIGHT;
+  size_t screen = fb_width * fb_height;
+
+  // memcpy only ever copies forwards, so scrolling up in place is fine
+  memcpy(framebuffer, framebuffer + row, (screen - row) * sizeof(uint32_t));
+  memset32(framebuffer + screen - row, curr_bg_col, row);
 
   curr_y -= FONT_HEIGHT;
   curr_x = 0;
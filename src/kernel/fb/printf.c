@@ -11,6 +11,8 @@
 #include <string.h>
 #include <vprintf.h>
 
+// klog is called under cli and the exception handlers print too, so this
+// and the serial and fb locks taken under it keep interrupts off
 static lock_t printf_lock = {0};
 
 // Not my implementation. Taken from https://wiki.osdev.org/User:A22347/Printf
@@ -155,7 +157,7 @@ void displayString(char *c, int *a) {
 }
 
 int vprintf(const char *format, va_list list) {
-  LOCK(printf_lock);
+  uint64_t rflags = spin_lock_irqsave(&printf_lock);
 
   int chars = 0;
   char intStrBuffer[256] = {0};
@@ -479,7 +481,7 @@ int vprintf(const char *format, va_list list) {
     }
   }
 
-  UNLOCK(printf_lock);
+  spin_unlock_irqrestore(&printf_lock, rflags);
 
   return chars;
 }
@@ -7,12 +7,15 @@
 #include <klog.h>
 #include <mm/kheap.h>
 #include <mm/pmm.h>
+#include <mm/scratch.h>
 #include <mm/vmm.h>
 #include <printf.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
 uint64_t fat_cluster_to_sector(device_t *dev, uint32_t cluster) {
   cluster -= 2;
   return (
@@ -28,7 +31,8 @@ uint64_t fat_cluster_to_sector(device_t *dev, uint32_t cluster) {
 }
 
 uint32_t fat_get_next_cluster(device_t *dev, uint32_t cluster) {
-  uint8_t *buf = kmalloc(512);
+  scratch_scope_t scope = scratch_begin();
+  uint8_t *buf = scratch_alloc(512);
   uint64_t fat_sector =
     ((fat_fs_private_info_t *)dev->fs->private_data)->boot.reserved_sectors +
     ((cluster * 4) / 512);
@@ -37,7 +41,7 @@ uint32_t fat_get_next_cluster(device_t *dev, uint32_t cluster) {
 
   uint32_t ret = *((uint32_t *)&buf[(cluster * 4) % 512]) & 0xfffffff;
 
-  kfree(buf);
+  scratch_end(scope);
 
   return ret;
 }
@@ -59,22 +63,21 @@ void fat_read_cluster_chain(device_t *dev, uint8_t *buffer, uint32_t cluster) {
 }
 
 size_t fat_chain_cluster_length(device_t *dev, uint32_t cluster) {
-  uint8_t *buffer = kmalloc(512);
   size_t count = 0;
 
+  // Only the FAT is needed to walk the chain, not the cluster contents
   while (cluster >= 2 && cluster < 0xffffff7) {
-    cluster = fat_read_cluster(dev, buffer, cluster);
+    cluster = fat_get_next_cluster(dev, cluster);
     count++;
   }
 
-  kfree(buffer);
-
   return count;
 }
 
 void fat_change_fat_value(device_t *dev, uint32_t current_cluster,
                           uint32_t next_cluster) {
-  uint8_t *buffer = kmalloc(512);
+  scratch_scope_t scope = scratch_begin();
+  uint8_t *buffer = scratch_alloc(512);
   uint64_t sector =
     ((fat_fs_private_info_t *)dev->fs->private_data)->boot.reserved_sectors +
     ((current_cluster * 4) / 512);
@@ -85,11 +88,12 @@ void fat_change_fat_value(device_t *dev, uint32_t current_cluster,
 
   dev->write(dev, sector, 1, (uint8_t *)buffer);
 
-  kfree(buffer);
+  scratch_end(scope);
 }
 
 uint32_t fat_find_free_cluster(device_t *dev) {
-  uint32_t *fat_buffer = kmalloc(128 * sizeof(uint32_t));
+  scratch_scope_t scope = scratch_begin();
+  uint32_t *fat_buffer = scratch_alloc(128 * sizeof(uint32_t));
 
   for (size_t i = 0;
        i < ((fat_fs_private_info_t *)dev->fs->private_data)->boot.table_size;
@@ -102,12 +106,12 @@ uint32_t fat_find_free_cluster(device_t *dev) {
 
     for (uint8_t j = 0; j < 128; j++)
       if (!fat_buffer[j]) {
-        kfree(fat_buffer);
+        scratch_end(scope);
         return (i * 128 + j) & 0xfffffff;
       }
   }
 
-  kfree(fat_buffer);
+  scratch_end(scope);
 
   return 0xfffffff;
 }
@@ -376,6 +380,7 @@ uint32_t fat_find(device_t *dev, uint32_t directory,
         if (*path == '/' && cluster->directory) {
           kfree(path_name);
           kfree(long_filename);
+          kfree(short_name);
           kfree(buffer);
 
           if (*(path + 2) != '.' && *(path + 3) != '.')
@@ -403,7 +408,6 @@ uint32_t fat_find(device_t *dev, uint32_t directory,
 
       kfree(path_name);
       kfree(long_filename);
-      kfree(short_name);
 
     } else {
       if (!strncmp(short_name, (char *)cluster->filename, 11)) {
@@ -541,7 +545,9 @@ int fat_truncate(fs_file_t *file, size_t size) {
   return 0;
 }
 
-ssize_t fat_read(fs_file_t *file, uint8_t *buf, size_t offset, size_t count) {
+// Reads the cluster chain once and scatters it, rather than once a buffer
+ssize_t fat_readv(fs_file_t *file, iovec_t *iov, size_t iov_count,
+                  size_t offset) {
   datetime_t time = rtc_get_datetime();
   time.year += 1900;
 
@@ -556,7 +562,9 @@ ssize_t fat_read(fs_file_t *file, uint8_t *buf, size_t offset, size_t count) {
 
   fat_set_dir_entry(file->fs->dev, dir, index, entry);
 
-  if (entry.directory)
+  size_t count = iov_length(iov, iov_count);
+
+  if (entry.directory || offset >= entry.size)
     return 0;
   if (entry.size < offset + count)
     count = entry.size - offset;
@@ -568,13 +576,23 @@ ssize_t fat_read(fs_file_t *file, uint8_t *buf, size_t offset, size_t count) {
     file->fs->dev, file_buffer,
     ((uint32_t)(entry.cluster_hi << 16) | (uint32_t)(entry.cluster_lo)));
 
-  memcpy(buf, file_buffer + offset, count);
+  size_t done = 0;
+  for (size_t i = 0; i < iov_count && done < count; i++) {
+    size_t length = MIN(iov[i].iov_len, count - done);
+    memcpy(iov[i].iov_base, file_buffer + offset + done, length);
+    done += length;
+  }
 
   kfree(file_buffer);
 
   return count;
 }
 
+ssize_t fat_read(fs_file_t *file, uint8_t *buf, size_t offset, size_t count) {
+  iovec_t iov = {.iov_base = buf, .iov_len = count};
+  return fat_readv(file, &iov, 1, offset);
+}
+
 ssize_t fat_write(fs_file_t *file, uint8_t *buf, size_t offset, size_t count) {
   datetime_t time = rtc_get_datetime();
 
@@ -756,6 +774,7 @@ int fat_rmdir(fs_file_t *file) {
 file_ops_t fat_file_ops = (file_ops_t){
   .read = fat_read,
   .write = fat_write,
+  .readv = fat_readv,
   .rmdir = fat_rmdir,
   .delete = fat_delete,
   .truncate = fat_truncate,
@@ -770,8 +789,10 @@ file_ops_t fat_file_ops = (file_ops_t){
 fs_file_t *fat_open(fs_t *fs, char *path) {
   fat_file_private_info_t *priv = kmalloc(sizeof(fat_file_private_info_t));
   if ((priv->cluster = fat_find(fs->dev, 0, &priv->dir, &priv->parent_cluster,
-                                &priv->index, path)) == 0xfffffff)
+                                &priv->index, path)) == 0xfffffff) {
+    kfree(priv);
     return NULL;
+  }
 
   fs_file_t *file = kmalloc(sizeof(fs_file_t));
   *file = (fs_file_t){
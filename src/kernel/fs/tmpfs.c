@@ -160,9 +160,10 @@ int tmpfs_chown(fs_file_t *file, int uid, int gid) {
 }
 
 fs_file_t *tmpfs_open(fs_t *fs, char *name) {
-  fs_file_t *q_file = kmalloc(sizeof(fs_file_t));
+  fs_file_t *q_file = NULL;
   if ((tmpfs_find(fs, name, &q_file, NULL)))
     return NULL;
+  q_file->ref_count++;
   return q_file;
 }
 
@@ -182,7 +183,7 @@ file_ops_t tmpfs_file_ops = (file_ops_t){
 fs_file_t *tmpfs_create(fs_t *fs, char *path, int mode, int uid, int gid) {
   posix_time_t tim = rtc_mktime(rtc_get_datetime());
 
-  fs_file_t *parent_dir = kmalloc(sizeof(fs_file_t));
+  fs_file_t *parent_dir = NULL;
 
   if (!tmpfs_find(fs, path, NULL, &parent_dir))
     return tmpfs_open(fs, path);
@@ -228,7 +229,7 @@ fs_file_t *tmpfs_create(fs_t *fs, char *path, int mode, int uid, int gid) {
 fs_file_t *tmpfs_mkfifo(fs_t *fs, char *path, int mode, int uid, int gid) {
   posix_time_t tim = rtc_mktime(rtc_get_datetime());
 
-  fs_file_t *parent_dir = kmalloc(sizeof(fs_file_t));
+  fs_file_t *parent_dir = NULL;
 
   if (!tmpfs_find(fs, path, NULL, &parent_dir))
     return tmpfs_open(fs, path);
@@ -277,7 +278,7 @@ fs_file_t *tmpfs_mkfifo(fs_t *fs, char *path, int mode, int uid, int gid) {
 fs_file_t *tmpfs_mkdir(fs_t *fs, char *path, int mode, int uid, int gid) {
   posix_time_t tim = rtc_mktime(rtc_get_datetime());
 
-  fs_file_t *parent_dir = kmalloc(sizeof(fs_file_t));
+  fs_file_t *parent_dir = NULL;
 
   if (!tmpfs_find(fs, path, NULL, &parent_dir))
     return tmpfs_open(fs, path);
@@ -329,7 +330,7 @@ fs_file_t *tmpfs_mknod(fs_t *fs, char *name, int mode, int uid, int gid,
                        device_t *dev) {
   posix_time_t tim = rtc_mktime(rtc_get_datetime());
 
-  fs_file_t *parent_dir = kmalloc(sizeof(fs_file_t));
+  fs_file_t *parent_dir = NULL;
 
   if (!tmpfs_find(fs, name, NULL, &parent_dir))
     return tmpfs_open(fs, name);
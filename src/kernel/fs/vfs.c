@@ -1,5 +1,6 @@
 #include <dev/device.h>
 #include <drivers/ahci.h>
+#include <errno.h>
 #include <fs/devfs.h>
 #include <fs/fat32.h>
 #include <fs/vfs.h>
@@ -8,56 +9,76 @@
 #include <mm/vmm.h>
 #include <pipe/pipe.h>
 #include <printf.h>
+#include <rcu.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
-#include <vec.h>
+#include <tasking/scheduler.h>
 
-vec_t(vfs_mount_info_t *) vfs_mounts = {0};
-vec_t(fs_ops_t *) registered_fses = {0};
+// Both tables are read without a lock on every path lookup, see rcu.h.
+// Mounts and filesystems are never removed, so what a lookup finds stays
+// valid after its read section.
+rcu_array_t *vfs_mounts = NULL;
+rcu_array_t *registered_fses = NULL;
+static lock_t vfs_mounts_lock = {0};
+static lock_t registered_fses_lock = {0};
 
 vfs_mount_info_t *root_mount;
 
 static inline int vfs_is_mounted(char *path) {
-  for (size_t i = 0; i < (size_t)vfs_mounts.length; i++)
-    if (!strcmp(vfs_mounts.data[i]->path, path))
-      return 1;
-  return 0;
+  uint64_t rflags = rcu_read_lock();
+  rcu_array_t *mounts = RCU_READ(vfs_mounts);
+
+  vfs_mount_info_t *mi;
+  for (size_t i = 0; (mi = rcu_array_get(mounts, i)); i++)
+    if (!strcmp(mi->path, path))
+      break;
+
+  rcu_read_unlock(rflags);
+  return mi != NULL;
 }
 
+// The mount with the longest path that path starts with, the root if none
 vfs_mount_info_t *vfs_find_mount(char *path) {
-  char *path_dup = kcalloc(strlen(path) + 1);
-  strcpy(path_dup, path);
-
-  if (!strcmp(path_dup, "/")) {
-    kfree(path_dup);
-    return root_mount;
+  vfs_mount_info_t *found = RCU_READ(root_mount);
+  size_t found_length = 1;
+
+  uint64_t rflags = rcu_read_lock();
+  rcu_array_t *mounts = RCU_READ(vfs_mounts);
+
+  vfs_mount_info_t *mi;
+  for (size_t i = 0; (mi = rcu_array_get(mounts, i)); i++) {
+    size_t length = strlen(mi->path);
+    if (length > found_length && !strncmp(mi->path, path, length)) {
+      found = mi;
+      found_length = length;
+    }
   }
 
-  while (strlen(path_dup) > 1) {
-    for (size_t i = 0; i < (size_t)vfs_mounts.length; i++)
-      if (!strcmp(vfs_mounts.data[i]->path, path_dup)) {
-        kfree(path_dup);
-        return vfs_mounts.data[i];
-      }
-    path_dup[strlen(path_dup) - 1] = 0;
-  }
+  rcu_read_unlock(rflags);
+  return found;
+}
 
-  kfree(path_dup);
-  return root_mount;
+static fs_ops_t *vfs_get_fs(size_t i) {
+  uint64_t rflags = rcu_read_lock();
+  fs_ops_t *ops = rcu_array_get(RCU_READ(registered_fses), i);
+  rcu_read_unlock(rflags);
+  return ops;
 }
 
+// Mounting reads the device, so it happens outside of any read section
 fs_t *vfs_mount_fs(device_t *dev, char *name) {
-  for (size_t i = 0; i < (size_t)registered_fses.length; i++)
-    if (registered_fses.data[i]->mount) {
+  fs_ops_t *ops;
+  for (size_t i = 0; (ops = vfs_get_fs(i)); i++)
+    if (ops->mount) {
       if (name) {
-        if (!strcmp(name, registered_fses.data[i]->fs_name)) {
-          fs_t *fs = registered_fses.data[i]->mount(dev);
+        if (!strcmp(name, ops->fs_name)) {
+          fs_t *fs = ops->mount(dev);
           if (fs)
             return fs;
         }
       } else {
-        fs_t *fs = registered_fses.data[i]->mount(dev);
+        fs_t *fs = ops->mount(dev);
         if (fs)
           return fs;
       }
@@ -67,7 +88,7 @@ fs_t *vfs_mount_fs(device_t *dev, char *name) {
 }
 
 int vfs_mount(char *path, device_t *dev, char *fs_name) {
-  if (!root_mount && strcmp(path, "/"))
+  if (!RCU_READ(root_mount) && strcmp(path, "/"))
     return 1;
   if (vfs_is_mounted(path))
     return 1;
@@ -84,10 +105,19 @@ int vfs_mount(char *path, device_t *dev, char *fs_name) {
     .fs = fs,
   };
 
-  vec_push(&vfs_mounts, mi);
+  // Someone may have mounted the same path while this one was reading
+  LOCK(vfs_mounts_lock);
+  if (vfs_is_mounted(path)) {
+    UNLOCK(vfs_mounts_lock);
+    kfree(mi);
+    return 1;
+  }
+
+  rcu_array_push(&vfs_mounts, mi);
 
   if (!root_mount)
-    root_mount = mi;
+    RCU_ASSIGN(root_mount, mi);
+  UNLOCK(vfs_mounts_lock);
 
   if (dev)
     dev->fs = fs;
@@ -131,13 +161,18 @@ int vfs_check_can_exec(fs_file_t *file, int uid, int gid) {
   return 0;
 }
 
-void vfs_register_fs(fs_ops_t *ops) { vec_push(&registered_fses, ops); }
+void vfs_register_fs(fs_ops_t *ops) {
+  LOCK(registered_fses_lock);
+  rcu_array_push(&registered_fses, ops);
+  UNLOCK(registered_fses_lock);
+}
 
 ssize_t vfs_read(fs_file_t *file, uint8_t *buf, size_t offset, size_t count) {
   if (ISFIFO(file)) {
     ssize_t ret = 0;
     while (!(ret = pipe_read(file->pipe, buf, count)))
-      ;
+      if (sched_interrupted())
+        return -EINTR;
     return ret;
   } else if (ISDEV(file))
     return device_read(file->dev, offset, count, buf);
@@ -149,7 +184,8 @@ ssize_t vfs_write(fs_file_t *file, uint8_t *buf, size_t offset, size_t count) {
   if (ISFIFO(file)) {
     ssize_t ret = 0;
     while (!(ret = pipe_write(file->pipe, buf, count)))
-      ;
+      if (sched_interrupted())
+        return -EINTR;
     return ret;
   } else if (ISDEV(file))
     return device_write(file->dev, offset, count, buf);
@@ -157,6 +193,54 @@ ssize_t vfs_write(fs_file_t *file, uint8_t *buf, size_t offset, size_t count) {
     return file->file_ops->write(file, buf, offset, count);
 }
 
+// Pipes say how much they moved, the file systems don't all, so a short
+// count only ends the loop for pipes
+static ssize_t vfs_transfer(fs_file_t *file, iovec_t *iov, size_t count,
+                            size_t offset, int write) {
+  size_t done = 0;
+
+  for (size_t i = 0; i < count; i++) {
+    size_t length = iov[i].iov_len;
+    if (!length)
+      continue;
+
+    uint8_t *buf = iov[i].iov_base;
+    ssize_t ret = write ? vfs_write(file, buf, offset + done, length)
+                        : vfs_read(file, buf, offset + done, length);
+
+    if (!ISFIFO(file)) {
+      done += length;
+      continue;
+    }
+
+    if (ret < 0)
+      return done ? (ssize_t)done : ret;
+    done += ret;
+    if ((size_t)ret < length)
+      break;
+  }
+
+  return done;
+}
+
+ssize_t vfs_readv(fs_file_t *file, iovec_t *iov, size_t count, size_t offset) {
+  if (ISDEV(file))
+    return device_readv(file->dev, offset, iov, count);
+  else if (!ISFIFO(file) && file->file_ops->readv)
+    return file->file_ops->readv(file, iov, count, offset);
+  else
+    return vfs_transfer(file, iov, count, offset, 0);
+}
+
+ssize_t vfs_writev(fs_file_t *file, iovec_t *iov, size_t count, size_t offset) {
+  if (ISDEV(file))
+    return device_writev(file->dev, offset, iov, count);
+  else if (!ISFIFO(file) && file->file_ops->writev)
+    return file->file_ops->writev(file, iov, count, offset);
+  else
+    return vfs_transfer(file, iov, count, offset, 1);
+}
+
 void *vfs_mmap(struct fs_file *file, pagemap_t *pg, syscall_file_t *sfile,
                void *addr, size_t size, size_t offset, int prot, int flags) {
   if (ISFIFO(file))
@@ -305,9 +389,4 @@ fs_file_t *vfs_open(char *name) {
   return mi->fs->ops->open(mi->fs, str);
 }
 
-int init_vfs() {
-  vfs_mounts.data = kmalloc(sizeof(vfs_mount_info_t *));
-  registered_fses.data = kmalloc(sizeof(fs_ops_t *));
-
-  return 0;
-}
+int init_vfs() { return 0; }
@@ -31,6 +31,12 @@ static inline uint64_t rdmsr(uint64_t msr) {
   return ((uint64_t)high << 32) | low;
 }
 
+static inline uint64_t rdtsc() {
+  uint32_t low, high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
+
 static inline void wrmsr(uint64_t msr, uint64_t value) {
   uint32_t low = value & 0xFFFFFFFF;
   uint32_t high = value >> 32;
@@ -2,20 +2,28 @@
 #define __CPU_LOCALS_H__
 
 #include <asm.h>
+#include <mm/scratch.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/gdt.h>
 #include <tasking/scheduler.h>
+#include <tasking/timer.h>
 
+// syscall_entry finds kernel_stack and user_stack through GS, they stay at
+// the offsets interrupts.asm has for them
 typedef struct cpu_locals {
+  uint64_t kernel_stack; // The running thread's, same as tss.rsp[0]
+  uint64_t user_stack;   // Scratch for syscall_entry
   thread_t *current_thread;
   uint64_t lapic_timer_freq;
+  uint64_t tsc_freq;
   size_t cpu_number;
   size_t lapic_id;
-  size_t last_run_thread_index[PRIORITY_LEVELS];
   tss_t tss;
-  uint8_t current_priority_peg;
-  uint8_t current_priority;
+  run_queue_t run_queue;
+  timer_wheel_t timers;
+  scratch_arena_t scratch;
+  uint64_t rcu_epoch; // As of this CPU's last schedule(), see rcu.c
 } cpu_locals_t;
 
 static inline cpu_locals_t *get_locals() {
@@ -8,6 +8,18 @@
 typedef signed long long int ssize_t;
 struct fs;
 
+// Same layout as libc's struct iovec
+typedef struct iovec {
+  void *iov_base;
+  size_t iov_len;
+} iovec_t;
+
+// A physically contiguous piece of a transfer
+typedef struct dma_segment {
+  uintptr_t phys;
+  size_t length;
+} dma_segment_t;
+
 typedef struct device {
   char *name;
   uint64_t type;
@@ -20,6 +32,12 @@ typedef struct device {
   uint64_t (*ioctl)(struct device *dev, uint64_t cmd, void *arg);
   void *(*mmap)(struct device *dev, pagemap_t *pg, syscall_file_t *sfile,
                 void *addr, size_t size, size_t offset, int prot, int flags);
+  // Optional, for block devices that can scatter-gather. start is in blocks
+  // and the segments add up to whole blocks.
+  ssize_t (*readv)(struct device *dev, size_t start, dma_segment_t *segments,
+                   size_t count);
+  ssize_t (*writev)(struct device *dev, size_t start, dma_segment_t *segments,
+                    size_t count);
 
   size_t block_size;
   size_t block_count;
@@ -27,6 +45,10 @@ typedef struct device {
 
 ssize_t device_read(device_t *dev, size_t start, size_t count, uint8_t *buf);
 ssize_t device_write(device_t *dev, size_t start, size_t count, uint8_t *buf);
+ssize_t device_readv(device_t *dev, size_t start, iovec_t *iov, size_t count);
+ssize_t device_writev(device_t *dev, size_t start, iovec_t *iov, size_t count);
+size_t iov_length(iovec_t *iov, size_t count);
+size_t iov_truncate(iovec_t *iov, size_t count, size_t length);
 int device_add(device_t *dev);
 device_t *device_get(uint32_t id);
 
@@ -0,0 +1,6 @@
+#ifndef __KHEAPSTAT_H__
+#define __KHEAPSTAT_H__
+
+int init_kheapstat(char *mount_place);
+
+#endif
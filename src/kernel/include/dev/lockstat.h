@@ -0,0 +1,9 @@
+#ifndef __LOCKSTAT_H__
+#define __LOCKSTAT_H__
+
+// Zeroes every lock's counters
+#define IOCTL_LOCKSTAT_RESET 1
+
+int init_lockstat(char *mount_place);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef __SCHEDSTAT_H__
+#define __SCHEDSTAT_H__
+
+// Zeroes every counter, histogram and thread runtime
+#define IOCTL_SCHEDSTAT_RESET 1
+
+int init_schedstat(char *mount_place);
+
+#endif
@@ -3,13 +3,26 @@
 
 #include <lock.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <vec.h>
 
+struct thread;
+
+typedef struct event_listener {
+  struct thread *thread;
+  size_t which;
+} event_listener_t;
+
+// Triggers nobody was waiting for are kept in pending, waiters sleep on
+// listeners until a trigger hands them one directly
 typedef struct event {
   size_t pending;
   lock_t lock;
+  vec_t(event_listener_t) listeners;
 } event_t;
 
 int event_await(event_t **events, size_t count, int block);
-void event_trigger(event_t *event);
+int event_await_timeout(event_t **events, size_t count, uint64_t timeout);
+void event_trigger(event_t *event, int all);
 
 #endif
@@ -111,6 +111,11 @@ typedef struct file_ops {
                   size_t count);
   ssize_t (*write)(struct fs_file *file, uint8_t *buf, size_t offset,
                    size_t count);
+  // Optional, otherwise vfs_readv and vfs_writev go a buffer at a time
+  ssize_t (*readv)(struct fs_file *file, iovec_t *iov, size_t count,
+                   size_t offset);
+  ssize_t (*writev)(struct fs_file *file, iovec_t *iov, size_t count,
+                    size_t offset);
   int (*rmdir)(struct fs_file *file);
   int (*delete)(struct fs_file *file);
   int (*truncate)(struct fs_file *file, size_t size);
@@ -171,6 +176,8 @@ void *vfs_mmap(fs_file_t *file, pagemap_t *pg, syscall_file_t *sfile,
 int vfs_mount(char *path, device_t *dev, char *fs_name);
 ssize_t vfs_read(fs_file_t *file, uint8_t *buf, size_t offset, size_t count);
 ssize_t vfs_write(fs_file_t *file, uint8_t *buf, size_t offset, size_t count);
+ssize_t vfs_readv(fs_file_t *file, iovec_t *iov, size_t count, size_t offset);
+ssize_t vfs_writev(fs_file_t *file, iovec_t *iov, size_t count, size_t offset);
 int vfs_rmdir(fs_file_t *file);
 int vfs_delete(fs_file_t *file);
 int vfs_truncate(fs_file_t *file, size_t size);
@@ -1,15 +1,70 @@
 #ifndef __LOCK_H__
 #define __LOCK_H__
 
+#include <asm.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // Based on lyre-os' spinlock system.
 
+// Set to 0 to compile out the contention counters of ticket locks
+#define LOCK_STATS 1
+
+#define LOCK_STATS_NAME 32
+
+// Test and set lock. Waiters spin on a plain read, so they only take the
+// cache line from the holder once the lock looks free.
 typedef struct {
-  uint32_t waiting_refcount;
   uint32_t bits;
 } lock_t;
 
+// Counters for one ticket lock. Only the holder updates them, so they need
+// no locking of their own.
+typedef struct lock_stats {
+  char *name;
+  uint64_t acquisitions;
+  uint64_t contended; // Acquisitions that had to wait
+  uint64_t spins;     // Times a waiter found it still wasn't its turn
+  uint64_t max_hold;  // TSC cycles
+  uint64_t acquired_at;
+  int registered;
+  struct lock_stats *next;
+} lock_stats_t;
+
+// Ticket lock. Each waiter takes a ticket and waits for owner to reach it,
+// so the lock is handed over in arrival order and nobody starves.
+// Interrupts stay off from taking a ticket until the unlock: a waiter that
+// got preempted would hold up everyone queued behind it.
+typedef struct {
+  union {
+    uint32_t value;
+    struct {
+      uint16_t owner;
+      uint16_t next;
+    };
+  };
+  uint64_t rflags; // The holder's, from before it took its ticket
+  lock_stats_t *stats;
+} ticket_lock_t;
+
+// What /dev/lockstat hands out per lock
+typedef struct lock_stat {
+  char name[LOCK_STATS_NAME];
+  uint64_t acquisitions;
+  uint64_t contended;
+  uint64_t spins;
+  uint64_t max_hold;
+} lock_stat_t;
+
+// A ticket lock that keeps counters, which show up in /dev/lockstat after
+// its first acquisition
+#define TICKET_LOCK_INIT(NAME)                                                 \
+  { .value = 0, .stats = &(lock_stats_t){.name = NAME}, }
+
+void lock_stats_register(lock_stats_t *stats);
+size_t lock_stats_snapshot(lock_stat_t *stats, size_t max);
+void lock_stats_reset();
+
 #define LOCKED_READ(VAR)                                                       \
   ({                                                                           \
     typeof(VAR) ret = 0;                                                       \
@@ -38,35 +93,143 @@ typedef struct {
     ret;                                                                       \
   })
 
+static inline void spin_lock(lock_t *lock) {
+  asm volatile("1: lock btsl $0, %0\n\t"
+               "jnc 3f\n\t"
+               "2: pause\n\t"
+               "testl $1, %0\n\t"
+               "jnz 2b\n\t"
+               "jmp 1b\n\t"
+               "3:"
+               : "+m"(lock->bits)
+               :
+               : "memory", "cc");
+}
+
+static inline int spin_lock_acquire(lock_t *lock) {
+  int ret;
+  asm volatile("lock btsl $0, %0"
+               : "+m"(lock->bits), "=@ccc"(ret)
+               :
+               : "memory");
+  return !ret;
+}
+
+static inline void spin_unlock(lock_t *lock) {
+  asm volatile("lock btrl $0, %0" : "+m"(lock->bits) : : "memory");
+}
+
+static inline void ticket_lock_acquired(ticket_lock_t *lock, uint64_t spins) {
+#if LOCK_STATS
+  lock_stats_t *stats = lock->stats;
+  if (!stats)
+    return;
+
+  if (!stats->registered)
+    lock_stats_register(stats);
+
+  stats->acquisitions++;
+  if (spins) {
+    stats->contended++;
+    stats->spins += spins;
+  }
+  stats->acquired_at = rdtsc();
+#else
+  (void)lock;
+  (void)spins;
+#endif
+}
+
+static inline uint64_t lock_irq_save() {
+  uint64_t rflags;
+  asm volatile("pushfq\n"
+               "pop %0\n"
+               "cli"
+               : "=r"(rflags)
+               :
+               : "memory");
+  return rflags;
+}
+
+static inline void lock_irq_restore(uint64_t rflags) {
+  if (rflags & 0x200)
+    asm volatile("sti" : : : "memory");
+}
+
+// For spinlocks that are ever taken with interrupts off, by an interrupt
+// handler or by code that is itself under cli. Every acquisition has to use
+// these: a holder that gets interrupted and switched out leaves the CPU it
+// was on spinning with interrupts off, and nothing can switch it back in.
+// Interrupts are only off between the two calls and come back as they were.
+static inline uint64_t spin_lock_irqsave(lock_t *lock) {
+  uint64_t rflags = lock_irq_save();
+  spin_lock(lock);
+  return rflags;
+}
+
+static inline void spin_unlock_irqrestore(lock_t *lock, uint64_t rflags) {
+  spin_unlock(lock);
+  lock_irq_restore(rflags);
+}
+
+static inline void ticket_lock(ticket_lock_t *lock) {
+  uint64_t rflags = lock_irq_save();
+  uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_ACQUIRE);
+  uint64_t spins = 0;
+
+  while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+    asm volatile("pause");
+    spins++;
+  }
+
+  lock->rflags = rflags;
+  ticket_lock_acquired(lock, spins);
+}
+
+// Only takes a ticket if it would be served right away
+static inline int ticket_lock_acquire(ticket_lock_t *lock) {
+  uint32_t value = __atomic_load_n(&lock->value, __ATOMIC_RELAXED);
+  if ((value & 0xffff) != value >> 16)
+    return 0;
+
+  uint64_t rflags = lock_irq_save();
+  if (!__atomic_compare_exchange_n(&lock->value, &value, value + 0x10000, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    lock_irq_restore(rflags);
+    return 0;
+  }
+
+  lock->rflags = rflags;
+  ticket_lock_acquired(lock, 0);
+  return 1;
+}
+
+// Only the holder writes owner, so a plain store hands the lock on
+static inline void ticket_unlock(ticket_lock_t *lock) {
+#if LOCK_STATS
+  lock_stats_t *stats = lock->stats;
+  if (stats) {
+    uint64_t held = rdtsc() - stats->acquired_at;
+    if (held > stats->max_hold)
+      stats->max_hold = held;
+  }
+#endif
+
+  uint64_t rflags = lock->rflags;
+  __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+  lock_irq_restore(rflags);
+}
+
+// Both kinds of lock take the same macros
 #define LOCK(LOCK)                                                             \
-  ({                                                                           \
-    int ret;                                                                   \
-    LOCKED_INC((LOCK).waiting_refcount);                                       \
-    asm volatile("1: lock btsl $0, %0\n\t"                                     \
-                 "jnc 1f\n\t"                                                  \
-                 "btl $1, %0\n\t"                                              \
-                 "jc 1f\n\t"                                                   \
-                 "pause\n\t"                                                   \
-                 "jmp 1b\n\t"                                                  \
-                 "1:"                                                          \
-                 : "+m"((LOCK).bits), "=@ccc"(ret)                             \
-                 :                                                             \
-                 : "memory");                                                  \
-    LOCKED_DEC((LOCK).waiting_refcount);                                       \
-    !ret;                                                                      \
-  })
+  _Generic(&(LOCK), ticket_lock_t *: ticket_lock, default: spin_lock)(&(LOCK))
 
 #define LOCK_ACQUIRE(LOCK)                                                     \
-  ({                                                                           \
-    int ret;                                                                   \
-    asm volatile("lock btsl $0, %0"                                            \
-                 : "+m"((LOCK).bits), "=@ccc"(ret)                             \
-                 :                                                             \
-                 : "memory");                                                  \
-    !ret;                                                                      \
-  })
+  _Generic(&(LOCK), ticket_lock_t *: ticket_lock_acquire,                      \
+           default: spin_lock_acquire)(&(LOCK))
 
 #define UNLOCK(LOCK)                                                           \
-  ({ asm volatile("lock btrl $0, %0" : "+m"((LOCK).bits) : : "memory"); })
+  _Generic(&(LOCK), ticket_lock_t *: ticket_unlock,                            \
+           default: spin_unlock)(&(LOCK))
 
 #endif
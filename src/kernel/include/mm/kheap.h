@@ -4,10 +4,38 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Set to 0 to drop the per call site accounting (and its 16 byte header)
+#define KHEAP_STATS 1
+
+#define KHEAP_STATS_SITES 256
+#define KHEAP_STATS_BUCKETS 32
+
+typedef struct kheap_site_stats {
+  uintptr_t rip;
+  uint64_t live_bytes;
+  uint64_t peak_bytes;
+  uint64_t alloc_count;
+  uint64_t free_count;
+} kheap_site_stats_t;
+
+// This is the layout /dev/kheapstat hands out. It is followed by
+// site_count kheap_site_stats_t records.
+typedef struct kheap_stats {
+  uint64_t live_bytes;
+  uint64_t peak_bytes;
+  uint64_t alloc_count;
+  uint64_t free_count;
+  uint64_t dropped_sites;
+  uint64_t size_histogram[KHEAP_STATS_BUCKETS];
+  uint64_t site_count;
+} kheap_stats_t;
+
 void *kmalloc(size_t size);
 void kfree(void *ptr);
 void *krealloc(void *ptr, size_t size);
 void *kcalloc(size_t size);
+size_t kheap_stats_snapshot(kheap_stats_t *stats, kheap_site_stats_t *sites,
+                            size_t max_sites);
 int kheap_init();
 
 #endif
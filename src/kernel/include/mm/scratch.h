@@ -0,0 +1,38 @@
+#ifndef __SCRATCH_H__
+#define __SCRATCH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCRATCH_PAGES 16
+
+// A per CPU bump allocator for buffers that only live for the length of one
+// call. Memory comes out of the direct map like kmalloc's, so it can be
+// handed to DMA. A scope runs with interrupts disabled, which keeps the
+// thread on this CPU and keeps anyone else off the arena until scratch_end.
+// Don't block or yield inside one.
+
+typedef struct scratch_overflow {
+  struct scratch_overflow *next;
+  uint64_t reserved;
+} scratch_overflow_t;
+
+typedef struct scratch_arena {
+  uint8_t *base;
+  size_t size;
+  size_t top;
+  scratch_overflow_t *overflow;
+} scratch_arena_t;
+
+typedef struct scratch_scope {
+  size_t mark;
+  scratch_overflow_t *overflow;
+  uint64_t rflags;
+} scratch_scope_t;
+
+void scratch_init(scratch_arena_t *arena);
+scratch_scope_t scratch_begin();
+void *scratch_alloc(size_t size);
+void scratch_end(scratch_scope_t scope);
+
+#endif
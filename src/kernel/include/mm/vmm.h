@@ -8,6 +8,9 @@
 
 #define KERNEL_MEM_OFFSET 0xffffffff80000000
 
+// Only set where EFER.NXE is, see vdso_init_cpu
+#define VMM_PTE_NX ((uint64_t)1 << 63)
+
 typedef struct syscall_file syscall_file_t; // Recursive inclusion
 struct pagemap;
 
@@ -25,6 +28,7 @@ typedef struct pagemap {
   lock_t lock;
   uint64_t *top_level;
   vec_t(mmap_range_t *) ranges;
+  uintptr_t vdso_proc; // Physical, the page behind VDSO_PROC
 } pagemap_t;
 
 extern pagemap_t kernel_pagemap;
@@ -40,9 +44,12 @@ void vmm_memcpy(pagemap_t *pagemap_1, uintptr_t virtual_address_1,
                 size_t count);
 uintptr_t vmm_virt_to_phys(pagemap_t *pagemap, uintptr_t virtual_address);
 uintptr_t vmm_get_kernel_address(pagemap_t *pagemap, uintptr_t virtual_address);
+void vmm_add_range(pagemap_t *pagemap, mmap_range_t *range);
+void vmm_free_range(mmap_range_t *range);
 void vmm_destroy_pagemap(pagemap_t *pagemap);
 void vmm_mmap_range(pagemap_t *pagemap, uintptr_t phys_addr,
                     uintptr_t virt_addr, size_t length, int flags, int prot);
+uintptr_t vmm_range_page(pagemap_t *pagemap, uintptr_t addr, int write);
 uintptr_t vmm_range_to_addr(pagemap_t *pagemap, uintptr_t virt_addr);
 int init_vmm();
 
@@ -0,0 +1,43 @@
+#ifndef __RCU_H__
+#define __RCU_H__
+
+#include <lock.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Read-copy-update for tables that are read all the time and rarely
+// changed. Readers take no lock and write nothing shared: a read section
+// just keeps interrupts off, so the CPU can't go through schedule() until
+// it's over. Writers publish a new copy with RCU_ASSIGN and pass the old one
+// to rcu_free, which frees it once every CPU has been through schedule() or
+// sat idle since. Nothing that sleeps or yields goes in a read section.
+
+struct cpu_locals;
+
+// A table that is never changed in place, rcu_array_push replaces it
+typedef struct rcu_array {
+  size_t length;
+  void *data[];
+} rcu_array_t;
+
+#define RCU_READ(PTR) __atomic_load_n(&(PTR), __ATOMIC_ACQUIRE)
+#define RCU_ASSIGN(PTR, VAL) __atomic_store_n(&(PTR), VAL, __ATOMIC_RELEASE)
+
+static inline uint64_t rcu_read_lock() { return lock_irq_save(); }
+
+static inline void rcu_read_unlock(uint64_t rflags) {
+  lock_irq_restore(rflags);
+}
+
+// NULL past the end. An array that was never pushed to is empty.
+static inline void *rcu_array_get(rcu_array_t *array, size_t i) {
+  if (!array || i >= array->length)
+    return NULL;
+  return array->data[i];
+}
+
+void rcu_quiescent(struct cpu_locals *locals);
+void rcu_free(void *ptr);
+size_t rcu_array_push(rcu_array_t **array, void *item);
+
+#endif
@@ -25,4 +25,6 @@ void memcpy16(void *dest, void *src, unsigned long length);
 void memcpy32(void *dest, void *src, unsigned long length);
 void memcpy64(void *dest, void *src, unsigned long length);
 
+int init_memf();
+
 #endif
@@ -0,0 +1,38 @@
+#ifndef __FPU_H__
+#define __FPU_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define CR0_TS (1 << 3)
+#define CR4_OSXSAVE (1 << 18)
+
+#define XCR0_X87 (1 << 0)
+#define XCR0_SSE (1 << 1)
+#define XCR0_AVX (1 << 2)
+#define XCR0_AVX512 (7 << 5)
+
+// Size of a thread's FPU state area, from CPUID leaf 0xD
+extern size_t fpu_state_size;
+
+int init_fpu();
+void fpu_init_cpu();
+
+void *fpu_alloc_state();
+void fpu_free_state(void *state);
+void fpu_init_state(void *state);
+void fpu_save(void *state);
+void fpu_restore(void *state);
+int fpu_handle_fault();
+
+static inline void fpu_enable() { asm volatile("clts"); }
+
+// Sets CR0.TS, so the next FPU or SSE instruction traps with #NM
+static inline void fpu_disable() {
+  uint64_t cr0;
+  asm volatile("mov %%cr0, %0" : "=r"(cr0));
+  if (!(cr0 & CR0_TS))
+    asm volatile("mov %0, %%cr0" : : "r"(cr0 | CR0_TS));
+}
+
+#endif
@@ -6,8 +6,9 @@
 #define GDT_SEG_NULL (uint16_t)((0 << 3) | 0)
 #define GDT_SEG_KCODE (uint16_t)((1 << 3) | 0)
 #define GDT_SEG_KDATA (uint16_t)((2 << 3) | 0)
-#define GDT_SEG_UCODE (uint16_t)((3 << 3) | 3)
-#define GDT_SEG_UDATA (uint16_t)((4 << 3) | 3)
+// SYSRET wants user data right below user code
+#define GDT_SEG_UDATA (uint16_t)((3 << 3) | 3)
+#define GDT_SEG_UCODE (uint16_t)((4 << 3) | 3)
 #define GDT_SEG_TSS (uint16_t)((5 << 3) | 0)
 
 typedef struct gdt_pointer {
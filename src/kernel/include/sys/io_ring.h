@@ -0,0 +1,15 @@
+#ifndef __IO_RING_H__
+#define __IO_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/io_ring_layout.h>
+
+struct proc;
+
+int io_ring_setup(io_ring_params_t *params);
+int64_t io_ring_enter(size_t fd, uint32_t to_submit, uint32_t min_complete,
+                      uint32_t flags);
+void io_ring_detach(struct proc *proc);
+
+#endif
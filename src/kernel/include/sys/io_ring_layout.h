@@ -0,0 +1,77 @@
+#ifndef __IO_RING_LAYOUT_H__
+#define __IO_RING_LAYOUT_H__
+
+#include <stdint.h>
+
+// What io_ring_setup's fd maps, shared by the kernel and libc. One mapping
+// from offset 0 of params.size bytes: the header, then sq_entries SQEs at
+// params.sqes_offset and cq_entries CQEs at params.cqes_offset. Both rings
+// are indexed by head or tail & mask, and the heads and tails only ever
+// count up. The process writes SQEs and sq_tail, and reads CQEs and bumps
+// cq_head. The kernel does the rest.
+
+#define IO_RING_ENTRIES_MAX 1024
+
+// io_ring_params_t flags
+#define IO_RING_SETUP_SQPOLL 0x1 // The worker polls the SQ, see sq_idle
+
+// io_ring_header_t sq_flags
+#define IO_RING_SQ_NEED_WAKEUP 0x1 // The polling worker went to sleep
+
+// io_ring_enter flags
+#define IO_RING_ENTER_GETEVENTS 0x1 // Wait for min_complete CQEs
+#define IO_RING_ENTER_SQ_WAKEUP 0x2 // Wake the polling worker
+
+#define IO_RING_OP_NOP 0
+#define IO_RING_OP_READ 1
+#define IO_RING_OP_WRITE 2
+#define IO_RING_OP_FSYNC 3
+#define IO_RING_OP_OPEN 4
+#define IO_RING_OP_CLOSE 5
+
+typedef struct io_ring_params {
+  uint32_t sq_entries; // Rounded up to a power of two
+  uint32_t cq_entries; // Out, twice sq_entries
+  uint32_t flags;
+  uint32_t sq_idle;     // Milliseconds the polling worker spins idle
+  uint64_t size;        // Out
+  uint64_t sqes_offset; // Out
+  uint64_t cqes_offset; // Out
+} io_ring_params_t;
+
+typedef struct io_ring_header {
+  uint32_t sq_head;
+  uint32_t sq_tail;
+  uint32_t sq_mask;
+  uint32_t sq_flags;
+  uint32_t cq_head;
+  uint32_t cq_tail;
+  uint32_t cq_mask;
+  uint32_t cq_overflow; // CQEs dropped because the CQ was full
+} io_ring_header_t;
+
+// READ and WRITE move len bytes at addr from offset, or from the file's
+// own offset, moving it along, when offset is -1. OPEN takes the path at
+// addr with open_flags and mode and completes with the fd.
+typedef struct io_ring_sqe {
+  uint8_t opcode;
+  uint8_t rsv0;
+  uint16_t rsv1;
+  int32_t fd;
+  int64_t offset;
+  uint64_t addr;
+  uint32_t len;
+  uint32_t open_flags;
+  uint32_t mode;
+  uint32_t rsv2;
+  uint64_t user_data;
+} io_ring_sqe_t;
+
+// res is what the system call would have returned, negative errno included
+typedef struct io_ring_cqe {
+  uint64_t user_data;
+  int32_t res;
+  uint32_t flags;
+} io_ring_cqe_t;
+
+#endif
@@ -3,29 +3,12 @@
 
 #include <fs/vfs.h>
 #include <stdint.h>
+#include <sys/syscall_list.h>
 
-#define SYSCALL_OPEN 0
-#define SYSCALL_CLOSE 1
-#define SYSCALL_READ 2
-#define SYSCALL_WRITE 3
-#define SYSCALL_EXEC 4
-#define SYSCALL_MMAP 5
-#define SYSCALL_MUNMAP 6
-#define SYSCALL_STAT 7
-#define SYSCALL_FSTAT 8
-#define SYSCALL_GETPID 9
-#define SYSCALL_EXIT 10
-#define SYSCALL_FORK 11
-#define SYSCALL_GETTIMEOFDAY 12
-#define SYSCALL_FSYNC 13
-#define SYSCALL_IOCTL 14
-#define SYSCALL_GETPPID 15
-#define SYSCALL_SEEK 16
-#define SYSCALL_WAITPID 17
-#define SYSCALL_ACCESS 18
-#define SYSCALL_PIPE 19
-#define SYSCALL_FCNTL 20
-#define SYSCALL_REMOVE 21
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
+#define TIMER_ABSTIME 1
 
 #define PROT_READ 0x1
 #define PROT_WRITE 0x2
@@ -39,6 +22,8 @@
 
 #define MMAP_MAX_SIZE 0x2000000
 
+#define IOV_MAX 1024
+
 typedef struct mmap_args {
   void *addr;
   size_t length;
@@ -48,11 +33,29 @@ typedef struct mmap_args {
   size_t offset;
 } mmap_args_t;
 
+// One for the fd table slot, one for each syscall using it right now
 typedef struct syscall_file {
   fs_file_t *file;
   int flags;
+  int ref_count;
 } syscall_file_t;
 
+#define MSR_EFER 0xc0000080
+#define MSR_STAR 0xc0000081
+#define MSR_LSTAR 0xc0000082
+#define MSR_SFMASK 0xc0000084
+#define MSR_KERNEL_GS_BASE 0xc0000102
+
+#define EFER_SCE (1 << 0)
+#define EFER_NXE (1 << 11)
+
+struct proc;
+
 int init_syscalls();
+void syscall_init_cpu();
+int syscall_do_open(struct proc *proc, int uid, int gid, char *path, int flags,
+                    int mode);
+ssize_t syscall_file_transfer(syscall_file_t *file, iovec_t *iov,
+                              size_t count, int64_t offset, int write);
 
 #endif
@@ -0,0 +1,55 @@
+#ifndef __SYSCALL_LIST_H__
+#define __SYSCALL_LIST_H__
+
+// Every system call, shared by the kernel and libc so the two can't drift:
+// X(number, constant, name, argument count). The kernel builds its table
+// from it and libc its stubs. Arguments go in rdi, rsi, rdx, r10, r8 and r9
+// and the number in rax, as on other x86-64 systems.
+
+#define SYSCALL_LIST(X)                                                        \
+  X(0, OPEN, open, 3)                                                          \
+  X(1, CLOSE, close, 1)                                                        \
+  X(2, READ, read, 3)                                                          \
+  X(3, WRITE, write, 3)                                                        \
+  X(4, EXEC, execve, 3)                                                        \
+  X(5, MMAP, mmap, 6)                                                          \
+  X(6, MUNMAP, munmap, 2)                                                      \
+  X(7, STAT, stat, 2)                                                          \
+  X(8, FSTAT, fstat, 2)                                                        \
+  X(9, GETPID, getpid, 0)                                                      \
+  X(10, EXIT, exit, 1)                                                         \
+  X(11, FORK, fork, 0)                                                         \
+  X(12, GETTIMEOFDAY, gettimeofday, 1)                                         \
+  X(13, FSYNC, fsync, 1)                                                       \
+  X(14, IOCTL, ioctl, 3)                                                       \
+  X(15, GETPPID, getppid, 0)                                                   \
+  X(16, SEEK, seek, 3)                                                         \
+  X(17, WAITPID, waitpid, 3)                                                   \
+  X(18, ACCESS, access, 2)                                                     \
+  X(19, PIPE, pipe, 1)                                                         \
+  X(20, FCNTL, fcntl, 3)                                                       \
+  X(21, REMOVE, remove, 1)                                                     \
+  X(22, NANOSLEEP, nanosleep, 2)                                               \
+  X(23, CLOCK_NANOSLEEP, clock_nanosleep, 4)                                   \
+  X(24, CLOCK_GETTIME, clock_gettime, 2)                                       \
+  X(25, THREAD_CREATE, thread_create, 5)                                       \
+  X(26, THREAD_EXIT, thread_exit, 0)                                           \
+  X(27, SET_FS_BASE, set_fs_base, 1)                                           \
+  X(28, SCHED_YIELD, sched_yield, 0)                                           \
+  X(29, FUTEX, futex, 4)                                                       \
+  X(30, GETCPU, getcpu, 2)                                                     \
+  X(31, READV, readv, 3)                                                       \
+  X(32, WRITEV, writev, 3)                                                     \
+  X(33, PREADV, preadv, 4)                                                     \
+  X(34, PWRITEV, pwritev, 4)                                                   \
+  X(35, IO_RING_SETUP, io_ring_setup, 1)                                       \
+  X(36, IO_RING_ENTER, io_ring_enter, 4)
+
+#define SYSCALL_NUMBER(NUMBER, CONSTANT, NAME, ARGUMENTS)                      \
+  SYSCALL_##CONSTANT = NUMBER,
+
+enum { SYSCALL_LIST(SYSCALL_NUMBER) SYSCALL_COUNT };
+
+#undef SYSCALL_NUMBER
+
+#endif
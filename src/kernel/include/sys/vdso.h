@@ -0,0 +1,21 @@
+#ifndef __VDSO_H__
+#define __VDSO_H__
+
+#include <drivers/rtc.h>
+#include <mm/vmm.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/vdso_layout.h>
+
+#define MSR_TSC_AUX 0xc0000103
+
+struct cpu_locals;
+
+int init_vdso();
+void vdso_init_cpu(struct cpu_locals *locals);
+void vdso_map(pagemap_t *pagemap);
+void vdso_unmap(pagemap_t *pagemap);
+void vdso_set_pid(pagemap_t *pagemap, size_t pid);
+posix_time_t vdso_clock(int clock);
+
+#endif
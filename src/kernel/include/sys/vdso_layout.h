@@ -0,0 +1,43 @@
+#ifndef __VDSO_LAYOUT_H__
+#define __VDSO_LAYOUT_H__
+
+#include <stdint.h>
+
+// What the kernel maps into every process for libc to read without a
+// system call, shared by both sides. Three read-only pages between the
+// stacks and mmap: code, then time data every process sees, then data of
+// the process's own. The code starts with a vdso_header_t and is only ever
+// mapped at VDSO_CODE.
+
+#define VDSO_BASE 0x80000000000
+#define VDSO_CODE VDSO_BASE
+#define VDSO_DATA (VDSO_BASE + 0x1000)
+#define VDSO_PROC (VDSO_BASE + 0x2000)
+
+#define VDSO_MAGIC 0x4f53445674646e4d // "MndtVDSO"
+
+typedef struct vdso_header {
+  uint64_t magic;
+  // int clock_gettime(int clock, struct timespec *time)
+  uintptr_t clock_gettime;
+  // pid_t getpid()
+  uintptr_t getpid;
+  // int getcpu(unsigned int *cpu, unsigned int *node)
+  uintptr_t getcpu;
+} vdso_header_t;
+
+// Written once at boot, before anything can map it. vdso.asm has the
+// offsets.
+typedef struct vdso_data {
+  uint64_t tsc_base;
+  uint64_t tsc_mult;       // Nanoseconds per cycle, 32.32 fixed point
+  uint64_t monotonic_base; // CLOCK_MONOTONIC at tsc_base, nanoseconds
+  int64_t realtime_offset; // CLOCK_REALTIME - CLOCK_MONOTONIC
+  uint32_t rdtscp;         // RDTSCP works and TSC_AUX is the CPU number
+} vdso_data_t;
+
+typedef struct vdso_proc {
+  uint64_t pid;
+} vdso_proc_t;
+
+#endif
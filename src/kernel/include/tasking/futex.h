@@ -0,0 +1,16 @@
+#ifndef __FUTEX_H__
+#define __FUTEX_H__
+
+#include <mm/vmm.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_WAKE_N 2
+
+int futex_wait(pagemap_t *pagemap, uint32_t *word, uint32_t value,
+               uint64_t deadline);
+int futex_wake(pagemap_t *pagemap, uint32_t *word, size_t count);
+
+#endif
@@ -8,12 +8,56 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/syscall.h>
+#include <tasking/timer.h>
 
 #define FDS_COUNT 128
 #define PRIORITY_LEVELS 20
 
+// Kernel threads are scheduled by priority, ahead of user threads, which
+// share what's left by weight
+#define SCHED_PRIORITY 0
+#define SCHED_FAIR 1
+
 #define WNOHANG 1
 
+// User threads keep their TLS pointer here, switched along with them
+#define MSR_FS_BASE 0xc0000100
+
+#define SCHED_STATS_BUCKETS 32
+#define SCHED_STATS_THREADS 256
+
+// Times are in nanoseconds. The histograms are in microseconds, bucket n
+// counting [2^n, 2^(n + 1)) with bucket 0 also counting 0.
+typedef struct sched_cpu_stats {
+  uint64_t schedules;
+  uint64_t switches;
+  uint64_t lock_misses;     // Threads skipped for being on another CPU
+  uint64_t lock_miss_ticks; // Reschedules that found nothing it could run
+  uint64_t steals;
+  uint64_t idle_time;
+  uint64_t wakeup_latency[SCHED_STATS_BUCKETS];
+  uint64_t slice_usage[SCHED_STATS_BUCKETS];
+} sched_cpu_stats_t;
+
+typedef struct sched_thread_stats {
+  uint64_t tid;
+  uint64_t pid;
+  uint64_t cpu;
+  int32_t policy;
+  int32_t priority;
+  uint64_t runtime;
+  uint64_t wait_time;
+} sched_thread_stats_t;
+
+// This is the layout /dev/schedstat hands out. It is followed by
+// cpu_count sched_cpu_stats_t and thread_count sched_thread_stats_t
+// records.
+typedef struct sched_stats {
+  uint64_t cpu_count;
+  uint64_t thread_count;
+  uint64_t dropped_threads;
+} sched_stats_t;
+
 struct proc;
 
 typedef struct thread {
@@ -24,13 +68,40 @@ typedef struct thread {
   size_t tid;
   lock_t lock;
   int queued;
+  int blocked;
+  size_t cpu;
+  timer_t wake_timer;
+  int policy;
   int priority;
+  int dynamic_priority; // Which run list it's on, see schedule()
+  struct thread *run_next;
+  struct thread *run_prev;
+  uint64_t vruntime; // Weighted nanoseconds on the CPU, while queued
+  int64_t vlag;      // vruntime - min_vruntime when it last left a queue
+  struct thread *fair_child;
+  struct thread *fair_sibling;
+  struct thread *fair_prev;
+  uint64_t runtime;   // Nanoseconds spent running
+  uint64_t wait_time; // Nanoseconds spent runnable but not running
+  uint64_t wait_start;
+  uint64_t woken_at;
   uintptr_t kernel_stack;
   size_t which_event;
+  int exiting;    // In sched_thread_exit, see sched_wait
+  int *stop_word; // Set and reads that could wait forever give up
+  struct thread *next_dead;
   registers_t regs;
-  uint8_t fpu_storage[512] __attribute__((aligned(16)));
+  uint64_t fs_base;
+  uintptr_t exit_word; // User word zeroed and woken once the thread is gone
+  uint8_t *fpu_storage;
+  int fpu_loaded; // fpu_storage is live in the registers of its CPU
 } thread_t;
 
+typedef struct run_list {
+  thread_t *head;
+  thread_t *tail;
+} run_list_t;
+
 typedef struct proc {
   int user;
   size_t pid;
@@ -44,19 +115,69 @@ typedef struct proc {
   syscall_file_t *fds[FDS_COUNT];
   event_t *event;
   int status;
+  int exited;
+  size_t ref_count;
+  size_t live_threads;
+  lock_t lock; // Address space layout: mmap_top, mmaped_len, stack_top
 } proc_t;
 
+// Each CPU only runs threads from its own queue: one FIFO list per
+// priority level with a bit in ready for each non-empty one, then a heap of
+// fair threads by vruntime. A thread stays queued while it runs, and its
+// lock is held for as long as some CPU is on its stack. Blocked threads
+// leave the queue, the ones with a timeout get a timer on the CPU's wheel.
+// With nothing to run a CPU switches to idle_thread, which is never queued.
+// Threads that exited here are left on dead for this CPU's reaper thread.
+typedef struct run_queue {
+  lock_t lock; // Taken from the scheduler interrupt, always irqsave
+  run_list_t runnable[PRIORITY_LEVELS];
+  uint32_t ready;
+  thread_t *fair;
+  uint64_t min_vruntime;
+  uint64_t exec_start;
+  uint64_t switched_at;
+  sched_cpu_stats_t stats;
+  thread_t *idle_thread;
+  lock_t reap_lock; // sched_die takes it under cli, always irqsave
+  thread_t *dead;
+  event_t reap_event;
+  size_t length;
+  size_t ticks;
+  uint64_t slice_end;
+  uint8_t current_priority_peg;
+  uint8_t current_priority;
+} run_queue_t;
+
 extern proc_t *kernel_proc;
 
 void init_sched(uintptr_t start_addr);
+void sched_init_run_queue(run_queue_t *run_queue);
 void sched_await();
+uint64_t sched_time();
+void sched_block(thread_t *thread, uint64_t deadline);
+int sched_wake(thread_t *thread, size_t which_event);
+void sched_wait(thread_t *thread);
+void sched_sleep(uint64_t deadline);
+void sched_yield();
+int sched_interrupted();
 proc_t *sched_new_proc(proc_t *old_proc, pagemap_t *pagemap, int user);
 thread_t *sched_new_thread(thread_t *thread, proc_t *parent, uintptr_t addr,
                            int priority, int uid, int gid, int auto_start);
+void sched_enqueue(thread_t *thread);
 int sched_fork(registers_t *regs);
 int sched_run_program(char *path, char *argv[], char *env[], char *stdin,
                       char *stdout, char *stderr, int replace);
 int sched_waitpid(ssize_t pid, int *status, int options);
 void sched_exit(int code);
+int sched_thread_create(uintptr_t entry, uintptr_t arg, uintptr_t stack,
+                        uintptr_t tls, uintptr_t exit_word);
+void sched_thread_exit();
+syscall_file_t *sched_fd_get(proc_t *proc, size_t fd);
+void sched_fd_put(syscall_file_t *file);
+int sched_fd_install(proc_t *proc, syscall_file_t *file, size_t from);
+int sched_fd_close(proc_t *proc, size_t fd);
+size_t sched_stats_snapshot(sched_stats_t *stats, sched_cpu_stats_t *cpus,
+                            sched_thread_stats_t *threads, size_t max_threads);
+void sched_stats_reset();
 
 #endif
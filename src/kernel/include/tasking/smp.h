@@ -2,7 +2,12 @@
 #define __SMP_H__
 
 #include <boot/stivale2.h>
+#include <cpu_locals.h>
+#include <stddef.h>
 
+extern size_t smp_cpu_count;
+
+cpu_locals_t *smp_get_locals(size_t cpu);
 int init_smp(struct stivale2_struct_tag_smp *smp_info);
 
 #endif
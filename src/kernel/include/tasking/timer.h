@@ -0,0 +1,50 @@
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+#include <lock.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Each CPU has a hierarchical timing wheel: TIMER_LEVELS levels of
+// TIMER_SLOTS slots, where a slot on one level spans a whole turn of the
+// level below. Level 0 slots are TIMER_TICK microseconds wide.
+#define TIMER_TICK 16
+#define TIMER_LEVELS 5
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+struct timer;
+struct timer_wheel;
+
+typedef void (*timer_callback_t)(struct timer *timer);
+
+typedef struct timer {
+  uint64_t deadline;
+  uint64_t expires;
+  timer_callback_t callback;
+  void *data;
+  int pending;
+  struct timer_wheel *wheel;
+  struct timer **head;
+  struct timer *next;
+  struct timer *prev;
+} timer_t;
+
+// Everything up to tick now has been handled. Timers that are due wait in
+// expired until their callback runs, one at a time in running.
+typedef struct timer_wheel {
+  lock_t lock; // Taken from the scheduler interrupt, always irqsave
+  uint64_t now;
+  uint64_t occupied[TIMER_LEVELS];
+  timer_t *slots[TIMER_LEVELS][TIMER_SLOTS];
+  timer_t *expired;
+  timer_t *running;
+} timer_wheel_t;
+
+void timer_init_wheel(timer_wheel_t *wheel);
+void timer_add(timer_t *timer, uint64_t deadline);
+int timer_cancel(timer_t *timer);
+void timer_run(timer_wheel_t *wheel, uint64_t now);
+uint64_t timer_next(timer_wheel_t *wheel);
+
+#endif
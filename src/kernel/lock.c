@@ -0,0 +1,50 @@
+#include <lock.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Ticket locks with counters, pushed on here by their first acquisition.
+// Entries are never removed, so readers can walk it without a lock.
+static lock_stats_t *lock_stats_list = NULL;
+
+void lock_stats_register(lock_stats_t *stats) {
+  stats->registered = 1;
+  stats->next = __atomic_load_n(&lock_stats_list, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&lock_stats_list, &stats->next, stats,
+                                      0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+    ;
+}
+
+// The counters are read while their locks may be in use, so a lock's
+// numbers can be one acquisition apart from each other
+size_t lock_stats_snapshot(lock_stat_t *stats, size_t max) {
+  size_t count = 0;
+
+  for (lock_stats_t *lock = __atomic_load_n(&lock_stats_list,
+                                            __ATOMIC_ACQUIRE);
+       lock && count < max; lock = lock->next) {
+    lock_stat_t *stat = &stats[count++];
+    *stat = (lock_stat_t){
+      .acquisitions = lock->acquisitions,
+      .contended = lock->contended,
+      .spins = lock->spins,
+      .max_hold = lock->max_hold,
+    };
+    size_t length = strlen(lock->name);
+    memcpy(stat->name, lock->name,
+           (length < LOCK_STATS_NAME) ? length : LOCK_STATS_NAME - 1);
+  }
+
+  return count;
+}
+
+void lock_stats_reset() {
+  for (lock_stats_t *lock = __atomic_load_n(&lock_stats_list,
+                                            __ATOMIC_ACQUIRE);
+       lock; lock = lock->next) {
+    lock->acquisitions = 0;
+    lock->contended = 0;
+    lock->spins = 0;
+    lock->max_hold = 0;
+  }
+}
@@ -3,7 +3,10 @@
 #include <cpu_locals.h>
 #include <dev/device.h>
 #include <dev/fbdev.h>
+#include <dev/kheapstat.h>
+#include <dev/lockstat.h>
 #include <dev/mousedev.h>
+#include <dev/schedstat.h>
 #include <dev/tty.h>
 #include <drivers/ahci.h>
 #include <drivers/apic.h>
@@ -29,11 +32,13 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/fpu.h>
 #include <sys/gdt.h>
 #include <sys/idt.h>
 #include <sys/irq.h>
 #include <sys/isr.h>
 #include <sys/syscall.h>
+#include <sys/vdso.h>
 #include <tasking/scheduler.h>
 #include <tasking/smp.h>
 
@@ -60,6 +65,7 @@ void k_thread2() {
 void k_thread() {
   klog(3, "Scheduler started and running\n");
   klog_init(init_rtc(), "Real time clock");
+  klog_init(init_vdso(), "vDSO");
   klog_init(init_serial(), "Serial");
   klog_init(pci_enumerate(), "PCI");
   klog_init(init_pit(), "PIT");
@@ -77,6 +83,9 @@ void k_thread() {
   klog_init(init_tty("/dev"), "TTY0");
   klog_init(init_fbdev("/dev"), "Framebuffer device");
   klog_init(init_mousedev("/dev"), "Mouse device");
+  klog_init(init_kheapstat("/dev"), "Kernel heap statistics");
+  klog_init(init_schedstat("/dev"), "Scheduler statistics");
+  klog_init(init_lockstat("/dev"), "Lock statistics");
 
   /* fs_file_t *tty0 = vfs_open("/dev/tty0"); */
 
@@ -116,11 +125,11 @@ void k_thread() {
   sched_run_program("/prog/shell", NULL, args, "/dev/tty0", "/dev/tty0",
                     "/dev/tty0", 0);
 
-  while (1) {
-    /* printf("Thread 1\n"); */
-  }
-  while (1)
-    ;
+  // Kernel threads run ahead of every user thread, so this one can't just
+  // spin. Nothing ever wakes it.
+  asm volatile("cli");
+  sched_block(get_locals()->current_thread, 0);
+  sched_wait(get_locals()->current_thread);
 }
 
 void kernel_main(struct stivale2_struct *bootloader_info) {
@@ -152,6 +161,8 @@ void kernel_main(struct stivale2_struct *bootloader_info) {
   disable_pic();
 
   klog_init(init_fb(framebuffer_info), "Framebuffer");
+  klog_init(init_fpu(), "FPU");
+  klog_init(init_memf(), "Memory routines");
   klog_init(init_acpi(rsdp_info), "ACPI");
   klog_init(init_smp(smp_info), "SMP");
 
@@ -1,3 +1,4 @@
+#include <klog.h>
 #include <lock.h>
 #include <mm/kheap.h>
 #include <mm/liballoc.h>
@@ -13,7 +14,26 @@
     (_a_ + (_b_ - 1)) / _b_;                                                   \
   })
 
-lock_t liballoc_slock = {0};
+#define KHEAP_TAG_MAGIC 0x6b686561
+#define KHEAP_NO_SITE 0xffffffff
+
+// Prepended to every allocation when KHEAP_STATS is on. Kept at 16 bytes so
+// the pointers we hand out keep liballoc's alignment.
+typedef struct kheap_tag {
+  uint32_t site;
+  uint32_t magic;
+  uint64_t size;
+} kheap_tag_t;
+
+ticket_lock_t liballoc_slock = TICKET_LOCK_INIT("liballoc_slock");
+
+#if KHEAP_STATS
+// kmalloc and kfree get called with interrupts off, event_wait does
+static lock_t kheap_stats_lock = {0};
+
+static kheap_stats_t kheap_stats = {0};
+static kheap_site_stats_t kheap_sites[KHEAP_STATS_SITES] = {0};
+#endif
 
 void *liballoc_alloc_pages(int size) {
   return (void *)((uintptr_t)pcalloc(size) + PHYS_MEM_OFFSET);
@@ -24,13 +44,177 @@ int liballoc_free_pages(void *ptr, size_t pages) {
   return 0;
 }
 
-int liballoc_lock() { return LOCK(liballoc_slock); }
+int liballoc_lock() {
+  LOCK(liballoc_slock);
+  return 0;
+}
 
 int liballoc_unlock() {
   UNLOCK(liballoc_slock);
   return 0;
 }
 
+#if KHEAP_STATS
+static inline size_t kheap_size_bucket(size_t size) {
+  size_t bucket = 63 - __builtin_clzll(size | 1);
+  return (bucket >= KHEAP_STATS_BUCKETS) ? KHEAP_STATS_BUCKETS - 1 : bucket;
+}
+
+// Open addressed on the caller's RIP. Sites are never removed, so a full
+// table only means new call sites stop being broken out individually.
+static uint32_t kheap_find_site(uintptr_t rip) {
+  size_t start = (rip >> 4) % KHEAP_STATS_SITES;
+
+  for (size_t i = 0; i < KHEAP_STATS_SITES; i++) {
+    kheap_site_stats_t *site = &kheap_sites[(start + i) % KHEAP_STATS_SITES];
+
+    if (site->rip == rip)
+      return (start + i) % KHEAP_STATS_SITES;
+
+    if (!site->rip) {
+      site->rip = rip;
+      kheap_stats.site_count++;
+      return (start + i) % KHEAP_STATS_SITES;
+    }
+  }
+
+  kheap_stats.dropped_sites++;
+  return KHEAP_NO_SITE;
+}
+
+static void kheap_account_alloc(kheap_tag_t *tag, size_t size, uintptr_t rip) {
+  uint64_t rflags = spin_lock_irqsave(&kheap_stats_lock);
+
+  tag->magic = KHEAP_TAG_MAGIC;
+  tag->size = size;
+  tag->site = kheap_find_site(rip);
+
+  kheap_stats.live_bytes += size;
+  kheap_stats.alloc_count++;
+  kheap_stats.size_histogram[kheap_size_bucket(size)]++;
+  if (kheap_stats.live_bytes > kheap_stats.peak_bytes)
+    kheap_stats.peak_bytes = kheap_stats.live_bytes;
+
+  if (tag->site != KHEAP_NO_SITE) {
+    kheap_site_stats_t *site = &kheap_sites[tag->site];
+    site->live_bytes += size;
+    site->alloc_count++;
+    if (site->live_bytes > site->peak_bytes)
+      site->peak_bytes = site->live_bytes;
+  }
+
+  spin_unlock_irqrestore(&kheap_stats_lock, rflags);
+}
+
+static void kheap_account_free(kheap_tag_t *tag) {
+  uint64_t rflags = spin_lock_irqsave(&kheap_stats_lock);
+
+  kheap_stats.live_bytes -= tag->size;
+  kheap_stats.free_count++;
+
+  if (tag->site != KHEAP_NO_SITE) {
+    kheap_sites[tag->site].live_bytes -= tag->size;
+    kheap_sites[tag->site].free_count++;
+  }
+
+  tag->magic = 0;
+
+  spin_unlock_irqrestore(&kheap_stats_lock, rflags);
+}
+
+// Freeing something twice or that never came from here. Leaking it beats
+// handing liballoc a block it doesn't know.
+static void kheap_bad_pointer(char *func, void *ptr, uintptr_t rip) {
+  klog(2, "%s: %lx isn't a live kmalloc block (caller %lx)\n", func,
+       (uintptr_t)ptr, rip);
+}
+
+static void *kheap_alloc(size_t size, uintptr_t rip) {
+  kheap_tag_t *tag = liballoc_malloc(size + sizeof(kheap_tag_t));
+  if (!tag)
+    return NULL;
+
+  kheap_account_alloc(tag, size, rip);
+
+  return tag + 1;
+}
+
+void *kmalloc(size_t size) {
+  return kheap_alloc(size, (uintptr_t)__builtin_return_address(0));
+}
+
+void kfree(void *ptr) {
+  if (!ptr)
+    return;
+
+  kheap_tag_t *tag = (kheap_tag_t *)ptr - 1;
+  if (tag->magic != KHEAP_TAG_MAGIC) {
+    kheap_bad_pointer("kfree", ptr, (uintptr_t)__builtin_return_address(0));
+    return;
+  }
+
+  kheap_account_free(tag);
+  liballoc_free(tag);
+}
+
+void *krealloc(void *ptr, size_t size) {
+  uintptr_t rip = (uintptr_t)__builtin_return_address(0);
+
+  if (!ptr)
+    return kheap_alloc(size, rip);
+
+  if (!size) {
+    kfree(ptr);
+    return NULL;
+  }
+
+  kheap_tag_t *tag = (kheap_tag_t *)ptr - 1;
+  if (tag->magic != KHEAP_TAG_MAGIC) {
+    kheap_bad_pointer("krealloc", ptr, rip);
+    return NULL;
+  }
+
+  // On failure the old block is still live and still counted. On success
+  // the tag came along with the data, so the old size and site are in it.
+  kheap_tag_t *new_tag = liballoc_realloc(tag, size + sizeof(kheap_tag_t));
+  if (!new_tag)
+    return NULL;
+
+  kheap_account_free(new_tag);
+  kheap_account_alloc(new_tag, size, rip);
+
+  return new_tag + 1;
+}
+
+void *kcalloc(size_t size) {
+  void *ptr = kheap_alloc(size, (uintptr_t)__builtin_return_address(0));
+  if (ptr)
+    memset(ptr, 0, size);
+  return ptr;
+}
+
+size_t kheap_stats_snapshot(kheap_stats_t *stats, kheap_site_stats_t *sites,
+                            size_t max_sites) {
+  size_t count = 0;
+
+  uint64_t rflags = spin_lock_irqsave(&kheap_stats_lock);
+
+  if (stats)
+    *stats = kheap_stats;
+
+  if (sites)
+    for (size_t i = 0; i < KHEAP_STATS_SITES && count < max_sites; i++)
+      if (kheap_sites[i].rip)
+        sites[count++] = kheap_sites[i];
+
+  spin_unlock_irqrestore(&kheap_stats_lock, rflags);
+
+  if (stats)
+    stats->site_count = count;
+
+  return count;
+}
+#else
 void *kmalloc(size_t size) { return liballoc_malloc(size); }
 
 void kfree(void *ptr) { liballoc_free(ptr); }
@@ -38,3 +222,13 @@ void kfree(void *ptr) { liballoc_free(ptr); }
 void *krealloc(void *ptr, size_t size) { return liballoc_realloc(ptr, size); }
 
 void *kcalloc(size_t size) { return liballoc_calloc(size, 1); }
+
+size_t kheap_stats_snapshot(kheap_stats_t *stats, kheap_site_stats_t *sites,
+                            size_t max_sites) {
+  (void)sites;
+  (void)max_sites;
+  if (stats)
+    memset(stats, 0, sizeof(kheap_stats_t));
+  return 0;
+}
+#endif
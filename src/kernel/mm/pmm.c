@@ -14,7 +14,7 @@
 #define BIT_CLEAR(__bit) (pmm_bitmap[(__bit) / 8] &= ~(1 << ((__bit) % 8)))
 #define BIT_TEST(__bit) ((pmm_bitmap[(__bit) / 8] >> ((__bit) % 8)) & 1)
 
-static lock_t pmm_lock = {0};
+static ticket_lock_t pmm_lock = TICKET_LOCK_INIT("pmm_lock");
 
 static uint8_t *pmm_bitmap = 0;
 static uintptr_t highest_page = 0;
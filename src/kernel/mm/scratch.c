@@ -0,0 +1,64 @@
+#include <cpu_locals.h>
+#include <lock.h>
+#include <mm/kheap.h>
+#include <mm/pmm.h>
+#include <mm/scratch.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCRATCH_ALIGN 16
+
+void scratch_init(scratch_arena_t *arena) {
+  *arena = (scratch_arena_t){
+    .base = (uint8_t *)((uintptr_t)pcalloc(SCRATCH_PAGES) + PHYS_MEM_OFFSET),
+    .size = SCRATCH_PAGES * PAGE_SIZE,
+    .top = 0,
+    .overflow = NULL,
+  };
+}
+
+scratch_scope_t scratch_begin() {
+  uint64_t rflags = lock_irq_save();
+
+  scratch_arena_t *arena = &get_locals()->scratch;
+
+  return (scratch_scope_t){
+    .mark = arena->top,
+    .overflow = arena->overflow,
+    .rflags = rflags,
+  };
+}
+
+void *scratch_alloc(size_t size) {
+  scratch_arena_t *arena = &get_locals()->scratch;
+
+  size = (size + SCRATCH_ALIGN - 1) & ~(SCRATCH_ALIGN - 1);
+
+  if (arena->top + size <= arena->size) {
+    void *ptr = arena->base + arena->top;
+    arena->top += size;
+    return ptr;
+  }
+
+  // Out of arena. Fall back to the heap and chain the block onto the arena
+  // so the enclosing scratch_end still releases it.
+  scratch_overflow_t *block = kmalloc(sizeof(scratch_overflow_t) + size);
+  block->next = arena->overflow;
+  arena->overflow = block;
+
+  return block + 1;
+}
+
+void scratch_end(scratch_scope_t scope) {
+  scratch_arena_t *arena = &get_locals()->scratch;
+
+  while (arena->overflow != scope.overflow) {
+    scratch_overflow_t *next = arena->overflow->next;
+    kfree(arena->overflow);
+    arena->overflow = next;
+  }
+
+  arena->top = scope.mark;
+
+  lock_irq_restore(scope.rflags);
+}
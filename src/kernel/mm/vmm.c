@@ -8,6 +8,8 @@
 #include <stdint.h>
 #include <string.h>
 #include <sys/syscall.h>
+#include <sys/vdso.h>
+#include <tasking/scheduler.h>
 #include <vec.h>
 
 #define ALIGN_DOWN(__addr, __align) ((__addr) & ~((__align)-1))
@@ -91,7 +93,7 @@ uintptr_t vmm_virt_to_phys(pagemap_t *pagemap, uintptr_t virtual_address) {
   if (!(pml1[pml_entry1] & 1))
     return 0;
 
-  return (pml1[pml_entry1]) & ~((uintptr_t)0xfff);
+  return (pml1[pml_entry1]) & ~(VMM_PTE_NX | 0xfff);
 }
 
 uintptr_t vmm_get_kernel_address(pagemap_t *pagemap,
@@ -162,6 +164,8 @@ pagemap_t *vmm_create_new_pagemap() {
 
   new_map->ranges.data = kcalloc(sizeof(mmap_range_t *));
 
+  vdso_map(new_map);
+
   return new_map;
 }
 
@@ -187,21 +191,38 @@ pagemap_t *vmm_fork_pagemap(pagemap_t *pg) {
         new_range->phys_addr = mem;
         memcpy((void *)mem, (void *)range->phys_addr, range->length);
       } else {
-        uintptr_t mem = (uintptr_t)vfs_mmap(
-          range->file->file, new_pg, range->file, (void *)range->virt_addr,
-          range->length, range->offset, range->flags, range->prot);
-
-        *new_range = *range;
-        new_range->phys_addr = mem;
+        // The file records the child's range itself if it agrees to map it
+        // again. Files that refuse, like io_ring's, leave the child without
+        // it.
+        kfree(new_range);
+        (void)vfs_mmap(range->file->file, new_pg, range->file,
+                       (void *)range->virt_addr, range->length, range->offset,
+                       range->prot, range->flags);
+        continue;
       }
     }
 
-    vec_push(&new_pg->ranges, new_range);
+    vmm_add_range(new_pg, new_range);
   }
 
   return new_pg;
 }
 
+// A range holds a reference on its file, the mapping can outlive the fd.
+// The caller holds one too.
+void vmm_add_range(pagemap_t *pagemap, mmap_range_t *range) {
+  if (range->file)
+    __atomic_add_fetch(&range->file->ref_count, 1, __ATOMIC_RELAXED);
+  vec_push(&pagemap->ranges, range);
+}
+
+// Dropping the file can close it, so not with the proc's lock held
+void vmm_free_range(mmap_range_t *range) {
+  if (range->file)
+    sched_fd_put(range->file);
+  kfree(range);
+}
+
 void vmm_destroy_pagemap(pagemap_t *pagemap) {
   for (size_t i = 0; i < (size_t)pagemap->ranges.length; i++) {
     for (size_t j = 0; j < pagemap->ranges.data[i]->length; j += PAGE_SIZE)
@@ -210,9 +231,11 @@ void vmm_destroy_pagemap(pagemap_t *pagemap) {
     if (pagemap->ranges.data[i]->flags & MAP_ANON)
       pmm_free_pages((void *)pagemap->ranges.data[i]->phys_addr,
                      pagemap->ranges.data[i]->length / PAGE_SIZE);
+    vmm_free_range(pagemap->ranges.data[i]);
   }
 
   kfree(pagemap->ranges.data);
+  vdso_unmap(pagemap);
   pmm_free_pages((void *)pagemap->top_level, 1);
   kfree(pagemap);
 }
@@ -237,6 +260,22 @@ void vmm_mmap_range(pagemap_t *pagemap, uintptr_t phys_addr,
   vec_push(&pagemap->ranges, mmap_range);
 }
 
+// The physical page behind addr if it's in one of pagemap's ranges, and in
+// a writable one if write is set. 0 otherwise. The caller holds the proc's
+// lock so the range can't go away.
+uintptr_t vmm_range_page(pagemap_t *pagemap, uintptr_t addr, int write) {
+  for (size_t i = 0; i < (size_t)pagemap->ranges.length; i++) {
+    mmap_range_t *range = pagemap->ranges.data[i];
+    if (addr < range->virt_addr || addr >= range->virt_addr + range->length)
+      continue;
+    if (write && !(range->prot & PROT_WRITE))
+      return 0;
+    return vmm_virt_to_phys(pagemap, addr & ~(PAGE_SIZE - 1));
+  }
+
+  return 0;
+}
+
 uintptr_t vmm_range_to_addr(pagemap_t *pagemap, uintptr_t virt_addr) {
   for (size_t i = 0; i < (size_t)pagemap->ranges.length; i++)
     if (pagemap->ranges.data[i]->virt_addr == virt_addr)
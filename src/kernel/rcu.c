@@ -0,0 +1,116 @@
+#include <cpu_locals.h>
+#include <lock.h>
+#include <mm/kheap.h>
+#include <rcu.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <tasking/smp.h>
+
+// Every rcu_free moves the epoch on. A CPU notes the epoch each time it
+// goes through schedule(), and since its readers keep interrupts off, none
+// of them started before that. Something retired in epoch e can go once
+// every CPU has noted an epoch past e.
+
+typedef struct rcu_head {
+  void *ptr;
+  uint64_t epoch;
+  struct rcu_head *next;
+} rcu_head_t;
+
+static uint64_t rcu_epoch = 1;
+static lock_t rcu_lock = {0};
+static rcu_head_t *rcu_pending = NULL;
+
+// Called by schedule() with interrupts off
+void rcu_quiescent(cpu_locals_t *locals) {
+  locals->rcu_epoch = __atomic_load_n(&rcu_epoch, __ATOMIC_ACQUIRE);
+}
+
+// Retired in an epoch before this, nobody can see it anymore. An idle CPU
+// holds nothing and goes through schedule() before it runs anything else.
+// Neither does the caller's: it isn't in a read section, and whatever was
+// retired before the epoch was read got unpublished before that too.
+static uint64_t rcu_safe_epoch() {
+  uint64_t safe = __atomic_load_n(&rcu_epoch, __ATOMIC_SEQ_CST);
+  size_t self = get_locals()->cpu_number;
+
+  for (size_t i = 0; i < smp_cpu_count; i++) {
+    if (i == self)
+      continue;
+
+    cpu_locals_t *locals = smp_get_locals(i);
+    thread_t *current_thread = LOCKED_READ(locals->current_thread);
+    if (!current_thread || current_thread == locals->run_queue.idle_thread)
+      continue;
+
+    uint64_t seen = __atomic_load_n(&locals->rcu_epoch, __ATOMIC_ACQUIRE);
+    if (seen < safe)
+      safe = seen;
+  }
+
+  return safe;
+}
+
+static void rcu_reclaim() {
+  uint64_t safe = rcu_safe_epoch();
+  rcu_head_t *done = NULL;
+
+  LOCK(rcu_lock);
+  rcu_head_t **link = &rcu_pending;
+  while (*link) {
+    rcu_head_t *head = *link;
+    if (head->epoch < safe) {
+      *link = head->next;
+      head->next = done;
+      done = head;
+    } else
+      link = &head->next;
+  }
+  UNLOCK(rcu_lock);
+
+  while (done) {
+    rcu_head_t *next = done->next;
+    kfree(done->ptr);
+    kfree(done);
+    done = next;
+  }
+}
+
+// Frees ptr after a grace period. It has to be unreachable for new readers
+// already. Also frees whatever earlier calls left that is now safe to.
+void rcu_free(void *ptr) {
+  if (!ptr)
+    return;
+
+  rcu_head_t *head = kmalloc(sizeof(rcu_head_t));
+  head->ptr = ptr;
+
+  LOCK(rcu_lock);
+  head->epoch = __atomic_fetch_add(&rcu_epoch, 1, __ATOMIC_SEQ_CST);
+  head->next = rcu_pending;
+  rcu_pending = head;
+  UNLOCK(rcu_lock);
+
+  rcu_reclaim();
+}
+
+// Publishes a copy of *array with item on the end and retires the old one.
+// Writers of the same array have to be serialized by the caller. Returns
+// the item's index.
+size_t rcu_array_push(rcu_array_t **array, void *item) {
+  rcu_array_t *old = *array;
+  size_t length = old ? old->length : 0;
+
+  rcu_array_t *new =
+    kmalloc(sizeof(rcu_array_t) + (length + 1) * sizeof(void *));
+  new->length = length + 1;
+  if (old)
+    memcpy(new->data, old->data, length * sizeof(void *));
+  new->data[length] = item;
+
+  RCU_ASSIGN(*array, new);
+  rcu_free(old);
+
+  return length;
+}
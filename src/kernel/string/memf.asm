@@ -8,13 +8,88 @@ global memcpy16
 global memcpy32
 global memcpy64
 
+extern memf_small_limit
+extern memf_nt_threshold
+extern memf_erms
+
+; memset and memcpy pick a strategy by size. The limits are tuned at boot
+; by init_memf. Below memf_small_limit we use plain 8 byte moves, from
+; memf_nt_threshold up we use non-temporal stores, and in between we use
+; rep movsb/stosb (or movsq/stosq without ERMS). The non-temporal paths
+; run in syscall context with the user's XMM state live, so they save
+; the registers they borrow.
+
 memset:
-    push  rbp
     cld
-    mov   rbp, rsp                   
-    mov   rax, rsi
+    movzx eax, sil
+    mov   r8, 0x0101010101010101
+    imul  rax, r8
+    cmp   rdx, [rel memf_small_limit]
+    jb    .small
+    cmp   rdx, [rel memf_nt_threshold]
+    jae   .nt
+    mov   rcx, rdx
+    cmp   byte [rel memf_erms], 0
+    je    .qwords
+    rep stosb
+    ret
+.qwords:
+    shr   rcx, 3
+    rep stosq
     mov   rcx, rdx
+    and   rcx, 7
+    rep stosb
+    ret
+.small:
+    cmp   rdx, 8
+    jb    .tiny
+    mov   [rdi + rdx - 8], rax
+.small_loop:
+    mov   [rdi], rax
+    add   rdi, 8
+    sub   rdx, 8
+    cmp   rdx, 8
+    ja    .small_loop
+    ret
+.tiny:
+    test  rdx, rdx
+    jz    .done
+.tiny_loop:
+    mov   [rdi], al
+    inc   rdi
+    dec   rdx
+    jnz   .tiny_loop
+.done:
+    ret
+.nt:
+    push  rbp
+    mov   rbp, rsp
+    sub   rsp, 16
+    and   rsp, -16
+    movdqa [rsp], xmm0
+    movq  xmm0, rax
+    punpcklqdq xmm0, xmm0
+    mov   rcx, rdi
+    neg   rcx
+    and   rcx, 15
+    sub   rdx, rcx
     rep stosb
+    mov   rcx, rdx
+    shr   rcx, 6
+.nt_loop:
+    movntdq [rdi], xmm0
+    movntdq [rdi + 16], xmm0
+    movntdq [rdi + 32], xmm0
+    movntdq [rdi + 48], xmm0
+    add   rdi, 64
+    dec   rcx
+    jnz   .nt_loop
+    sfence
+    mov   rcx, rdx
+    and   rcx, 63
+    rep stosb
+    movdqa xmm0, [rsp]
+    mov   rsp, rbp
     pop   rbp
     ret
 
@@ -49,11 +124,90 @@ memset64:
     ret
 
 memcpy:
-    push  rbp
     cld
-    mov   rbp, rsp                    
+    cmp   rdx, [rel memf_small_limit]
+    jb    .small
+    cmp   rdx, [rel memf_nt_threshold]
+    jae   .nt
+    mov   rcx, rdx
+    cmp   byte [rel memf_erms], 0
+    je    .qwords
+    rep   movsb
+    ret
+.qwords:
+    shr   rcx, 3
+    rep   movsq
+    mov   rcx, rdx
+    and   rcx, 7
+    rep   movsb
+    ret
+.small:
+    cmp   rdx, 8
+    jb    .tiny
+    ; The last 8 bytes are loaded up front and stored last, overlapping
+    ; whatever the loop left over
+    mov   r8, [rsi + rdx - 8]
+    lea   r9, [rdi + rdx - 8]
+.small_loop:
+    mov   rax, [rsi]
+    mov   [rdi], rax
+    add   rsi, 8
+    add   rdi, 8
+    sub   rdx, 8
+    cmp   rdx, 8
+    ja    .small_loop
+    mov   [r9], r8
+    ret
+.tiny:
+    test  rdx, rdx
+    jz    .done
+.tiny_loop:
+    mov   al, [rsi]
+    mov   [rdi], al
+    inc   rsi
+    inc   rdi
+    dec   rdx
+    jnz   .tiny_loop
+.done:
+    ret
+.nt:
+    push  rbp
+    mov   rbp, rsp
+    sub   rsp, 64
+    and   rsp, -16
+    movdqa [rsp], xmm0
+    movdqa [rsp + 16], xmm1
+    movdqa [rsp + 32], xmm2
+    movdqa [rsp + 48], xmm3
+    mov   rcx, rdi
+    neg   rcx
+    and   rcx, 15
+    sub   rdx, rcx
+    rep   movsb
+    mov   rcx, rdx
+    shr   rcx, 6
+.nt_loop:
+    movdqu xmm0, [rsi]
+    movdqu xmm1, [rsi + 16]
+    movdqu xmm2, [rsi + 32]
+    movdqu xmm3, [rsi + 48]
+    movntdq [rdi], xmm0
+    movntdq [rdi + 16], xmm1
+    movntdq [rdi + 32], xmm2
+    movntdq [rdi + 48], xmm3
+    add   rsi, 64
+    add   rdi, 64
+    dec   rcx
+    jnz   .nt_loop
+    sfence
     mov   rcx, rdx
+    and   rcx, 63
     rep   movsb
+    movdqa xmm0, [rsp]
+    movdqa xmm1, [rsp + 16]
+    movdqa xmm2, [rsp + 32]
+    movdqa xmm3, [rsp + 48]
+    mov   rsp, rbp
     pop   rbp
     ret
 
@@ -0,0 +1,95 @@
+#include <asm.h>
+#include <cpuid.h>
+#include <klog.h>
+#include <mm/pmm.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Read by memcpy and memset in memf.asm. Until init_memf runs everything
+// but tiny copies goes through rep movsb/stosb, like it always did.
+size_t memf_small_limit = 16;
+size_t memf_nt_threshold = SIZE_MAX;
+uint8_t memf_erms = 1;
+
+#define MEMF_BENCH_SIZE 0x100000
+#define MEMF_BENCH_PAGES (MEMF_BENCH_SIZE / PAGE_SIZE)
+
+#define MEMF_SMALL_SIZE 64
+#define MEMF_SMALL_LIMIT 256
+#define MEMF_MEDIUM_SIZE PAGE_SIZE
+
+// Best of a few rounds, so one interrupt doesn't decide anything
+static uint64_t memf_time(uint8_t *dest, uint8_t *src, size_t size,
+                          size_t iterations) {
+  uint64_t best = UINT64_MAX;
+
+  for (size_t round = 0; round < 4; round++) {
+    uint64_t start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+      memcpy(dest, src, size);
+    uint64_t cycles = rdtsc() - start;
+
+    if (cycles < best)
+      best = cycles;
+  }
+
+  return best;
+}
+
+int init_memf() {
+  uint32_t eax, ebx, ecx, edx;
+  int erms = 0;
+  int fsrm = 0;
+
+  if (__get_cpuid_max(0, NULL) >= 7) {
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    erms = !!(ebx & (1 << 9));
+    fsrm = !!(edx & (1 << 4));
+  }
+
+  uint8_t *src = (uint8_t *)((uintptr_t)pcalloc(MEMF_BENCH_PAGES) +
+                             PHYS_MEM_OFFSET);
+  uint8_t *dest = (uint8_t *)((uintptr_t)pcalloc(MEMF_BENCH_PAGES) +
+                              PHYS_MEM_OFFSET);
+
+  // Medium sizes: rep movsb is only worth trying when the CPU advertises
+  // ERMS, otherwise use rep movsq
+  memf_small_limit = 0;
+  memf_nt_threshold = SIZE_MAX;
+  memf_erms = 0;
+  uint64_t movsq = memf_time(dest, src, MEMF_MEDIUM_SIZE, 64);
+
+  if (erms) {
+    memf_erms = 1;
+    uint64_t movsb = memf_time(dest, src, MEMF_MEDIUM_SIZE, 64);
+    memf_erms = movsb <= movsq;
+  }
+
+  // Small sizes: FSRM makes short rep movsb cheap, otherwise the startup
+  // cost of a rep string op usually loses to a few plain moves
+  uint64_t rep = memf_time(dest, src, MEMF_SMALL_SIZE, 256);
+  memf_small_limit = MEMF_SMALL_LIMIT;
+  uint64_t moves = memf_time(dest, src, MEMF_SMALL_SIZE, 256);
+  if (fsrm && rep <= moves)
+    memf_small_limit = 0;
+
+  // Large sizes: streaming stores skip the cache, which pays off once the
+  // copy doesn't fit in it anyway
+  uint64_t cached = memf_time(dest, src, MEMF_BENCH_SIZE, 2);
+  memf_nt_threshold = MEMF_BENCH_SIZE / 2;
+  uint64_t streamed = memf_time(dest, src, MEMF_BENCH_SIZE, 2);
+  if (streamed >= cached)
+    memf_nt_threshold = SIZE_MAX;
+
+  pmm_free_pages((void *)((uintptr_t)src - PHYS_MEM_OFFSET), MEMF_BENCH_PAGES);
+  pmm_free_pages((void *)((uintptr_t)dest - PHYS_MEM_OFFSET),
+                 MEMF_BENCH_PAGES);
+
+  klog(3, "memcpy/memset: small %s, medium %s, large %s (ERMS %d, FSRM %d)\n",
+       memf_small_limit ? "8 byte moves" : "rep movsb",
+       memf_erms ? "rep movsb" : "rep movsq",
+       (memf_nt_threshold == SIZE_MAX) ? "rep string" : "movntdq", erms, fsrm);
+
+  return 0;
+}
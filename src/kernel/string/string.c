@@ -22,13 +22,26 @@ void strcat(char *dest, char *src) {
     ;
 }
 
+#define ONES 0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+#define HAS_ZERO(x) (((x)-ONES) & ~(x)&HIGHS)
+
+// A word at a time. Aligned 8 byte loads never cross into another page, so
+// reading a little past the terminator is harmless.
 size_t strlen(char *s) {
-  size_t count = 0;
-  while (*s != '\0') {
-    count++;
-    s++;
-  }
-  return count;
+  char *p = s;
+
+  for (; (uintptr_t)p & 7; p++)
+    if (!*p)
+      return p - s;
+
+  uint64_t *w = (uint64_t *)p;
+  while (!HAS_ZERO(*w))
+    w++;
+
+  for (p = (char *)w; *p; p++)
+    ;
+  return p - s;
 }
 
 int strncmp(char *s1, char *s2, size_t n) {
@@ -76,6 +89,13 @@ char *strrchr(char *s, int c) {
 }
 
 int memcmp(char *str_1, char *str_2, size_t size) {
+  // Skip over equal words, then find the differing byte
+  while (size >= 8 && *(uint64_t *)str_1 == *(uint64_t *)str_2) {
+    str_1 += 8;
+    str_2 += 8;
+    size -= 8;
+  }
+
   while (size) {
     if (*str_1 != *str_2)
       return (int)(*str_1) - (int)(*str_2);
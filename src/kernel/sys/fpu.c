@@ -0,0 +1,139 @@
+#include <cpu_locals.h>
+#include <cpuid.h>
+#include <klog.h>
+#include <mm/pmm.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/fpu.h>
+#include <tasking/scheduler.h>
+
+// Threads start with CR0.TS set. The first FPU or SSE instruction they run
+// traps with #NM, and only then is their state loaded. A thread that
+// didn't touch the FPU since it was switched in has nothing to save, so
+// kernel threads never pay for it.
+
+size_t fpu_state_size = 512;
+
+static int fpu_xsave = 0;
+static int fpu_xsaveopt = 0;
+static uint64_t fpu_xcr0 = XCR0_X87 | XCR0_SSE;
+
+static inline void xsetbv(uint32_t reg, uint64_t value) {
+  asm volatile("xsetbv"
+               :
+               : "c"(reg), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+int init_fpu() {
+  uint32_t eax, ebx, ecx, edx;
+
+  __cpuid(1, eax, ebx, ecx, edx);
+  fpu_xsave = !!(ecx & bit_XSAVE);
+
+  if (fpu_xsave && __get_cpuid_max(0, NULL) >= 0xd) {
+    int avx = !!(ecx & bit_AVX);
+
+    __cpuid_count(0xd, 0, eax, ebx, ecx, edx);
+    if (avx && (eax & XCR0_AVX)) {
+      fpu_xcr0 |= XCR0_AVX;
+      // Opmask, ZMM0-15 upper halves and ZMM16-31 only work together
+      if ((eax & XCR0_AVX512) == XCR0_AVX512)
+        fpu_xcr0 |= XCR0_AVX512;
+    }
+
+    __cpuid_count(0xd, 1, eax, ebx, ecx, edx);
+    fpu_xsaveopt = eax & 1;
+  } else
+    fpu_xsave = 0;
+
+  fpu_init_cpu();
+
+  // EBX is the size needed for what's enabled in XCR0 right now
+  if (fpu_xsave) {
+    __cpuid_count(0xd, 0, eax, ebx, ecx, edx);
+    fpu_state_size = ebx;
+  }
+
+  klog(3, "FPU: %s, XCR0 %lx, %lu byte state\n",
+       fpu_xsaveopt ? "xsaveopt" : (fpu_xsave ? "xsave" : "fxsave"), fpu_xcr0,
+       fpu_state_size);
+
+  return 0;
+}
+
+// Run on every CPU after enable_sse
+void fpu_init_cpu() {
+  if (!fpu_xsave)
+    return;
+
+  uint64_t cr4;
+  asm volatile("mov %%cr4, %0" : "=r"(cr4));
+  asm volatile("mov %0, %%cr4" : : "r"(cr4 | CR4_OSXSAVE));
+
+  xsetbv(0, fpu_xcr0);
+}
+
+// XSAVE wants 64 byte alignment, whole pages are the easy way to get it
+void *fpu_alloc_state() {
+  void *state = (void *)((uintptr_t)pcalloc((fpu_state_size + PAGE_SIZE - 1) /
+                                            PAGE_SIZE) +
+                         PHYS_MEM_OFFSET);
+  fpu_init_state(state);
+  return state;
+}
+
+void fpu_free_state(void *state) {
+  pmm_free_pages((void *)((uintptr_t)state - PHYS_MEM_OFFSET),
+                 (fpu_state_size + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+// What fninit and a reset MXCSR would leave behind. An all zero XSAVE
+// header means every other component starts out in its init state.
+void fpu_init_state(void *state) {
+  memset(state, 0, fpu_state_size);
+  *(uint16_t *)state = 0x37f;
+  *(uint32_t *)((uintptr_t)state + 24) = 0x1f80;
+}
+
+void fpu_save(void *state) {
+  if (fpu_xsaveopt)
+    asm volatile("xsaveopt64 %0"
+                 : "+m"(*(uint8_t *)state)
+                 : "a"(UINT32_MAX), "d"(UINT32_MAX)
+                 : "memory");
+  else if (fpu_xsave)
+    asm volatile("xsave64 %0"
+                 : "+m"(*(uint8_t *)state)
+                 : "a"(UINT32_MAX), "d"(UINT32_MAX)
+                 : "memory");
+  else
+    asm volatile("fxsave64 %0" : "+m"(*(uint8_t *)state) : : "memory");
+}
+
+void fpu_restore(void *state) {
+  if (fpu_xsave)
+    asm volatile("xrstor64 %0"
+                 :
+                 : "m"(*(uint8_t *)state), "a"(UINT32_MAX), "d"(UINT32_MAX)
+                 : "memory");
+  else
+    asm volatile("fxrstor64 %0" : : "m"(*(uint8_t *)state) : "memory");
+}
+
+// #NM handler, runs with interrupts off. Returns 0 if the trap wasn't
+// caused by lazy switching.
+int fpu_handle_fault() {
+  thread_t *thread = get_locals()->current_thread;
+
+  if (!thread)
+    return 0;
+
+  fpu_enable();
+  if (!thread->fpu_loaded) {
+    fpu_restore(thread->fpu_storage);
+    thread->fpu_loaded = 1;
+  }
+
+  return 1;
+}
@@ -62,18 +62,18 @@ int init_gdt() {
   gdt.gdt[3] = (gdt_entry_t){.limit_low = 0,
                              .base_low = 0,
                              .base_mid = 0,
-                             .flags = 0xfa,
+                             .flags = 0xf2,
                              .limit_high = 0,
-                             .granularity = 0x2,
-                             .base_high = 0}; // User code descriptor
+                             .granularity = 0x0,
+                             .base_high = 0}; // User data descriptor
 
   gdt.gdt[4] = (gdt_entry_t){.limit_low = 0,
                              .base_low = 0,
                              .base_mid = 0,
-                             .flags = 0xf2,
+                             .flags = 0xfa,
                              .limit_high = 0,
-                             .granularity = 0x0,
-                             .base_high = 0}; // User data descriptor
+                             .granularity = 0x2,
+                             .base_high = 0}; // User code descriptor
 
   load_gdt();
 
@@ -1,6 +1,14 @@
 extern c_isr_handler
 extern c_irq_handler
 
+; Offsets into cpu_locals_t, see cpu_locals.h
+CPU_LOCALS_KERNEL_STACK equ 0
+CPU_LOCALS_USER_STACK equ 8
+
+; Same as GDT_SEG_UCODE and GDT_SEG_UDATA
+SEG_UCODE equ 0x23
+SEG_UDATA equ 0x1b
+
 %macro pushaq 0
     push rax
     push rbx
@@ -37,7 +45,19 @@ extern c_irq_handler
     pop rax
 %endmacro
 
+; The kernel runs with its cpu_locals_t in the GS base, userspace with its
+; own, and swapgs trades them. Only needed when coming from or going back to
+; user mode, which the interrupted cs tells. rsp has to point at the two
+; words a stub pushes before the registers.
+%macro swapgs_if_user 0
+  test byte [rsp + 24], 3
+  jz %%kernel
+  swapgs
+%%kernel:
+%endmacro
+
 isr_stub:
+  swapgs_if_user
   pushaq
 
   mov rdi, [rsp + 120]
@@ -45,12 +65,14 @@ isr_stub:
   call c_isr_handler
   
   popaq
+  swapgs_if_user
   
   add rsp, 16
 
   iretq
 
 irq_stub:
+  swapgs_if_user
   pushaq
 
   mov rdi, [rsp + 120]
@@ -58,6 +80,7 @@ irq_stub:
   call c_irq_handler
   
   popaq
+  swapgs_if_user
   
   add rsp, 16
 
@@ -142,13 +165,17 @@ IRQ 15
 global syscall_isr
 
 extern c_syscall_handler
+extern syscall_bad_rip
 
 syscall_isr:
-  ; cli
   cld
   
   push 0
   push 0x45
+
+  ; Through an interrupt gate, so nothing can come in before the swap
+  swapgs_if_user
+  sti
   
   pushaq
 
@@ -171,10 +198,83 @@ syscall_isr:
   pop rbx
   add rsp, 8 ; Don't restore rax. It has our return value.
 
+  cli
+  swapgs_if_user
   add rsp, 16
 
   iretq
 
+global syscall_entry
+
+; The SYSCALL instruction lands here, see syscall_init_cpu. It left the user
+; rip in rcx and rflags in r11, and SFMASK has turned interrupts off. The
+; fourth argument comes in r10 instead of rcx, as it does for int 0x45 too.
+; The frame is the same registers_t syscall_isr builds, so fork and friends
+; can't tell them apart.
+syscall_entry:
+  swapgs
+  mov [gs:CPU_LOCALS_USER_STACK], rsp
+  mov rsp, [gs:CPU_LOCALS_KERNEL_STACK]
+
+  push SEG_UDATA
+  push qword [gs:CPU_LOCALS_USER_STACK]
+  push r11
+  push SEG_UCODE
+  push rcx
+
+  push 0
+  push 0x45
+
+  push rax
+  push rbx
+  push rcx
+  push rdx
+  push rsi
+  push rdi
+  push rbp
+  push r8
+  push r9
+  push r10
+  push r11
+  push r12
+  push r13
+  push r14
+  push r15
+
+  sti
+
+  mov rdi, rsp
+  call c_syscall_handler
+
+  cli
+
+  ; Callers expect every register but the callee saved ones to be trashed,
+  ; and those the handler kept. Only the rest of the frame is reloaded, and
+  ; the scratch registers are cleared so nothing of the kernel's leaks out.
+  mov rcx, [rsp + 136]
+  mov r11, [rsp + 152]
+  xor edi, edi
+  xor esi, esi
+  xor r8d, r8d
+  xor r9d, r9d
+  xor r10d, r10d
+
+  ; A syscall right at the end of the lower half comes back to a non
+  ; canonical rip. SYSRET and IRETQ would both raise #GP at CPL0 with the
+  ; user's GS already swapped in, so the process is ended here instead,
+  ; still on the kernel's GS.
+  mov rdx, rcx
+  shr rdx, 47
+  jnz .bad_rip
+
+  mov rsp, [rsp + 160]
+  swapgs
+  o64 sysret
+
+.bad_rip:
+  sti
+  call syscall_bad_rip
+
 global schedule_irq
 
 extern schedule
@@ -185,6 +285,8 @@ schedule_irq:
   
   push 0
   push 16
+
+  swapgs_if_user
   
   pushaq
   
@@ -192,6 +294,7 @@ schedule_irq:
   call schedule
 
   popaq
+  swapgs_if_user
   add rsp, 16
 
   iretq
@@ -0,0 +1,538 @@
+#include <cpu_locals.h>
+#include <drivers/rtc.h>
+#include <errno.h>
+#include <event.h>
+#include <fs/vfs.h>
+#include <lock.h>
+#include <mm/kheap.h>
+#include <mm/pmm.h>
+#include <mm/vmm.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/io_ring.h>
+#include <sys/syscall.h>
+#include <tasking/scheduler.h>
+
+// Every ring has a kernel thread of its own that takes SQEs off the shared
+// ring in order, runs them as the process that set the ring up and posts a
+// CQE for each. It's a fair thread at its owner's priority, so a busy ring
+// shares the CPU the way its owner would. io_ring_enter only has to wake it, and with
+// IO_RING_SETUP_SQPOLL not even that while it is still polling. Buffers are
+// copied through the kernel heap with the owner's lock held, so munmap
+// can't take pages away mid-copy but isn't held up by the I/O itself.
+
+#define ALIGN_UP(__addr, __align) (((__addr) + (__align)-1) & ~((__align)-1))
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+#define IO_RING_RW_MAX 0x100000    // Longer READs and WRITEs come back short
+#define IO_RING_POLL_INTERVAL 20   // Microseconds between looks at the SQ
+#define IO_RING_SQ_IDLE 10         // Milliseconds, when sq_idle is 0
+#define IO_RING_PATH_MAX 4096
+
+typedef struct io_ring {
+  io_ring_header_t *header;
+  io_ring_sqe_t *sqes;
+  io_ring_cqe_t *cqes;
+  uintptr_t phys;
+  size_t pages;
+  // The kernel's own copies, the ones in header are only ever written
+  uint32_t sq_head;
+  uint32_t sq_mask;
+  uint32_t cq_tail;
+  uint32_t cq_mask;
+  uint32_t flags;
+  uint64_t sq_idle; // Microseconds
+  // The owner, NULL once it exits or execs, see io_ring_detach
+  proc_t *proc;
+  pagemap_t *pagemap;
+  int uid;
+  int gid;
+  thread_t *worker;
+  event_t work_event;
+  event_t cq_event;
+  event_t exit_event;
+  int stopping;
+  int stopped;
+  int ref_count; // One each for the file, the owner and the worker
+  struct io_ring *next;
+} io_ring_t;
+
+static lock_t io_rings_lock = {0};
+static io_ring_t *io_rings = NULL; // The rings with an owner
+
+static file_ops_t io_ring_file_ops;
+
+static void io_ring_put(io_ring_t *ring) {
+  if (__atomic_sub_fetch(&ring->ref_count, 1, __ATOMIC_ACQ_REL))
+    return;
+
+  pmm_free_pages((void *)ring->phys, ring->pages);
+  kfree(ring->work_event.listeners.data);
+  kfree(ring->cq_event.listeners.data);
+  kfree(ring->exit_event.listeners.data);
+  kfree(ring);
+}
+
+// Returns once the worker is done with the SQE it's on. One stuck in a pipe
+// or tty read gives up, see sched_interrupted. The worker can end up here
+// itself, closing the ring's fd from an SQE, and stops after it.
+static void io_ring_stop(io_ring_t *ring) {
+  LOCKED_WRITE(ring->stopping, 1);
+  event_trigger(&ring->work_event, 0);
+
+  if (get_locals()->current_thread == ring->worker)
+    return;
+
+  event_t *event = &ring->exit_event;
+  while (!LOCKED_READ(ring->stopped))
+    event_await(&event, 1, 1);
+}
+
+// Once the worker is done the owner's fds and memory aren't touched again
+static void io_ring_release_owner(io_ring_t *ring) {
+  io_ring_stop(ring);
+  ring->proc = NULL;
+  ring->pagemap = NULL;
+  io_ring_put(ring);
+}
+
+// Copies len bytes between buf and the owner's memory at addr, to the
+// owner if out is set
+static int io_ring_copy(io_ring_t *ring, uintptr_t addr, void *buf,
+                        size_t len, int out) {
+  if (addr + len < addr || addr + len > 0x800000000000)
+    return -EFAULT;
+
+  int ret = 0;
+
+  LOCK(ring->proc->lock);
+
+  while (len) {
+    size_t chunk = MIN(PAGE_SIZE - addr % PAGE_SIZE, len);
+    uintptr_t page = vmm_range_page(ring->pagemap, addr, out);
+    if (!page) {
+      ret = -EFAULT;
+      break;
+    }
+
+    void *user = (void *)(page + addr % PAGE_SIZE + PHYS_MEM_OFFSET);
+    if (out)
+      memcpy(user, buf, chunk);
+    else
+      memcpy(buf, user, chunk);
+
+    addr += chunk;
+    buf += chunk;
+    len -= chunk;
+  }
+
+  UNLOCK(ring->proc->lock);
+
+  return ret;
+}
+
+static int64_t io_ring_rw(io_ring_t *ring, io_ring_sqe_t *sqe, int write) {
+  if (sqe->offset < -1)
+    return -EINVAL;
+
+  syscall_file_t *file = sched_fd_get(ring->proc, sqe->fd);
+  if (!file)
+    return -EBADF;
+
+  size_t len = MIN(sqe->len, IO_RING_RW_MAX);
+  uint8_t *buf = kmalloc(len);
+  int64_t ret = write ? io_ring_copy(ring, sqe->addr, buf, len, 0) : 0;
+
+  if (!ret) {
+    iovec_t iov = {.iov_base = buf, .iov_len = len};
+    ret = syscall_file_transfer(file, &iov, 1, sqe->offset, write);
+
+    if (!write && ret > 0) {
+      int err = io_ring_copy(ring, sqe->addr, buf, ret, 1);
+      if (err)
+        ret = err;
+    }
+  }
+
+  kfree(buf);
+  sched_fd_put(file);
+  return ret;
+}
+
+static int64_t io_ring_fsync(io_ring_t *ring, io_ring_sqe_t *sqe) {
+  syscall_file_t *file = sched_fd_get(ring->proc, sqe->fd);
+  if (!file)
+    return -EBADF;
+  int ret = ISFIFO(file->file) ? -EINVAL : 0;
+  sched_fd_put(file);
+  return ret;
+}
+
+// The path is copied a page at a time, it can end right before an
+// unmapped one
+static int64_t io_ring_open(io_ring_t *ring, io_ring_sqe_t *sqe) {
+  char *path = kmalloc(IO_RING_PATH_MAX);
+  int64_t ret = -ENAMETOOLONG;
+
+  for (size_t done = 0; done < IO_RING_PATH_MAX;) {
+    uintptr_t addr = sqe->addr + done;
+    size_t chunk = MIN(PAGE_SIZE - addr % PAGE_SIZE, IO_RING_PATH_MAX - done);
+
+    if (io_ring_copy(ring, addr, path + done, chunk, 0)) {
+      ret = -EFAULT;
+      break;
+    }
+
+    size_t end = done;
+    while (end < done + chunk && path[end])
+      end++;
+    if (end < done + chunk) {
+      ret = syscall_do_open(ring->proc, ring->uid, ring->gid, path,
+                            sqe->open_flags, sqe->mode);
+      break;
+    }
+
+    done += chunk;
+  }
+
+  kfree(path);
+  return ret;
+}
+
+static int64_t io_ring_run(io_ring_t *ring, io_ring_sqe_t *sqe) {
+  switch (sqe->opcode) {
+    case IO_RING_OP_NOP:
+      return 0;
+    case IO_RING_OP_READ:
+      return io_ring_rw(ring, sqe, 0);
+    case IO_RING_OP_WRITE:
+      return io_ring_rw(ring, sqe, 1);
+    case IO_RING_OP_FSYNC:
+      return io_ring_fsync(ring, sqe);
+    case IO_RING_OP_OPEN:
+      return io_ring_open(ring, sqe);
+    case IO_RING_OP_CLOSE:
+      return sched_fd_close(ring->proc, sqe->fd);
+  }
+
+  return -EINVAL;
+}
+
+// A full CQ drops the CQE and counts it in cq_overflow
+static void io_ring_post(io_ring_t *ring, uint64_t user_data, int32_t res) {
+  io_ring_header_t *header = ring->header;
+  uint32_t head = __atomic_load_n(&header->cq_head, __ATOMIC_ACQUIRE);
+
+  if (ring->cq_tail - head > ring->cq_mask) {
+    __atomic_add_fetch(&header->cq_overflow, 1, __ATOMIC_RELEASE);
+  } else {
+    ring->cqes[ring->cq_tail & ring->cq_mask] = (io_ring_cqe_t){
+      .user_data = user_data,
+      .res = res,
+    };
+    ring->cq_tail++;
+    __atomic_store_n(&header->cq_tail, ring->cq_tail, __ATOMIC_RELEASE);
+  }
+
+  event_trigger(&ring->cq_event, 1);
+}
+
+static void io_ring_worker(io_ring_t *ring) {
+  io_ring_header_t *header = ring->header;
+  event_t *event = &ring->work_event;
+  uint64_t idle_since = sched_time();
+
+  while (!LOCKED_READ(ring->stopping)) {
+    uint32_t tail = __atomic_load_n(&header->sq_tail, __ATOMIC_ACQUIRE);
+
+    if (tail != ring->sq_head) {
+      // Copied first, the process may reuse the slot once sq_head moves
+      io_ring_sqe_t sqe = ring->sqes[ring->sq_head & ring->sq_mask];
+      ring->sq_head++;
+      __atomic_store_n(&header->sq_head, ring->sq_head, __ATOMIC_RELEASE);
+
+      io_ring_post(ring, sqe.user_data, io_ring_run(ring, &sqe));
+      idle_since = sched_time();
+      continue;
+    }
+
+    if (ring->flags & IO_RING_SETUP_SQPOLL) {
+      if (sched_time() - idle_since < ring->sq_idle) {
+        sched_sleep(sched_time() + IO_RING_POLL_INTERVAL);
+        continue;
+      }
+
+      // Looked at again with the flag up, or an SQE that came in between
+      // would wait for a wakeup nobody sends
+      __atomic_or_fetch(&header->sq_flags, IO_RING_SQ_NEED_WAKEUP,
+                        __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&header->sq_tail, __ATOMIC_SEQ_CST) !=
+          ring->sq_head) {
+        __atomic_and_fetch(&header->sq_flags, ~IO_RING_SQ_NEED_WAKEUP,
+                           __ATOMIC_SEQ_CST);
+        continue;
+      }
+    }
+
+    event_await(&event, 1, 1);
+
+    __atomic_and_fetch(&header->sq_flags, ~IO_RING_SQ_NEED_WAKEUP,
+                       __ATOMIC_SEQ_CST);
+    idle_since = sched_time();
+  }
+
+  LOCKED_WRITE(ring->stopped, 1);
+  event_trigger(&ring->exit_event, 1);
+  io_ring_put(ring);
+
+  sched_thread_exit();
+}
+
+static ssize_t io_ring_read(fs_file_t *file, uint8_t *buf, size_t offset,
+                            size_t count) {
+  (void)file;
+  (void)buf;
+  (void)offset;
+  (void)count;
+  return -EINVAL;
+}
+
+static ssize_t io_ring_write(fs_file_t *file, uint8_t *buf, size_t offset,
+                             size_t count) {
+  (void)file;
+  (void)buf;
+  (void)offset;
+  (void)count;
+  return -EINVAL;
+}
+
+static uint64_t io_ring_ioctl(fs_file_t *file, uint64_t cmd, void *arg) {
+  (void)file;
+  (void)cmd;
+  (void)arg;
+  return -EINVAL;
+}
+
+// Only the owner can map it. The range is recorded as private so fork asks
+// again for the child, which is refused, rather than sharing pages that go
+// away with the owner. The range keeps the file open until it's unmapped.
+static void *io_ring_mmap(fs_file_t *file, pagemap_t *pg,
+                          syscall_file_t *sfile, void *addr, size_t size,
+                          size_t offset, int prot, int flags) {
+  io_ring_t *ring = file->private_data;
+
+  if (!ring->pagemap || pg != ring->pagemap)
+    return (void *)-EACCES;
+  if (offset || size > ring->pages * PAGE_SIZE || !(flags & MAP_SHARED))
+    return (void *)-EINVAL;
+
+  size = ALIGN_UP(size, PAGE_SIZE);
+  for (size_t i = 0; i < size; i += PAGE_SIZE)
+    vmm_map_page(pg, ring->phys + i, (uintptr_t)addr + i,
+                 (prot & PROT_WRITE) ? 0b111 : 0b101);
+
+  mmap_range_t *mmap_range = kmalloc(sizeof(mmap_range_t));
+  *mmap_range = (mmap_range_t){
+    .file = sfile,
+    .flags = MAP_PRIVATE,
+    .length = size,
+    .offset = 0,
+    .prot = prot,
+    .phys_addr = ring->phys,
+    .virt_addr = (uintptr_t)addr,
+  };
+
+  vmm_add_range(pg, mmap_range);
+
+  return (void *)ring->phys;
+}
+
+static int io_ring_close(fs_file_t *file) {
+  io_ring_t *ring = file->private_data;
+
+  io_ring_stop(ring);
+  io_ring_put(ring);
+
+  kfree(file->path);
+  kfree(file);
+  return 0;
+}
+
+static file_ops_t io_ring_file_ops = {
+  .read = io_ring_read,
+  .write = io_ring_write,
+  .close = io_ring_close,
+  .ioctl = io_ring_ioctl,
+  .mmap = io_ring_mmap,
+};
+
+// Fills in the rest of params and returns the fd to mmap
+int io_ring_setup(io_ring_params_t *params) {
+  if (!params->sq_entries || params->sq_entries > IO_RING_ENTRIES_MAX)
+    return -EINVAL;
+  if (params->flags & ~IO_RING_SETUP_SQPOLL)
+    return -EINVAL;
+
+  uint32_t entries = 1;
+  while (entries < params->sq_entries)
+    entries <<= 1;
+
+  params->sq_entries = entries;
+  params->cq_entries = entries * 2;
+  params->sqes_offset = PAGE_SIZE;
+  params->cqes_offset =
+    ALIGN_UP(params->sqes_offset + entries * sizeof(io_ring_sqe_t), PAGE_SIZE);
+  params->size = ALIGN_UP(params->cqes_offset +
+                            params->cq_entries * sizeof(io_ring_cqe_t),
+                          PAGE_SIZE);
+
+  thread_t *thread = get_locals()->current_thread;
+
+  io_ring_t *ring = kcalloc(sizeof(io_ring_t));
+  ring->pages = params->size / PAGE_SIZE;
+  ring->phys = (uintptr_t)pcalloc(ring->pages);
+  if (!ring->phys) {
+    kfree(ring);
+    return -ENOMEM;
+  }
+
+  ring->header = (io_ring_header_t *)(ring->phys + PHYS_MEM_OFFSET);
+  ring->sqes = (void *)ring->header + params->sqes_offset;
+  ring->cqes = (void *)ring->header + params->cqes_offset;
+  ring->sq_mask = params->sq_entries - 1;
+  ring->cq_mask = params->cq_entries - 1;
+  ring->header->sq_mask = ring->sq_mask;
+  ring->header->cq_mask = ring->cq_mask;
+  ring->flags = params->flags;
+  ring->sq_idle = (params->sq_idle ? params->sq_idle : IO_RING_SQ_IDLE) * 1000;
+  ring->proc = thread->parent;
+  ring->pagemap = thread->parent->pagemap;
+  ring->uid = thread->uid;
+  ring->gid = thread->gid;
+  ring->ref_count = 3;
+
+  posix_time_t tim = rtc_mktime(rtc_get_datetime());
+
+  fs_file_t *file = kmalloc(sizeof(fs_file_t));
+  *file = (fs_file_t){
+    .path = strdup("io_ring"),
+    .uid = thread->uid,
+    .gid = thread->gid,
+    .file_ops = &io_ring_file_ops,
+    .fs = NULL,
+    .length = 0,
+    .inode = (uint64_t)file,
+    .private_data = ring,
+    .mode = 0600,
+    .last_access_time = tim,
+    .last_modification_time = tim,
+    .last_status_change_time = tim,
+    .creation_time = tim,
+    .ref_count = 1,
+  };
+
+  syscall_file_t *sfile = kmalloc(sizeof(syscall_file_t));
+  *sfile = (syscall_file_t){
+    .file = file,
+    .flags = O_RDWR,
+  };
+
+  ring->worker = sched_new_thread(NULL, kernel_proc, (uintptr_t)io_ring_worker,
+                                  thread->priority, 0, 0, 0);
+  ring->worker->policy = SCHED_FAIR;
+  ring->worker->stop_word = &ring->stopping;
+  ring->worker->regs.rdi = (uintptr_t)ring;
+  sched_enqueue(ring->worker);
+
+  LOCK(io_rings_lock);
+  ring->next = io_rings;
+  io_rings = ring;
+  UNLOCK(io_rings_lock);
+
+  int fd = sched_fd_install(ring->proc, sfile, 0);
+  if (fd < 0) {
+    LOCK(io_rings_lock);
+    io_ring_t **prev = &io_rings;
+    while (*prev != ring)
+      prev = &(*prev)->next;
+    *prev = ring->next;
+    UNLOCK(io_rings_lock);
+
+    io_ring_release_owner(ring);
+    vfs_close(file);
+    kfree(sfile);
+  }
+
+  return fd;
+}
+
+// Returns how many SQEs there were to submit, up to to_submit. Only the
+// owner can enter, a child that got the fd through fork can't.
+int64_t io_ring_enter(size_t fd, uint32_t to_submit, uint32_t min_complete,
+                      uint32_t flags) {
+  proc_t *proc = get_locals()->current_thread->parent;
+
+  syscall_file_t *file = sched_fd_get(proc, fd);
+  if (!file)
+    return -EBADF;
+
+  io_ring_t *ring = file->file->private_data;
+  int64_t ret = -EINVAL;
+
+  if (file->file->file_ops != &io_ring_file_ops || ring->proc != proc)
+    goto out;
+  if ((flags & IO_RING_ENTER_GETEVENTS) && min_complete > ring->cq_mask + 1)
+    goto out;
+
+  io_ring_header_t *header = ring->header;
+  uint32_t queued = __atomic_load_n(&header->sq_tail, __ATOMIC_ACQUIRE) -
+                    __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE);
+  ret = MIN(to_submit, queued);
+
+  if (ring->flags & IO_RING_SETUP_SQPOLL) {
+    if (flags & IO_RING_ENTER_SQ_WAKEUP)
+      event_trigger(&ring->work_event, 0);
+  } else if (ret) {
+    event_trigger(&ring->work_event, 0);
+  }
+
+  if (flags & IO_RING_ENTER_GETEVENTS) {
+    event_t *event = &ring->cq_event;
+    while (__atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE) -
+             __atomic_load_n(&header->cq_head, __ATOMIC_ACQUIRE) <
+           min_complete) {
+      // Woken by sched_exit, the thread is on its way out
+      if (sched_interrupted()) {
+        ret = -EINTR;
+        break;
+      }
+      event_await(&event, 1, 1);
+    }
+  }
+
+out:
+  sched_fd_put(file);
+  return ret;
+}
+
+// For an owner that's exiting or replacing its image, before its fds and
+// pagemap go. Its rings stop taking SQEs and the pages go with the last
+// of the file and the owner.
+void io_ring_detach(proc_t *proc) {
+  while (1) {
+    LOCK(io_rings_lock);
+    io_ring_t **prev = &io_rings;
+    while (*prev && (*prev)->proc != proc)
+      prev = &(*prev)->next;
+    io_ring_t *ring = *prev;
+    if (ring)
+      *prev = ring->next;
+    UNLOCK(io_rings_lock);
+
+    if (!ring)
+      return;
+
+    io_ring_release_owner(ring);
+  }
+}
@@ -1,3 +1,4 @@
+#include <asm.h>
 #include <cpu_locals.h>
 #include <dev/device.h>
 #include <drivers/ahci.h>
@@ -13,12 +14,16 @@
 #include <mm/vmm.h>
 #include <printf.h>
 #include <registers.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/gdt.h>
 #include <sys/idt.h>
+#include <sys/io_ring.h>
 #include <sys/syscall.h>
+#include <sys/vdso.h>
+#include <tasking/futex.h>
 #include <tasking/scheduler.h>
 #include <vec.h>
 
@@ -31,18 +36,34 @@
 #define MAX_HEAP_SIZE 0x10000
 
 extern void syscall_isr();
+extern void syscall_entry();
 
+// int 0x45 stays around for anything that doesn't use libc's intsyscall
 int init_syscalls() {
-  idt_set_gate(&idt[0x45], 1, 1, syscall_isr);
+  idt_set_gate(&idt[0x45], 1, 0, syscall_isr);
   return 0;
 }
 
-size_t syscall_open(char *path, int flags, int mode) {
+// Sets up SYSCALL on this CPU. It loads cs from STAR[47:32] and ss 8 above,
+// SYSRET cs from 16 above STAR[63:48] and ss from 8 above. SFMASK turns
+// interrupts off until syscall_entry is on the kernel stack, along with the
+// direction, trap and alignment check flags.
+void syscall_init_cpu() {
+  wrmsr(MSR_STAR, ((uint64_t)(GDT_SEG_UDATA - 8) << 48) |
+                    ((uint64_t)GDT_SEG_KCODE << 32));
+  wrmsr(MSR_LSTAR, (uint64_t)syscall_entry);
+  wrmsr(MSR_SFMASK, 0x40700);
+  wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+}
+
+// Opens path for proc with the permissions of uid and gid
+int syscall_do_open(proc_t *proc, int uid, int gid, char *path, int flags,
+                    int mode) {
   fs_file_t *file = vfs_open((char *)path);
 
   if (!file) {
     if (!(flags & O_CREAT))
-      return (size_t)-ENOENT;
+      return -ENOENT;
 
     char *str = strdup(path);
     for (ssize_t i = strlen(str) - 1; i >= 0; i--)
@@ -58,42 +79,31 @@ size_t syscall_open(char *path, int flags, int mode) {
     if (!parent)
       return -ENOENT;
 
-    if (flags & O_RDONLY &&
-        vfs_check_can_read(parent, CURRENT_THREAD->uid, CURRENT_THREAD->gid))
+    if (flags & O_RDONLY && vfs_check_can_read(parent, uid, gid))
       return -EACCES;
-    else if (flags & O_WRONLY &&
-             vfs_check_can_write(parent, CURRENT_THREAD->uid,
-                                 CURRENT_THREAD->gid))
+    else if (flags & O_WRONLY && vfs_check_can_write(parent, uid, gid))
       return -EACCES;
-    else if (flags & O_RDWR && (vfs_check_can_read(parent, CURRENT_THREAD->uid,
-                                                   CURRENT_THREAD->gid) ||
-                                vfs_check_can_write(parent, CURRENT_THREAD->uid,
-                                                    CURRENT_THREAD->gid)))
+    else if (flags & O_RDWR && (vfs_check_can_read(parent, uid, gid) ||
+                                vfs_check_can_write(parent, uid, gid)))
       return -EACCES;
 
-    if (flags & O_EXEC &&
-        vfs_check_can_exec(parent, CURRENT_THREAD->uid, CURRENT_THREAD->gid))
+    if (flags & O_EXEC && vfs_check_can_exec(parent, uid, gid))
       return -EACCES;
 
     vfs_close(parent);
 
-    file = vfs_create(path, mode, CURRENT_THREAD->uid, CURRENT_THREAD->gid);
+    file = vfs_create(path, mode, uid, gid);
   }
 
-  if (flags & O_RDONLY &&
-      vfs_check_can_read(file, CURRENT_THREAD->uid, CURRENT_THREAD->gid))
+  if (flags & O_RDONLY && vfs_check_can_read(file, uid, gid))
     return -EACCES;
-  else if (flags & O_WRONLY &&
-           vfs_check_can_write(file, CURRENT_THREAD->uid, CURRENT_THREAD->gid))
+  else if (flags & O_WRONLY && vfs_check_can_write(file, uid, gid))
     return -EACCES;
-  else if (flags & O_RDWR && (vfs_check_can_read(file, CURRENT_THREAD->uid,
-                                                 CURRENT_THREAD->gid) ||
-                              vfs_check_can_write(file, CURRENT_THREAD->uid,
-                                                  CURRENT_THREAD->gid)))
+  else if (flags & O_RDWR && (vfs_check_can_read(file, uid, gid) ||
+                              vfs_check_can_write(file, uid, gid)))
     return -EACCES;
 
-  if (flags & O_EXEC &&
-      vfs_check_can_exec(file, CURRENT_THREAD->uid, CURRENT_THREAD->gid))
+  if (flags & O_EXEC && vfs_check_can_exec(file, uid, gid))
     return -EACCES;
 
   syscall_file_t *sfile = kmalloc(sizeof(syscall_file_t));
@@ -104,36 +114,24 @@ size_t syscall_open(char *path, int flags, int mode) {
 
   sfile->file->offset = 0;
 
-  size_t i;
-  for (i = 0; i < FDS_COUNT; i++)
-    if (!CURRENT_PROC->fds[i]) {
-      CURRENT_PROC->fds[i] = sfile;
-      break;
-    }
-
-  if (i == FDS_COUNT) {
+  int fd = sched_fd_install(proc, sfile, 0);
+  if (fd < 0) {
     vfs_close(file);
     kfree(sfile);
-    return -EMFILE;
   }
 
-  return i;
+  return fd;
 }
 
-int syscall_close(size_t id) {
-  syscall_file_t *file = CURRENT_PROC->fds[id];
-  if (!file)
-    return -EBADF;
-  vfs_close(file->file);
-  kfree(file);
-  CURRENT_PROC->fds[id] = NULL;
-  return 0;
+size_t syscall_open(char *path, int flags, int mode) {
+  return syscall_do_open(CURRENT_PROC, CURRENT_THREAD->uid,
+                         CURRENT_THREAD->gid, path, flags, mode);
 }
 
-ssize_t syscall_read(size_t id, uint8_t *buffer, size_t size) {
-  syscall_file_t *file = CURRENT_PROC->fds[id];
-  if (!file)
-    return -EBADF;
+int64_t syscall_close(size_t id) { return sched_fd_close(CURRENT_PROC, id); }
+
+static ssize_t syscall_do_read(syscall_file_t *file, uint8_t *buffer,
+                               size_t size) {
   if (!(file->flags & (O_RDONLY | O_RDWR)))
     return -EINVAL;
   if (!size)
@@ -147,13 +145,24 @@ ssize_t syscall_read(size_t id, uint8_t *buffer, size_t size) {
 
   file->file->offset += size;
 
-  return read;
+  // Only pipes and character devices report how much they moved. Files and
+  // block devices either moved all of it or failed.
+  if (ISFIFO(file->file) || S_ISCHR(file->file->mode) || read < 0)
+    return read;
+  return size;
 }
 
-ssize_t syscall_write(size_t id, uint8_t *buffer, size_t size) {
-  syscall_file_t *file = CURRENT_PROC->fds[id];
+ssize_t syscall_read(size_t id, uint8_t *buffer, size_t size) {
+  syscall_file_t *file = sched_fd_get(CURRENT_PROC, id);
   if (!file)
-    return 0;
+    return -EBADF;
+  ssize_t ret = syscall_do_read(file, buffer, size);
+  sched_fd_put(file);
+  return ret;
+}
+
+static ssize_t syscall_do_write(syscall_file_t *file, uint8_t *buffer,
+                                size_t size) {
   if (!(file->flags & (O_WRONLY | O_RDWR)))
     return 0;
   if (!size)
@@ -163,14 +172,100 @@ ssize_t syscall_write(size_t id, uint8_t *buffer, size_t size) {
       !ISFIFO(file->file))
     size = file->file->length - file->file->offset;
 
-  ssize_t read = vfs_write(file->file, buffer, file->file->offset, size);
+  ssize_t written = vfs_write(file->file, buffer, file->file->offset, size);
 
   file->file->offset += size;
 
-  return read;
+  if (ISFIFO(file->file) || S_ISCHR(file->file->mode) || written < 0)
+    return written;
+  return size;
+}
+
+ssize_t syscall_write(size_t id, uint8_t *buffer, size_t size) {
+  syscall_file_t *file = sched_fd_get(CURRENT_PROC, id);
+  if (!file)
+    return 0;
+  ssize_t ret = syscall_do_write(file, buffer, size);
+  sched_fd_put(file);
+  return ret;
+}
+
+// offset is -1 to go from and move the file's own offset, like read and
+// write do. iov is the kernel's, it may get cut down to the file's length.
+ssize_t syscall_file_transfer(syscall_file_t *file, iovec_t *iov,
+                              size_t count, int64_t offset, int write) {
+  if (!(file->flags & (write ? O_WRONLY | O_RDWR : O_RDONLY | O_RDWR)))
+    return write ? 0 : -EINVAL;
+  if (offset != -1 && ISFIFO(file->file))
+    return -ESPIPE;
+
+  size_t start = offset == -1 ? file->file->offset : (size_t)offset;
+  size_t size = iov_length(iov, count);
+
+  if (size + start > file->file->length && !ISDEV(file->file) &&
+      !ISFIFO(file->file)) {
+    size = start < file->file->length ? file->file->length - start : 0;
+    count = iov_truncate(iov, count, size);
+  }
+  if (!size)
+    return 0;
+
+  ssize_t ret = write ? vfs_writev(file->file, iov, count, start)
+                      : vfs_readv(file->file, iov, count, start);
+
+  if (offset == -1)
+    file->file->offset += size;
+
+  if (!ISFIFO(file->file) && !S_ISCHR(file->file->mode) && ret >= 0)
+    return size;
+  return ret;
 }
 
-int syscall_execve(char *path, char **argv, char **env) {
+static ssize_t syscall_do_transfer(size_t id, iovec_t *user_iov,
+                                   int64_t iov_count, int64_t offset,
+                                   int write) {
+  if (iov_count < 0 || iov_count > IOV_MAX)
+    return -EINVAL;
+
+  syscall_file_t *file = sched_fd_get(CURRENT_PROC, id);
+  if (!file)
+    return -EBADF;
+
+  // The array is copied, a thread could change it under us otherwise
+  iovec_t *iov = kmalloc(iov_count * sizeof(iovec_t));
+  memcpy(iov, user_iov, iov_count * sizeof(iovec_t));
+
+  ssize_t ret = syscall_file_transfer(file, iov, iov_count, offset, write);
+
+  kfree(iov);
+  sched_fd_put(file);
+  return ret;
+}
+
+ssize_t syscall_readv(size_t id, iovec_t *iov, int64_t count) {
+  return syscall_do_transfer(id, iov, count, -1, 0);
+}
+
+ssize_t syscall_writev(size_t id, iovec_t *iov, int64_t count) {
+  return syscall_do_transfer(id, iov, count, -1, 1);
+}
+
+// Leave the file's offset alone, so threads sharing it don't race
+ssize_t syscall_preadv(size_t id, iovec_t *iov, int64_t count,
+                       int64_t offset) {
+  if (offset < 0)
+    return -EINVAL;
+  return syscall_do_transfer(id, iov, count, offset, 0);
+}
+
+ssize_t syscall_pwritev(size_t id, iovec_t *iov, int64_t count,
+                        int64_t offset) {
+  if (offset < 0)
+    return -EINVAL;
+  return syscall_do_transfer(id, iov, count, offset, 1);
+}
+
+int64_t syscall_execve(char *path, char **argv, char **env) {
   fs_file_t *file = vfs_open((char *)path);
   if (!file)
     return -ENOENT;
@@ -185,13 +280,9 @@ int syscall_execve(char *path, char **argv, char **env) {
                            "/dev/tty0", 1);
 }
 
-void *syscall_mmap(mmap_args_t *args) {
-  if (args->fd > -1) {
-    if (args->fd >= FDS_COUNT || !CURRENT_PROC->fds[args->fd])
-      return (void *)-EBADF;
-    if (!(CURRENT_PROC->fds[args->fd]->flags & (O_RDONLY | O_RDWR)))
-      return (void *)-EACCES;
-  }
+static void *syscall_do_mmap(mmap_args_t *args, syscall_file_t *file) {
+  if (file && !(file->flags & (O_RDONLY | O_RDWR)))
+    return (void *)-EACCES;
   if (!args->length)
     return (void *)-EINVAL;
   if (!(args->flags & MAP_SHARED) && !(args->flags & MAP_PRIVATE))
@@ -223,11 +314,9 @@ void *syscall_mmap(mmap_args_t *args) {
     vmm_mmap_range(CURRENT_PAGEMAP, given_pages, addr, needed_pages * PAGE_SIZE,
                    args->flags, args->prot);
   } else {
-    if (args->fd < 0)
+    if (!file)
       return (void *)-EBADF;
 
-    syscall_file_t *file = CURRENT_PROC->fds[args->fd];
-
     if (args->prot & PROT_WRITE && args->flags & MAP_SHARED &&
         !(file->flags & (O_RDWR | O_WRONLY)))
       return (void *)-EACCES;
@@ -240,48 +329,102 @@ void *syscall_mmap(mmap_args_t *args) {
     size_t flg = args->flags;
 
     vmm_load_pagemap(&kernel_pagemap);
-    (void)vfs_mmap(file->file, CURRENT_PAGEMAP, file, (void *)addr, len, off,
-                   prt, flg);
+    void *ret = vfs_mmap(file->file, CURRENT_PAGEMAP, file, (void *)addr, len,
+                         off, prt, flg);
     vmm_load_pagemap(CURRENT_PAGEMAP);
+
+    // NULL if the file can't be mapped like that, or a negative errno
+    if (!ret || (intptr_t)ret < 0) {
+      CURRENT_PROC->mmaped_len -= needed_pages * PAGE_SIZE;
+      return ret ? ret : (void *)-EINVAL;
+    }
   }
 
   return (void *)addr;
 }
 
-int syscall_munmap(void *addr, size_t length) {
+// Threads of a process share mmap_top and the pagemap's ranges
+void *syscall_mmap(void *addr, size_t length, int prot, int flags, int fd,
+                   size_t offset) {
+  mmap_args_t args = {
+    .addr = addr,
+    .length = length,
+    .flags = flags,
+    .prot = prot,
+    .fd = fd,
+    .offset = offset,
+  };
+
+  syscall_file_t *file = NULL;
+  if (fd > -1) {
+    file = sched_fd_get(CURRENT_PROC, fd);
+    if (!file)
+      return (void *)-EBADF;
+  }
+
+  LOCK(CURRENT_PROC->lock);
+  void *ret = syscall_do_mmap(&args, file);
+  UNLOCK(CURRENT_PROC->lock);
+
+  if (file)
+    sched_fd_put(file);
+  return ret;
+}
+
+// Returns the range it took out, for the caller to free
+static mmap_range_t *syscall_do_munmap(void *addr, size_t length) {
   for (size_t i = 0; i < (size_t)CURRENT_PAGEMAP->ranges.length; i++) {
-    if ((void *)CURRENT_PAGEMAP->ranges.data[i]->virt_addr == addr) {
-      vec_remove(&CURRENT_PAGEMAP->ranges, CURRENT_PAGEMAP->ranges.data[i]);
-      for (size_t i = 0; i < length; i += PAGE_SIZE)
-        vmm_unmap_page(CURRENT_PAGEMAP, (uintptr_t)(addr + i));
-      if (CURRENT_PAGEMAP->ranges.data[i]->flags & MAP_ANON)
-        pmm_free_pages((void *)CURRENT_PAGEMAP->ranges.data[i]->phys_addr,
-                       CURRENT_PAGEMAP->ranges.data[i]->length / PAGE_SIZE);
-      return 0;
+    mmap_range_t *range = CURRENT_PAGEMAP->ranges.data[i];
+    if ((void *)range->virt_addr == addr) {
+      vec_remove(&CURRENT_PAGEMAP->ranges, range);
+      for (size_t j = 0; j < length; j += PAGE_SIZE)
+        vmm_unmap_page(CURRENT_PAGEMAP, (uintptr_t)(addr + j));
+      if (range->flags & MAP_ANON)
+        pmm_free_pages((void *)range->phys_addr, range->length / PAGE_SIZE);
+      if (CURRENT_PROC->mmaped_len >= range->length)
+        CURRENT_PROC->mmaped_len -= range->length;
+      return range;
     }
   }
-  return 1;
+  return NULL;
+}
+
+int64_t syscall_munmap(void *addr, size_t length) {
+  LOCK(CURRENT_PROC->lock);
+  mmap_range_t *range = syscall_do_munmap(addr, length);
+  UNLOCK(CURRENT_PROC->lock);
+
+  if (!range)
+    return 1;
+  vmm_free_range(range);
+  return 0;
 }
 
-int syscall_stat(char *path, stat_t *stat) {
+int64_t syscall_stat(char *path, stat_t *stat) {
   fs_file_t *file = vfs_open(path);
   if (!file)
     return -ENOENT;
-  if (vfs_check_can_read(file, CURRENT_THREAD->uid, CURRENT_THREAD->gid))
+  if (vfs_check_can_read(file, CURRENT_THREAD->uid, CURRENT_THREAD->gid)) {
+    vfs_close(file);
     return -EACCES;
+  }
   vfs_fstat(file, stat);
   vfs_close(file);
   return 0;
 }
 
-int syscall_fstat(size_t id, stat_t *stat) {
-  syscall_file_t *file = CURRENT_PROC->fds[id];
+int64_t syscall_fstat(size_t id, stat_t *stat) {
+  syscall_file_t *file = sched_fd_get(CURRENT_PROC, id);
   if (!file)
     return -EBADF;
-  if (vfs_check_can_read(file->file, CURRENT_THREAD->uid, CURRENT_THREAD->gid))
-    return -EACCES;
-  vfs_fstat(file->file, stat);
-  return 0;
+
+  int ret = -EACCES;
+  if (!vfs_check_can_read(file->file, CURRENT_THREAD->uid,
+                          CURRENT_THREAD->gid))
+    ret = vfs_fstat(file->file, stat);
+
+  sched_fd_put(file);
+  return ret;
 }
 
 size_t syscall_getpid() { return CURRENT_PROC->pid; }
@@ -290,8 +433,54 @@ size_t syscall_getppid() {
   return (CURRENT_PROC->parent) ? CURRENT_PROC->parent->pid : (size_t)-1;
 }
 
-void syscall_exit(int code) { sched_exit(code); }
+int64_t syscall_exit(int code) {
+  sched_exit(code);
+  return 0;
+}
+
+// For syscall_entry, in place of returning to a non canonical rip
+void syscall_bad_rip() { sched_exit(128 + SIGSEGV); }
+
+// For the vDSO's getcpu when RDTSCP doesn't work. The thread can be on
+// another CPU by the time it looks.
+int64_t syscall_getcpu(uint32_t *cpu, uint32_t *node) {
+  if (cpu)
+    *cpu = get_locals()->cpu_number;
+  if (node)
+    *node = 0;
+  return 0;
+}
+
+int64_t syscall_thread_create(uintptr_t entry, uintptr_t arg, uintptr_t stack,
+                              uintptr_t tls, uintptr_t exit_word) {
+  return sched_thread_create(entry, arg, stack, tls, exit_word);
+}
 
+int64_t syscall_thread_exit() {
+  sched_thread_exit();
+  return 0;
+}
+
+int64_t syscall_sched_yield() {
+  sched_yield();
+  return 0;
+}
+
+int64_t syscall_set_fs_base(uintptr_t base) {
+  // wrmsr faults on a non canonical address
+  if (base >= 0x800000000000)
+    return -EINVAL;
+
+  asm volatile("cli");
+  CURRENT_THREAD->fs_base = base;
+  wrmsr(MSR_FS_BASE, base);
+  asm volatile("sti");
+
+  return 0;
+}
+
+// regs is the frame the system call came in with, c_syscall_handler passes
+// it straight here instead of through the table
 size_t syscall_fork(registers_t *regs) {
   vmm_load_pagemap(&kernel_pagemap);
   size_t ret = sched_fork(regs);
@@ -299,30 +488,102 @@ size_t syscall_fork(registers_t *regs) {
   return ret;
 }
 
-void syscall_gettimeofday(posix_time_t *time) {
-  *time = rtc_mktime(rtc_get_datetime());
+int64_t syscall_gettimeofday(posix_time_t *time) {
+  *time = vdso_clock(CLOCK_REALTIME);
+  return 0;
 }
 
-int syscall_fsync(size_t id) {
-  syscall_file_t *file = CURRENT_PROC->fds[id];
-  if (!file)
-    return -EBADF;
-  if (ISFIFO(file->file))
+// Mostly called by the vDSO for clocks it doesn't know, the ones it knows
+// come out the same here
+int64_t syscall_clock_gettime(int clock, posix_time_t *time) {
+  if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC)
     return -EINVAL;
+
+  *time = vdso_clock(clock);
   return 0;
 }
 
-uint64_t syscall_ioctl(size_t fd, uint64_t cmd, void *arg) {
-  syscall_file_t *file = CURRENT_PROC->fds[fd];
+int64_t syscall_clock_nanosleep(int clock, int flags, posix_time_t *request,
+                                posix_time_t *remain) {
+  if (clock != CLOCK_REALTIME && clock != CLOCK_MONOTONIC)
+    return -EINVAL;
+  if (request->nanoseconds >= 1000000000)
+    return -EINVAL;
+
+  // Anything past a few hundred thousand years is as good as forever
+  uint64_t length = (request->seconds < UINT32_MAX)
+                      ? request->seconds * 1000000 +
+                          (request->nanoseconds + 999) / 1000
+                      : UINT64_MAX / 2;
+  uint64_t now = sched_time();
+  uint64_t deadline = now + length;
+
+  // The target is on the clock clock_gettime reads, not sched_time()'s
+  if (flags & TIMER_ABSTIME) {
+    posix_time_t clock_now = vdso_clock(clock);
+    uint64_t target_now =
+      clock_now.seconds * 1000000 + clock_now.nanoseconds / 1000;
+    deadline = (length > target_now) ? now + (length - target_now) : now;
+  }
+
+  sched_sleep(deadline);
+
+  // Nothing can cut a sleep short yet
+  if (remain && !(flags & TIMER_ABSTIME))
+    *remain = (posix_time_t){0};
+
+  return 0;
+}
+
+int64_t syscall_nanosleep(posix_time_t *request, posix_time_t *remain) {
+  return syscall_clock_nanosleep(CLOCK_MONOTONIC, 0, request, remain);
+}
+
+// FUTEX_WAIT takes a relative timeout, NULL for none
+int64_t syscall_futex(uint32_t *word, int op, uint32_t value,
+                      posix_time_t *timeout) {
+  switch (op) {
+    case FUTEX_WAIT: {
+      uint64_t deadline = 0;
+      if (timeout) {
+        if (timeout->nanoseconds >= 1000000000)
+          return -EINVAL;
+        deadline = sched_time() + ((timeout->seconds < UINT32_MAX)
+                                     ? timeout->seconds * 1000000 +
+                                         (timeout->nanoseconds + 999) / 1000
+                                     : UINT64_MAX / 2);
+      }
+      return futex_wait(CURRENT_PAGEMAP, word, value, deadline);
+    }
+    case FUTEX_WAKE:
+      return futex_wake(CURRENT_PAGEMAP, word, 1);
+    case FUTEX_WAKE_N:
+      return futex_wake(CURRENT_PAGEMAP, word, value);
+  }
+
+  return -EINVAL;
+}
+
+int64_t syscall_fsync(size_t id) {
+  syscall_file_t *file = sched_fd_get(CURRENT_PROC, id);
   if (!file)
     return -EBADF;
-  return vfs_ioctl(file->file, cmd, arg);
+  int ret = ISFIFO(file->file) ? -EINVAL : 0;
+  sched_fd_put(file);
+  return ret;
 }
 
-size_t syscall_seek(size_t fd, ssize_t offset, int type) {
-  syscall_file_t *file = CURRENT_PROC->fds[fd];
+uint64_t syscall_ioctl(size_t fd, uint64_t cmd, void *arg) {
+  syscall_file_t *file = sched_fd_get(CURRENT_PROC, fd);
   if (!file)
     return -EBADF;
+  uint64_t ret = vfs_ioctl(file->file, cmd, arg);
+  sched_fd_put(file);
+  return ret;
+}
+
+static size_t syscall_do_seek(syscall_file_t *file, ssize_t offset,
+                              int type) {
   if (ISFIFO(file->file))
     return -ESPIPE;
 
@@ -345,11 +606,20 @@ size_t syscall_seek(size_t fd, ssize_t offset, int type) {
   return -EINVAL;
 }
 
-int syscall_waitpid(ssize_t pid, int *status, int options) {
+size_t syscall_seek(size_t fd, ssize_t offset, int type) {
+  syscall_file_t *file = sched_fd_get(CURRENT_PROC, fd);
+  if (!file)
+    return -EBADF;
+  size_t ret = syscall_do_seek(file, offset, type);
+  sched_fd_put(file);
+  return ret;
+}
+
+int64_t syscall_waitpid(ssize_t pid, int *status, int options) {
   return sched_waitpid(pid, status, options);
 }
 
-int syscall_access(char *path, int mode) {
+int64_t syscall_access(char *path, int mode) {
   fs_file_t *file = vfs_open(path);
 
   if (!file)
@@ -373,7 +643,7 @@ int syscall_access(char *path, int mode) {
   return 0;
 }
 
-int syscall_pipe(int pipefd[2]) {
+int64_t syscall_pipe(int pipefd[2]) {
   fs_file_t *file = vfs_mkfifo("unamed_fifo", 0777, CURRENT_THREAD->uid,
                                CURRENT_THREAD->gid, 0);
   if (!file)
@@ -393,61 +663,56 @@ int syscall_pipe(int pipefd[2]) {
 
   file->offset = 0;
 
-  size_t i;
-  for (i = 0; i < FDS_COUNT; i++)
-    if (!CURRENT_PROC->fds[i]) {
-      CURRENT_PROC->fds[i] = sfile_r;
-      break;
-    }
-  if (i == FDS_COUNT) {
+  int fd = sched_fd_install(CURRENT_PROC, sfile_r, 0);
+  if (fd < 0) {
     vfs_close(file);
     kfree(sfile_r);
     kfree(sfile_w);
-    return -EMFILE;
+    return fd;
   }
-  pipefd[0] = i;
+  pipefd[0] = fd;
 
-  for (i = 0; i < FDS_COUNT; i++)
-    if (!CURRENT_PROC->fds[i]) {
-      CURRENT_PROC->fds[i] = sfile_w;
-      break;
-    }
-  if (i == FDS_COUNT) {
-    vfs_close(file);
-    kfree(sfile_r);
+  fd = sched_fd_install(CURRENT_PROC, sfile_w, 0);
+  if (fd < 0) {
+    // The read end is in the table now, closing it closes the pipe
+    sched_fd_close(CURRENT_PROC, pipefd[0]);
     kfree(sfile_w);
     pipefd[0] = 0;
-    return -EMFILE;
+    return fd;
   }
-  pipefd[1] = i;
+  pipefd[1] = fd;
 
   return 0;
 }
 
-int syscall_fcntl(int fd, int cmd, int arg) {
-  syscall_file_t *file = CURRENT_PROC->fds[fd];
+int64_t syscall_fcntl(int fd, int cmd, int arg) {
+  syscall_file_t *file = sched_fd_get(CURRENT_PROC, fd);
   if (!file)
     return -EBADF;
 
+  int ret = -EINVAL;
   switch (cmd) {
     case F_DUPFD:;
+      if (arg < 0)
+        break;
+
       syscall_file_t *new_file = kmalloc(sizeof(syscall_file_t));
       *new_file = *file;
       file->file->ref_count++;
 
-      size_t i;
-      for (i = arg; i < FDS_COUNT; i++)
-        if (!CURRENT_PROC->fds[i]) {
-          CURRENT_PROC->fds[i] = new_file;
-          break;
-        }
-      return i;
+      ret = sched_fd_install(CURRENT_PROC, new_file, arg);
+      if (ret < 0) {
+        vfs_close(file->file);
+        kfree(new_file);
+      }
+      break;
   }
 
-  return -EINVAL;
+  sched_fd_put(file);
+  return ret;
 }
 
-int syscall_remove(char *path) {
+int64_t syscall_remove(char *path) {
   fs_file_t *file = vfs_open(path);
   if (!file)
     return -ENOENT;
@@ -461,91 +726,41 @@ int syscall_remove(char *path) {
     return vfs_delete(file);
 }
 
+int64_t syscall_io_ring_setup(io_ring_params_t *params) {
+  io_ring_params_t copy = *params;
+  int ret = io_ring_setup(&copy);
+  if (ret >= 0)
+    *params = copy;
+  return ret;
+}
+
+int64_t syscall_io_ring_enter(size_t fd, uint32_t to_submit,
+                              uint32_t min_complete, uint32_t flags) {
+  return io_ring_enter(fd, to_submit, min_complete, flags);
+}
+
+// Every handler takes its arguments in the registers the table call passes
+// them in and returns something that fits rax, so they can all be called
+// the same way. Going through void (*)(void) keeps GCC quiet about it.
+typedef uint64_t (*syscall_handler_t)(uint64_t, uint64_t, uint64_t, uint64_t,
+                                      uint64_t, uint64_t);
+
+#define SYSCALL_ENTRY(NUMBER, CONSTANT, NAME, ARGUMENTS)                       \
+  [NUMBER] = (syscall_handler_t)(void (*)(void))syscall_##NAME,
+
+static const syscall_handler_t syscall_table[SYSCALL_COUNT] = {
+  SYSCALL_LIST(SYSCALL_ENTRY)};
+
 uint64_t c_syscall_handler(uint64_t rsp) {
   registers_t *registers = (registers_t *)rsp;
 
-  uint64_t ret = registers->rax;
+  uint64_t number = registers->rax;
+  if (number >= SYSCALL_COUNT || !syscall_table[number])
+    return -ENOSYS;
 
-  switch (registers->rdi) {
-    case SYSCALL_OPEN:
-      ret = syscall_open((char *)registers->rsi, (int)registers->rdx,
-                         (int)registers->rcx);
-      break;
-    case SYSCALL_CLOSE:
-      ret = syscall_close((size_t)registers->rsi);
-      break;
-    case SYSCALL_READ:
-      ret =
-        syscall_read(registers->rsi, (uint8_t *)registers->rdx, registers->rcx);
-      break;
-    case SYSCALL_WRITE:
-      ret = syscall_write(registers->rsi, (uint8_t *)registers->rdx,
-                          registers->rcx);
-      break;
-    case SYSCALL_EXEC:
-      ret = syscall_execve((char *)registers->rsi, (char **)registers->rdx,
-                           (char **)registers->rcx);
-      break;
-    case SYSCALL_MMAP:
-      ret = (uint64_t)syscall_mmap((mmap_args_t *)registers->rsi);
-      break;
-    case SYSCALL_MUNMAP:
-      ret = (uint64_t)syscall_munmap((void *)registers->rsi,
-                                     (size_t)registers->rdx);
-      break;
-    case SYSCALL_STAT:
-      ret = syscall_stat((char *)registers->rsi, (stat_t *)registers->rdx);
-      break;
-    case SYSCALL_FSTAT:
-      ret = syscall_fstat((size_t)registers->rsi, (stat_t *)registers->rdx);
-      break;
-    case SYSCALL_GETPID:
-      ret = syscall_getpid();
-      break;
-    case SYSCALL_GETPPID:
-      ret = syscall_getppid();
-      break;
-    case SYSCALL_EXIT:
-      syscall_exit((int)registers->rsi);
-      break;
-    case SYSCALL_FORK:
-      ret = syscall_fork(registers);
-      break;
-    case SYSCALL_GETTIMEOFDAY:
-      syscall_gettimeofday((posix_time_t *)registers->rsi);
-      break;
-    case SYSCALL_FSYNC:
-      syscall_fsync((size_t)registers->rsi);
-      break;
-    case SYSCALL_IOCTL:
-      ret = syscall_ioctl((size_t)registers->rsi, registers->rdx,
-                          (void *)registers->rcx);
-      break;
-    case SYSCALL_SEEK:
-      ret =
-        syscall_seek((size_t)registers->rsi, registers->rdx, registers->rcx);
-      break;
-    case SYSCALL_WAITPID:
-      ret = syscall_waitpid((ssize_t)registers->rsi, (int *)registers->rdx,
-                            registers->rcx);
-      break;
-    case SYSCALL_ACCESS:
-      ret = syscall_access((char *)registers->rsi, registers->rdx);
-      break;
-    case SYSCALL_PIPE:
-      ret = syscall_pipe((int *)registers->rsi);
-      break;
-    case SYSCALL_FCNTL:
-      ret = syscall_fcntl((int)registers->rsi, (int)registers->rdx,
-                          (int)registers->rcx);
-      break;
-    case SYSCALL_REMOVE:
-      ret = syscall_remove((char *)registers->rsi);
-      break;
-    default:
-      ret = -1;
-      break;
-  }
+  if (number == SYSCALL_FORK)
+    return syscall_fork(registers);
 
-  return ret;
+  return syscall_table[number](registers->rdi, registers->rsi, registers->rdx,
+                               registers->r10, registers->r8, registers->r9);
 }
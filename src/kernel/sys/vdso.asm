@@ -0,0 +1,97 @@
+global vdso_start
+global vdso_end
+
+; Same as sys/vdso_layout.h
+VDSO_CODE equ 0x80000000000
+VDSO_DATA equ 0x80000001000
+VDSO_PROC equ 0x80000002000
+VDSO_MAGIC equ 0x4f53445674646e4d
+
+; Offsets into vdso_data_t
+VDSO_DATA_TSC_BASE equ 0
+VDSO_DATA_TSC_MULT equ 8
+VDSO_DATA_MONOTONIC_BASE equ 16
+VDSO_DATA_REALTIME_OFFSET equ 24
+VDSO_DATA_RDTSCP equ 32
+
+; SYSCALL_* equs, the Makefile generates it from sys/syscall_list.h
+%include "syscall_list.inc"
+
+CLOCK_MONOTONIC equ 1
+
+; Never runs here. init_vdso copies it to VDSO_CODE, where it runs in user
+; mode. Jumps within it are relative, anything else has to be an absolute
+; address. Whatever it can't do itself goes to the system call.
+
+vdso_start:
+  dq VDSO_MAGIC
+  dq VDSO_CODE + (vdso_clock_gettime - vdso_start)
+  dq VDSO_CODE + (vdso_getpid - vdso_start)
+  dq VDSO_CODE + (vdso_getcpu - vdso_start)
+
+; rdi: clock, rsi: timespec to fill
+vdso_clock_gettime:
+  cmp edi, CLOCK_MONOTONIC
+  ja .syscall
+  mov r8, VDSO_DATA
+
+  ; RDTSC would otherwise be free to run ahead of earlier loads
+  lfence
+  rdtsc
+  shl rdx, 32
+  or rax, rdx
+  sub rax, [r8 + VDSO_DATA_TSC_BASE]
+  mul qword [r8 + VDSO_DATA_TSC_MULT]
+  shrd rax, rdx, 32
+  add rax, [r8 + VDSO_DATA_MONOTONIC_BASE]
+
+  ; CLOCK_REALTIME is 0
+  test edi, edi
+  jnz .split
+  add rax, [r8 + VDSO_DATA_REALTIME_OFFSET]
+
+.split:
+  xor edx, edx
+  mov rcx, 1000000000
+  div rcx
+  mov [rsi], rax
+  mov [rsi + 8], rdx
+  xor eax, eax
+  ret
+
+.syscall:
+  mov eax, SYSCALL_CLOCK_GETTIME
+  syscall
+  ret
+
+vdso_getpid:
+  mov rax, VDSO_PROC
+  mov rax, [rax]
+  ret
+
+; rdi: cpu, rsi: node, either can be NULL. There's only ever node 0.
+vdso_getcpu:
+  mov r8, VDSO_DATA
+  cmp dword [r8 + VDSO_DATA_RDTSCP], 0
+  je .syscall
+
+  rdtscp
+  test rdi, rdi
+  jz .node
+  mov [rdi], ecx
+
+.node:
+  test rsi, rsi
+  jz .done
+  mov dword [rsi], 0
+
+.done:
+  xor eax, eax
+  ret
+
+.syscall:
+  mov eax, SYSCALL_GETCPU
+  syscall
+  ret
+
+vdso_end:
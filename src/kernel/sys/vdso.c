@@ -0,0 +1,119 @@
+#include <asm.h>
+#include <cpu_locals.h>
+#include <cpuid.h>
+#include <drivers/rtc.h>
+#include <mm/pmm.h>
+#include <mm/vmm.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/vdso.h>
+
+// The code is vdso.asm's, copied into a page of its own at boot. That page
+// and the time data are shared by every process, the VDSO_PROC page is one
+// per pagemap. None of them are in the pagemap's ranges, so fork and munmap
+// leave them alone and vmm_create_new_pagemap maps them afresh.
+
+// CPUID 0x80000001 EDX
+#define CPUID_NX (1 << 20)
+#define CPUID_RDTSCP (1 << 27)
+
+extern uint8_t vdso_start[];
+extern uint8_t vdso_end[];
+
+static uintptr_t vdso_code = 0; // Physical, like vdso_data
+static uintptr_t vdso_data = 0;
+
+static int vdso_has_feature(uint32_t feature) {
+  uint32_t eax, ebx, ecx, edx;
+
+  if (__get_cpuid_max(0x80000000, NULL) < 0x80000001)
+    return 0;
+
+  __cpuid(0x80000001, eax, ebx, ecx, edx);
+  return !!(edx & feature);
+}
+
+// So RDTSCP hands the vDSO's getcpu the CPU it ran on, and so the data
+// pages can be mapped no-execute
+void vdso_init_cpu(cpu_locals_t *locals) {
+  if (vdso_has_feature(CPUID_RDTSCP))
+    wrmsr(MSR_TSC_AUX, locals->cpu_number);
+  if (vdso_has_feature(CPUID_NX))
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+}
+
+// Needs the RTC and this CPU's TSC frequency. CLOCK_MONOTONIC starts out
+// where sched_time() is, CLOCK_REALTIME where the RTC is, and both go by
+// the TSC from there.
+int init_vdso() {
+  size_t size = vdso_end - vdso_start;
+  if (size > PAGE_SIZE)
+    return 1;
+
+  vdso_code = (uintptr_t)pcalloc(1);
+  vdso_data = (uintptr_t)pcalloc(1);
+  if (!vdso_code || !vdso_data)
+    return 1;
+
+  memcpy((void *)(vdso_code + PHYS_MEM_OFFSET), vdso_start, size);
+
+  uint64_t tsc_freq = get_locals()->tsc_freq;
+  posix_time_t real = rtc_mktime(rtc_get_datetime());
+  uint64_t tsc = rdtsc();
+  uint64_t monotonic = tsc / (tsc_freq / 1000000) * 1000;
+
+  *(vdso_data_t *)(vdso_data + PHYS_MEM_OFFSET) = (vdso_data_t){
+    .tsc_base = tsc,
+    .tsc_mult = (1000000000ull << 32) / tsc_freq,
+    .monotonic_base = monotonic,
+    .realtime_offset = real.seconds * 1000000000 - monotonic,
+    .rdtscp = vdso_has_feature(CPUID_RDTSCP),
+  };
+
+  return 0;
+}
+
+void vdso_map(pagemap_t *pagemap) {
+  uint64_t data_flags = 0b101 | (vdso_has_feature(CPUID_NX) ? VMM_PTE_NX : 0);
+
+  pagemap->vdso_proc = (uintptr_t)pcalloc(1);
+
+  vmm_map_page(pagemap, vdso_code, VDSO_CODE, 0b101);
+  vmm_map_page(pagemap, vdso_data, VDSO_DATA, data_flags);
+  vmm_map_page(pagemap, pagemap->vdso_proc, VDSO_PROC, data_flags);
+}
+
+void vdso_unmap(pagemap_t *pagemap) {
+  vmm_unmap_page(pagemap, VDSO_CODE);
+  vmm_unmap_page(pagemap, VDSO_DATA);
+  vmm_unmap_page(pagemap, VDSO_PROC);
+
+  pmm_free_pages((void *)pagemap->vdso_proc, 1);
+  pagemap->vdso_proc = 0;
+}
+
+// The kernel pagemap has no vDSO
+void vdso_set_pid(pagemap_t *pagemap, size_t pid) {
+  if (!pagemap->vdso_proc)
+    return;
+
+  ((vdso_proc_t *)(pagemap->vdso_proc + PHYS_MEM_OFFSET))->pid = pid;
+}
+
+// The same clocks the vDSO reads, for the system calls
+posix_time_t vdso_clock(int clock) {
+  vdso_data_t *data = (vdso_data_t *)(vdso_data + PHYS_MEM_OFFSET);
+
+  uint64_t cycles = rdtsc() - data->tsc_base;
+  uint64_t ns = data->monotonic_base +
+                (uint64_t)(((unsigned __int128)cycles * data->tsc_mult) >> 32);
+  if (clock == CLOCK_REALTIME)
+    ns += data->realtime_offset;
+
+  return (posix_time_t){
+    .seconds = ns / 1000000000,
+    .nanoseconds = ns % 1000000000,
+  };
+}
@@ -0,0 +1,147 @@
+#include <cpu_locals.h>
+#include <errno.h>
+#include <lock.h>
+#include <mm/pmm.h>
+#include <mm/vmm.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tasking/futex.h>
+#include <tasking/scheduler.h>
+
+// Waiters are keyed by the physical address of the word, so every mapping
+// of a page meets in the same place. Keys hash to one of FUTEX_BUCKETS
+// buckets, each a list of waiters in the order they arrived. Userspace only
+// gets here once a lock is contended.
+
+#define FUTEX_BUCKET_BITS 8
+#define FUTEX_BUCKETS (1 << FUTEX_BUCKET_BITS)
+
+// Lives on the waiting thread's stack
+typedef struct futex_waiter {
+  thread_t *thread;
+  uintptr_t key;
+  int woken;
+  struct futex_waiter *next;
+  struct futex_waiter *prev;
+} futex_waiter_t;
+
+// Waking takes a run queue lock, and those are taken from the timer
+// interrupt, so interrupts stay off while a bucket is locked
+typedef struct futex_bucket {
+  lock_t lock;
+  futex_waiter_t *head;
+  futex_waiter_t *tail;
+} futex_bucket_t;
+
+static futex_bucket_t futex_buckets[FUTEX_BUCKETS] = {0};
+
+// Words are 4 byte aligned and neighbours shouldn't share a bucket, so
+// the low bits are dropped before a multiplicative hash
+static inline futex_bucket_t *futex_bucket(uintptr_t key) {
+  return &futex_buckets[((key >> 2) * 0x9e3779b97f4a7c15) >>
+                        (64 - FUTEX_BUCKET_BITS)];
+}
+
+// 0 if the word isn't aligned or mapped
+static uintptr_t futex_key(pagemap_t *pagemap, uint32_t *word) {
+  uintptr_t addr = (uintptr_t)word;
+  if (addr % sizeof(uint32_t) || addr >= 0x800000000000)
+    return 0;
+
+  uintptr_t phys = vmm_virt_to_phys(pagemap, addr);
+  if (!phys)
+    return 0;
+
+  return phys + addr % PAGE_SIZE;
+}
+
+static void futex_link(futex_bucket_t *bucket, futex_waiter_t *waiter) {
+  waiter->next = NULL;
+  waiter->prev = bucket->tail;
+  if (bucket->tail)
+    bucket->tail->next = waiter;
+  else
+    bucket->head = waiter;
+  bucket->tail = waiter;
+}
+
+static void futex_unlink(futex_bucket_t *bucket, futex_waiter_t *waiter) {
+  if (waiter->prev)
+    waiter->prev->next = waiter->next;
+  else
+    bucket->head = waiter->next;
+
+  if (waiter->next)
+    waiter->next->prev = waiter->prev;
+  else
+    bucket->tail = waiter->prev;
+}
+
+// Sleeps while *word holds value, until futex_wake or the sched_time()
+// deadline (0 for none). The word is read under the bucket lock, so a
+// wake that follows a change to it can't be missed.
+int futex_wait(pagemap_t *pagemap, uint32_t *word, uint32_t value,
+               uint64_t deadline) {
+  uintptr_t key = futex_key(pagemap, word);
+  if (!key)
+    return -EFAULT;
+
+  thread_t *thread = get_locals()->current_thread;
+  futex_bucket_t *bucket = futex_bucket(key);
+  futex_waiter_t waiter = {.thread = thread, .key = key};
+
+  uint64_t rflags = spin_lock_irqsave(&bucket->lock);
+
+  if (__atomic_load_n(word, __ATOMIC_SEQ_CST) != value) {
+    spin_unlock_irqrestore(&bucket->lock, rflags);
+    return -EAGAIN;
+  }
+
+  futex_link(bucket, &waiter);
+  sched_block(thread, deadline);
+
+  UNLOCK(bucket->lock);
+
+  sched_wait(thread);
+
+  LOCK(bucket->lock);
+  if (!waiter.woken)
+    futex_unlink(bucket, &waiter);
+  spin_unlock_irqrestore(&bucket->lock, rflags);
+
+  if (waiter.woken)
+    return 0;
+  return thread->parent->exited ? -EINTR : -ETIMEDOUT;
+}
+
+// Wakes up to count threads waiting on word, oldest first. Returns how
+// many were woken.
+int futex_wake(pagemap_t *pagemap, uint32_t *word, size_t count) {
+  uintptr_t key = futex_key(pagemap, word);
+  if (!key)
+    return -EFAULT;
+
+  futex_bucket_t *bucket = futex_bucket(key);
+  int woken = 0;
+
+  uint64_t rflags = spin_lock_irqsave(&bucket->lock);
+
+  futex_waiter_t *next;
+  for (futex_waiter_t *waiter = bucket->head; waiter && (size_t)woken < count;
+       waiter = next) {
+    next = waiter->next;
+    if (waiter->key != key)
+      continue;
+
+    // A waiter whose timeout fired first still counts, it finds woken set
+    // and returns 0. Either way it can't leave before the bucket unlocks.
+    futex_unlink(bucket, waiter);
+    waiter->woken = 1;
+    sched_wake(waiter->thread, 0);
+    woken++;
+  }
+
+  spin_unlock_irqrestore(&bucket->lock, rflags);
+
+  return woken;
+}
@@ -1,4 +1,6 @@
+#include <asm.h>
 #include <cpu_locals.h>
+#include <cpuid.h>
 #include <dev/device.h>
 #include <drivers/apic.h>
 #include <elf.h>
@@ -9,56 +11,429 @@
 #include <mm/kheap.h>
 #include <mm/pmm.h>
 #include <mm/vmm.h>
+#include <rcu.h>
 #include <registers.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/fpu.h>
 #include <sys/gdt.h>
+#include <sys/io_ring.h>
 #include <sys/syscall.h>
+#include <sys/vdso.h>
+#include <tasking/futex.h>
 #include <tasking/scheduler.h>
+#include <tasking/smp.h>
 #include <vec.h>
 
-#define DEFAULT_WAIT_TIMESLICE 20000
 #define DEFAULT_TIMESLICE 5000
 
+// Among kernel threads, priority 0 runs most often. A thread is queued at
+// its dynamic_priority, which moves between its priority and
+// SCHED_MAX_DECAY levels below it:
+// - using up a whole timeslice without blocking decays it by one level
+// - waking up after blocking boosts it straight back to its priority
+// So threads that mostly wait stay ahead of ones that mostly compute.
+#define SCHED_MAX_DECAY 3
+
+// Fair threads get CPU time in proportion to a weight, which drops by about
+// a fifth with every priority level. vruntime grows by the nanoseconds a
+// thread ran times 1024 / weight, and the one furthest behind runs next.
+static const uint32_t sched_weights[PRIORITY_LEVELS] = {
+  1024, 820, 655, 526, 423, 335, 272, 215, 172, 137,
+  110,  87,  70,  56,  45,  36,  29,  23,  18,  15,
+};
+
+// A woken fair thread only preempts one that's at least this far ahead of
+// it (in nanoseconds of vruntime), so threads passing work back and forth
+// don't switch on every wakeup
+#define SCHED_WAKEUP_GRANULARITY 1000000
+
+// How far behind min_vruntime a thread that slept can come back, so it
+// runs soon without then owning the CPU for as long as it slept
+#define SCHED_WAKEUP_CREDIT 2500000
+#define WAITPID_LOCAL_EVENTS 16
+
+// How often (in timer ticks) a CPU with work of its own looks for a more
+// loaded CPU to take from. CPUs look every time they run out of work.
+#define SCHED_BALANCE_TICKS 20
+
+// Longest the LAPIC timer is ever armed for, in microseconds. Keeps its
+// 32 bit initial count from overflowing while waiting on a far off timer.
+#define SCHED_MAX_TIMER 1000000
+
 #define SCHED_STACK_TOP 0x70000000000
 #define SCHED_MMAP_TOP 0x90000000000
 #define SCHED_STACK_SIZE PAGE_SIZE * 0x40
 
-extern void switch_and_run_stack(uintptr_t stack);
+extern void switch_and_run_stack(uintptr_t stack, lock_t *unlock);
 
 proc_t *kernel_proc = NULL;
 
+// Taken with __atomic_fetch_add, threads of one process fork and create
+// threads on several CPUs at once
 static size_t current_pid = 0;
 static size_t current_tid = 0;
 
 static int sched_has_started = 0;
+static int sched_mwait = 0;
 
-static lock_t sched_lock = {0};
+static ticket_lock_t sched_lock = TICKET_LOCK_INIT("sched_lock");
 
-static vec_t(thread_t *) threads[PRIORITY_LEVELS];
+// Every thread that hasn't been reaped, for /dev/schedstat. Guarded by
+// sched_lock.
+static vec_t(thread_t *) sched_threads = {0};
 
+// Where each CPU enters the scheduler. The boot stack is left behind for
+// the first thread, or the idle thread if there's nothing to run yet.
 void sched_await() {
-  while (!sched_has_started)
-    ;
+  while (!LOCKED_READ(sched_has_started))
+    asm volatile("pause");
 
   asm volatile("cli");
+  sched_yield();
+}
+
+void sched_init_run_queue(run_queue_t *run_queue) {
+  *run_queue = (run_queue_t){0};
+}
+
+static void sched_list_push(run_queue_t *run_queue, thread_t *thread) {
+  run_list_t *list = &run_queue->runnable[thread->dynamic_priority];
+
+  thread->run_next = NULL;
+  thread->run_prev = list->tail;
+  if (list->tail)
+    list->tail->run_next = thread;
+  else
+    list->head = thread;
+  list->tail = thread;
+
+  run_queue->ready |= 1u << thread->dynamic_priority;
+}
+
+static void sched_list_remove(run_queue_t *run_queue, thread_t *thread) {
+  run_list_t *list = &run_queue->runnable[thread->dynamic_priority];
+
+  if (thread->run_prev)
+    thread->run_prev->run_next = thread->run_next;
+  else
+    list->head = thread->run_next;
+  if (thread->run_next)
+    thread->run_next->run_prev = thread->run_prev;
+  else
+    list->tail = thread->run_prev;
+  thread->run_next = thread->run_prev = NULL;
+
+  if (!list->head)
+    run_queue->ready &= ~(1u << thread->dynamic_priority);
+}
+
+// Fair threads sit in a pairing heap ordered by vruntime, linked through
+// the threads themselves so queueing never allocates. fair_prev is the
+// parent for a first child and the previous sibling for the rest.
+static inline int sched_fair_before(thread_t *a, thread_t *b) {
+  return (int64_t)(a->vruntime - b->vruntime) < 0;
+}
+
+static thread_t *sched_fair_meld(thread_t *a, thread_t *b) {
+  if (!a)
+    return b;
+  if (!b)
+    return a;
+
+  if (sched_fair_before(b, a)) {
+    thread_t *tmp = a;
+    a = b;
+    b = tmp;
+  }
+
+  b->fair_prev = a;
+  b->fair_sibling = a->fair_child;
+  if (a->fair_child)
+    a->fair_child->fair_prev = b;
+  a->fair_child = b;
+
+  return a;
+}
+
+// Melds a list of siblings into one heap, pairwise left to right and then
+// the pairs right to left
+static thread_t *sched_fair_merge_pairs(thread_t *first) {
+  thread_t *pairs = NULL;
+
+  while (first) {
+    thread_t *a = first;
+    thread_t *b = a->fair_sibling;
+    first = b ? b->fair_sibling : NULL;
+
+    a->fair_sibling = a->fair_prev = NULL;
+    if (b)
+      b->fair_sibling = b->fair_prev = NULL;
+
+    thread_t *pair = sched_fair_meld(a, b);
+    pair->fair_sibling = pairs;
+    pairs = pair;
+  }
+
+  thread_t *root = NULL;
+  while (pairs) {
+    thread_t *next = pairs->fair_sibling;
+    pairs->fair_sibling = NULL;
+    root = sched_fair_meld(root, pairs);
+    pairs = next;
+  }
+
+  return root;
+}
+
+static void sched_fair_push(run_queue_t *run_queue, thread_t *thread) {
+  thread->fair_child = thread->fair_sibling = thread->fair_prev = NULL;
+  run_queue->fair = sched_fair_meld(run_queue->fair, thread);
+}
+
+static void sched_fair_remove(run_queue_t *run_queue, thread_t *thread) {
+  thread_t *children = sched_fair_merge_pairs(thread->fair_child);
+
+  if (thread == run_queue->fair)
+    run_queue->fair = children;
+  else {
+    if (thread->fair_prev->fair_child == thread)
+      thread->fair_prev->fair_child = thread->fair_sibling;
+    else
+      thread->fair_prev->fair_sibling = thread->fair_sibling;
+    if (thread->fair_sibling)
+      thread->fair_sibling->fair_prev = thread->fair_prev;
+    run_queue->fair = sched_fair_meld(run_queue->fair, children);
+  }
+
+  thread->fair_child = thread->fair_sibling = thread->fair_prev = NULL;
+}
 
-  lapic_timer_oneshot(SCHEDULE_REG, DEFAULT_WAIT_TIMESLICE);
+// Keeps min_vruntime moving forward with the fair thread furthest behind
+static inline void sched_fair_update_min(run_queue_t *run_queue) {
+  if (run_queue->fair &&
+      (int64_t)(run_queue->fair->vruntime - run_queue->min_vruntime) > 0)
+    run_queue->min_vruntime = run_queue->fair->vruntime;
+}
+
+static inline void sched_class_push(run_queue_t *run_queue,
+                                    thread_t *thread) {
+  if (thread->policy == SCHED_FAIR)
+    sched_fair_push(run_queue, thread);
+  else
+    sched_list_push(run_queue, thread);
+}
 
-  asm volatile("sti\n"
-               "1:\n"
-               "hlt\n"
-               "jmp 1b\n");
+static inline void sched_class_remove(run_queue_t *run_queue,
+                                      thread_t *thread) {
+  if (thread->policy == SCHED_FAIR)
+    sched_fair_remove(run_queue, thread);
+  else
+    sched_list_remove(run_queue, thread);
 }
 
+// Called with the run queue locked. A fair thread keeps its lag behind
+// min_vruntime from the queue it left, so moving between CPUs or sleeping
+// neither helps nor hurts it, except that a sleeper's credit is capped at
+// SCHED_WAKEUP_CREDIT.
+static void sched_rq_add(run_queue_t *run_queue, thread_t *thread) {
+  if (thread->policy == SCHED_FAIR) {
+    if (thread->vlag < -SCHED_WAKEUP_CREDIT)
+      thread->vlag = -SCHED_WAKEUP_CREDIT;
+    thread->vruntime = run_queue->min_vruntime + thread->vlag;
+  }
+
+  sched_class_push(run_queue, thread);
+  run_queue->length++;
+}
+
+// Called with the run queue locked
+static void sched_rq_remove(run_queue_t *run_queue, thread_t *thread) {
+  sched_class_remove(run_queue, thread);
+  run_queue->length--;
+
+  if (thread->policy == SCHED_FAIR)
+    thread->vlag = thread->vruntime - run_queue->min_vruntime;
+}
+
+// Microseconds since boot, going by the TSC
+uint64_t sched_time() { return rdtsc() / (get_locals()->tsc_freq / 1000000); }
+
+static inline uint64_t sched_tsc_ns(cpu_locals_t *locals, uint64_t cycles) {
+  return cycles * 1000 / (locals->tsc_freq / 1000000);
+}
+
+static inline void sched_stats_log2(uint64_t *histogram, uint64_t us) {
+  size_t bucket = us ? 63 - __builtin_clzll(us) : 0;
+  if (bucket >= SCHED_STATS_BUCKETS)
+    bucket = SCHED_STATS_BUCKETS - 1;
+  histogram[bucket]++;
+}
+
+// Called with the run queue locked, when a woken thread first runs
+static inline void sched_stats_woken(cpu_locals_t *locals, thread_t *thread) {
+  if (!thread->woken_at)
+    return;
+
+  sched_stats_log2(
+    locals->run_queue.stats.wakeup_latency,
+    sched_tsc_ns(locals, locals->run_queue.exec_start - thread->woken_at) /
+      1000);
+  thread->woken_at = 0;
+}
+
+static inline int sched_cpu_idle(cpu_locals_t *locals) {
+  thread_t *current_thread = LOCKED_READ(locals->current_thread);
+  return !current_thread || current_thread == locals->run_queue.idle_thread;
+}
+
+static void sched_queue_push(size_t cpu, thread_t *thread) {
+  cpu_locals_t *target = smp_get_locals(cpu);
+  run_queue_t *run_queue = &target->run_queue;
+
+  uint64_t rflags = spin_lock_irqsave(&run_queue->lock);
+  sched_rq_add(run_queue, thread);
+  thread->cpu = cpu;
+  thread->wait_start = rdtsc();
+
+  // Wakeup preemption: kernel threads always go ahead of fair ones, a fair
+  // thread only of one it's well behind
+  thread_t *running = target->current_thread;
+  int preempt = 0;
+  if (running && running != run_queue->idle_thread &&
+      running->policy == SCHED_FAIR)
+    preempt = thread->policy != SCHED_FAIR ||
+              (int64_t)(running->vruntime - thread->vruntime) >
+                SCHED_WAKEUP_GRANULARITY;
+  spin_unlock_irqrestore(&run_queue->lock, rflags);
+
+  // An idle CPU in MWAIT already woke up from the write to length, one in
+  // HLT needs an interrupt
+  if (preempt ||
+      (!sched_mwait && target != get_locals() && sched_cpu_idle(target)))
+    lapic_send_ipi(target->lapic_id, SCHEDULE_REG);
+}
+
+static void sched_queue_remove(thread_t *thread) {
+  run_queue_t *run_queue = &smp_get_locals(thread->cpu)->run_queue;
+
+  uint64_t rflags = spin_lock_irqsave(&run_queue->lock);
+  sched_rq_remove(run_queue, thread);
+  spin_unlock_irqrestore(&run_queue->lock, rflags);
+}
+
+// New threads start on the least loaded CPU, stealing evens things out from
+// there
 void sched_enqueue(thread_t *thread) {
   if (thread->queued)
     return;
   thread->queued = 1;
-  LOCK(sched_lock);
-  vec_push(&threads[thread->priority], thread);
-  UNLOCK(sched_lock);
+  thread->dynamic_priority = thread->priority;
+  thread->vlag = 0;
+
+  size_t target = 0;
+  for (size_t i = 1; i < smp_cpu_count; i++)
+    if (LOCKED_READ(smp_get_locals(i)->run_queue.length) <
+        LOCKED_READ(smp_get_locals(target)->run_queue.length))
+      target = i;
+
+  sched_queue_push(target, thread);
+}
+
+static void sched_timeout(timer_t *timer) {
+  sched_wake(timer->data, (size_t)-1);
+}
+
+// Reads from pipes and the tty poll until there's something to read.
+// They give up with -EINTR once the process has exited, or once the
+// thread's stop word is set, so exit and io_ring_detach aren't held up.
+int sched_interrupted() {
+  thread_t *thread = get_locals()->current_thread;
+  if (!thread)
+    return 0;
+  return LOCKED_READ(thread->parent->exited) ||
+         (thread->stop_word && LOCKED_READ(*thread->stop_word));
+}
+
+// Takes the running thread off its queue. It keeps running until it calls
+// sched_wait, which only returns once sched_wake or the sched_time()
+// deadline (0 for none) has put it back.
+void sched_block(thread_t *thread, uint64_t deadline) {
+  run_queue_t *run_queue = &smp_get_locals(thread->cpu)->run_queue;
+
+  uint64_t rflags = spin_lock_irqsave(&run_queue->lock);
+
+  LOCKED_WRITE(thread->blocked, 1);
+  if (thread->queued) {
+    sched_rq_remove(run_queue, thread);
+    thread->queued = 0;
+  }
+
+  spin_unlock_irqrestore(&run_queue->lock, rflags);
+
+  if (deadline) {
+    thread->wake_timer.callback = sched_timeout;
+    thread->wake_timer.data = thread;
+    timer_add(&thread->wake_timer, deadline);
+  }
+}
+
+// Puts a blocked thread back on the queue it left, or on an idle CPU if
+// that one has other work. Returns 0 if the thread wasn't blocked, or
+// someone else is already waking it.
+int sched_wake(thread_t *thread, size_t which_event) {
+  // blocked only drops to 0 once the thread is queued again, so it can't
+  // block a second time before we're done here
+  if (!__sync_bool_compare_and_swap(&thread->blocked, 1, 2))
+    return 0;
+
+  thread->which_event = which_event;
+
+  size_t cpu = thread->cpu;
+  if (LOCKED_READ(smp_get_locals(cpu)->run_queue.length))
+    for (size_t i = 0; i < smp_cpu_count; i++)
+      if (sched_cpu_idle(smp_get_locals(i))) {
+        cpu = i;
+        break;
+      }
+
+  thread->queued = 1;
+  thread->dynamic_priority = thread->priority;
+  thread->woken_at = rdtsc();
+  sched_queue_push(cpu, thread);
+  LOCKED_WRITE(thread->blocked, 0);
+
+  return 1;
+}
+
+// Gives up the CPU. A blocked thread won't be back until it is woken.
+void sched_yield() { asm volatile("int %0" : : "i"(SCHEDULE_REG) : "memory"); }
+
+// Called by a thread after sched_block, with interrupts off. Returns once
+// it has been woken, with its timeout no longer pending or running.
+void sched_wait(thread_t *thread) {
+  // sched_exit wakes the threads it finds blocked, one that blocked after
+  // it looked wakes itself. The thread on its way out still waits.
+  if (!thread->exiting && LOCKED_READ(thread->parent->exited))
+    sched_wake(thread, (size_t)-1);
+
+  while (LOCKED_READ(thread->blocked))
+    sched_yield();
+  timer_cancel(&thread->wake_timer);
+}
+
+// Puts the running thread to sleep until the sched_time() deadline
+void sched_sleep(uint64_t deadline) {
+  uint64_t rflags = lock_irq_save();
+
+  if (deadline > sched_time()) {
+    thread_t *thread = get_locals()->current_thread;
+    sched_block(thread, deadline);
+    sched_wait(thread);
+  }
+
+  lock_irq_restore(rflags);
 }
 
 proc_t *sched_new_proc(proc_t *old_proc, pagemap_t *pagemap, int user) {
@@ -78,7 +453,7 @@ proc_t *sched_new_proc(proc_t *old_proc, pagemap_t *pagemap, int user) {
       .parent = NULL,
       .pagemap = pagemap,
       .user = user,
-      .pid = current_pid++,
+      .pid = __atomic_fetch_add(&current_pid, 1, __ATOMIC_RELAXED),
       .status = 0,
       .event = kcalloc(sizeof(event_t)),
     };
@@ -92,7 +467,7 @@ proc_t *sched_new_proc(proc_t *old_proc, pagemap_t *pagemap, int user) {
       .stack_top = old_proc->stack_top,
       .parent = old_proc,
       .user = user,
-      .pid = current_pid++,
+      .pid = __atomic_fetch_add(&current_pid, 1, __ATOMIC_RELAXED),
       .pagemap = vmm_fork_pagemap(old_proc->pagemap),
       .status = 0,
       .event = kcalloc(sizeof(event_t)),
@@ -102,51 +477,78 @@ proc_t *sched_new_proc(proc_t *old_proc, pagemap_t *pagemap, int user) {
     new_proc->threads.data = kcalloc(sizeof(thread_t *));
     memset(new_proc->fds, 0, sizeof(syscall_file_t *) * FDS_COUNT);
 
-    for (size_t i = 0; i < FDS_COUNT; i++)
-      if (old_proc->fds[i]) {
-        syscall_file_t *sfile = kmalloc(sizeof(syscall_file_t));
-        *sfile = *old_proc->fds[i];
-        new_proc->fds[i] = sfile;
-        sfile->file->ref_count++;
-      }
+    for (size_t i = 0; i < FDS_COUNT; i++) {
+      syscall_file_t *old_sfile = sched_fd_get(old_proc, i);
+      if (!old_sfile)
+        continue;
+
+      syscall_file_t *sfile = kmalloc(sizeof(syscall_file_t));
+      *sfile = *old_sfile;
+      sfile->ref_count = 1;
+      sfile->file->ref_count++;
+      new_proc->fds[i] = sfile;
+      sched_fd_put(old_sfile);
+    }
   }
 
+  vdso_set_pid(new_proc->pagemap, new_proc->pid);
+
   return new_proc;
 }
 
 thread_t *sched_new_thread(thread_t *thread, proc_t *parent, uintptr_t addr,
                            int priority, int uid, int gid, int auto_start) {
-  if (!thread)
-    thread = kcalloc(sizeof(thread_t));
+  int reused = thread != NULL;
+
   if (!parent)
     return NULL;
 
-  *thread = (thread_t){
-    .gid = gid,
-    .uid = uid,
-    .parent = parent,
-    .alive = 1,
-    .priority = priority,
-    .tid = current_tid++,
-    .queued = 0,
-    .fpu_storage = {0},
-    .regs =
-      (registers_t){
-        .rip = addr,
-        .cs = (parent->user) ? GDT_SEG_UCODE : GDT_SEG_KCODE,
-        .ss = (parent->user) ? GDT_SEG_UDATA : GDT_SEG_KDATA,
-        .rflags = 0x202,
-        .rax = 0,
-      },
+  registers_t regs = {
+    .rip = addr,
+    .cs = (parent->user) ? GDT_SEG_UCODE : GDT_SEG_KCODE,
+    .ss = (parent->user) ? GDT_SEG_UDATA : GDT_SEG_KDATA,
+    .rflags = 0x202,
+    .rax = 0,
   };
 
-  UNLOCK(thread->lock);
-
-  asm volatile("fxsave %0" : "+m"(thread->fpu_storage) : : "memory");
+  if (!reused) {
+    thread = kcalloc(sizeof(thread_t));
+    *thread = (thread_t){
+      .gid = gid,
+      .uid = uid,
+      .parent = parent,
+      .alive = 1,
+      .policy = (parent->user) ? SCHED_FAIR : SCHED_PRIORITY,
+      .priority = priority,
+      .dynamic_priority = priority,
+      .tid = __atomic_fetch_add(&current_tid, 1, __ATOMIC_RELAXED),
+      .queued = 0,
+      .regs = regs,
+      .fpu_storage = fpu_alloc_state(),
+    };
+  } else {
+    // exec reuses the running thread, which has to stay queued and locked.
+    // Only what belonged to the old image is reset.
+    uint64_t rflags = lock_irq_save();
+    thread->gid = gid;
+    thread->uid = uid;
+    thread->parent = parent;
+    thread->alive = 1;
+    thread->priority = priority;
+    thread->tid = __atomic_fetch_add(&current_tid, 1, __ATOMIC_RELAXED);
+    thread->regs = regs;
+    thread->exit_word = 0;
+    thread->fs_base = 0;
+    wrmsr(MSR_FS_BASE, 0);
+    // The old image's registers are dropped, the next use loads a clean state
+    fpu_init_state(thread->fpu_storage);
+    thread->fpu_loaded = 0;
+    fpu_disable();
+    lock_irq_restore(rflags);
+  }
 
   if (parent->user) {
     uintptr_t user_stack = (uintptr_t)pcalloc(SCHED_STACK_SIZE / PAGE_SIZE);
-    uintptr_t kernel_stack = (uintptr_t)pcalloc(SCHED_STACK_SIZE / PAGE_SIZE);
 
     uintptr_t virt_stack = parent->stack_top;
     parent->stack_top -= SCHED_STACK_SIZE;
@@ -156,13 +558,24 @@ thread_t *sched_new_thread(thread_t *thread, proc_t *parent, uintptr_t addr,
                    PROT_READ | PROT_WRITE | PROT_EXEC);
 
     thread->regs.rsp = virt_stack + SCHED_STACK_SIZE;
-    thread->kernel_stack = kernel_stack + PHYS_MEM_OFFSET + SCHED_STACK_SIZE;
+
+    // exec is running on the kernel stack it has, which stays
+    if (!reused)
+      thread->kernel_stack = (uintptr_t)pcalloc(SCHED_STACK_SIZE / PAGE_SIZE) +
+                             PHYS_MEM_OFFSET + SCHED_STACK_SIZE;
   } else
     thread->regs.rsp = thread->kernel_stack =
       (uintptr_t)pcalloc(SCHED_STACK_SIZE / PAGE_SIZE) + PHYS_MEM_OFFSET +
       SCHED_STACK_SIZE;
 
-  vec_push(&parent->threads, thread);
+  // A reused thread is already on its parent's list
+  if (!reused) {
+    LOCK(sched_lock);
+    vec_push(&parent->threads, thread);
+    vec_push(&sched_threads, thread);
+    parent->live_threads++;
+    UNLOCK(sched_lock);
+  }
 
   if (auto_start)
     sched_enqueue(thread);
@@ -170,50 +583,45 @@ thread_t *sched_new_thread(thread_t *thread, proc_t *parent, uintptr_t addr,
   return thread;
 }
 
-static inline thread_t *sched_get_next_thread(size_t orig_i, int priority,
-                                              size_t *new_index) {
-  size_t index = orig_i + 1;
-
-  while (1) {
-    if (index >= (size_t)threads[priority].length)
-      index = 0;
-
-    thread_t *thread = threads[priority].data[index];
-    if ((thread == get_locals()->current_thread ||
-         LOCK_ACQUIRE(thread->lock))) {
-      *new_index = index;
-      return thread;
-    }
-
-    if (index == orig_i)
-      return NULL;
-
-    index++;
-  }
-}
-
 int sched_fork(registers_t *regs) {
   proc_t *old_proc = get_locals()->current_thread->parent;
   thread_t *old_thread = get_locals()->current_thread;
 
   proc_t *new_proc = sched_new_proc(old_proc, NULL, 1);
   thread_t *new_thread = kcalloc(sizeof(thread_t));
-
-  new_thread->regs = *regs;
+  *new_thread = (thread_t){
+    .gid = old_thread->gid,
+    .uid = old_thread->uid,
+    .parent = new_proc,
+    .alive = 1,
+    .policy = old_thread->policy,
+    .priority = old_thread->priority,
+    .dynamic_priority = old_thread->priority,
+    .tid = __atomic_fetch_add(&current_tid, 1, __ATOMIC_RELAXED),
+    .regs = *regs,
+    // Only the calling thread is copied, its TLS sits at the same address
+    .fs_base = old_thread->fs_base,
+    .kernel_stack = (uintptr_t)pcalloc(SCHED_STACK_SIZE / PAGE_SIZE) +
+                    PHYS_MEM_OFFSET + SCHED_STACK_SIZE,
+  };
   new_thread->regs.rax = 0;
   new_thread->regs.cs = GDT_SEG_UCODE;
   new_thread->regs.ss = GDT_SEG_UDATA;
-  new_thread->parent = new_proc;
-  new_thread->priority = old_thread->priority;
-  new_thread->tid = current_tid++;
 
+  LOCK(sched_lock);
   vec_push(&old_proc->children, new_proc);
   vec_push(&new_proc->threads, new_thread);
+  vec_push(&sched_threads, new_thread);
+  new_proc->live_threads = 1;
+  UNLOCK(sched_lock);
 
-  new_thread->kernel_stack = (uintptr_t)pcalloc(SCHED_STACK_SIZE / PAGE_SIZE) +
-                             PHYS_MEM_OFFSET + SCHED_STACK_SIZE;
-
-  memcpy(new_thread->fpu_storage, old_thread->fpu_storage, 512);
+  // The parent's latest FPU state may only be in the registers
+  uint64_t rflags = lock_irq_save();
+  if (old_thread->fpu_loaded)
+    fpu_save(old_thread->fpu_storage);
+  lock_irq_restore(rflags);
+  new_thread->fpu_storage = fpu_alloc_state();
+  memcpy(new_thread->fpu_storage, old_thread->fpu_storage, fpu_state_size);
   memcpy((void *)new_thread->kernel_stack - SCHED_STACK_SIZE,
          (void *)old_thread->kernel_stack - SCHED_STACK_SIZE, SCHED_STACK_SIZE);
 
@@ -222,159 +630,702 @@ int sched_fork(registers_t *regs) {
   return new_proc->pid;
 }
 
+// Starts a thread in the calling process at entry(arg), on a stack the
+// caller set up and with tls as its FS base
+int sched_thread_create(uintptr_t entry, uintptr_t arg, uintptr_t stack,
+                        uintptr_t tls, uintptr_t exit_word) {
+  thread_t *current_thread = get_locals()->current_thread;
+  proc_t *proc = current_thread->parent;
+
+  if (!entry || entry >= 0x800000000000 || !stack ||
+      stack > 0x800000000000 || tls >= 0x800000000000)
+    return -EINVAL;
+
+  thread_t *thread = kcalloc(sizeof(thread_t));
+  *thread = (thread_t){
+    .gid = current_thread->gid,
+    .uid = current_thread->uid,
+    .parent = proc,
+    .alive = 1,
+    .policy = current_thread->policy,
+    .priority = current_thread->priority,
+    .dynamic_priority = current_thread->priority,
+    .tid = __atomic_fetch_add(&current_tid, 1, __ATOMIC_RELAXED),
+    .regs =
+      (registers_t){
+        .rip = entry,
+        .rdi = arg,
+        .rsp = stack,
+        .cs = GDT_SEG_UCODE,
+        .ss = GDT_SEG_UDATA,
+        .rflags = 0x202,
+      },
+    .fs_base = tls,
+    .exit_word = exit_word,
+    .kernel_stack = (uintptr_t)pcalloc(SCHED_STACK_SIZE / PAGE_SIZE) +
+                    PHYS_MEM_OFFSET + SCHED_STACK_SIZE,
+    .fpu_storage = fpu_alloc_state(),
+  };
+
+  LOCK(sched_lock);
+  vec_push(&proc->threads, thread);
+  vec_push(&sched_threads, thread);
+  proc->live_threads++;
+  UNLOCK(sched_lock);
+
+  sched_enqueue(thread);
+
+  return thread->tid;
+}
+
 void sched_destroy_thread(thread_t *thread) {
-  pmm_free_pages((void *)thread->kernel_stack, SCHED_STACK_SIZE / PAGE_SIZE);
-  vec_remove(&threads[thread->priority], thread);
+  pmm_free_pages(
+    (void *)(thread->kernel_stack - SCHED_STACK_SIZE - PHYS_MEM_OFFSET),
+    SCHED_STACK_SIZE / PAGE_SIZE);
+  fpu_free_state(thread->fpu_storage);
+  if (thread->queued)
+    sched_queue_remove(thread);
   kfree(thread);
 }
 
-void sched_exit(int code) {
-  /* vmm_load_pagemap(&kernel_pagemap); */
+// Called with sched_lock held. The reaper and the parent's waitpid each
+// hold a reference on an exited proc, whichever lets go last frees it.
+static void sched_release_proc(proc_t *proc) {
+  if (--proc->ref_count)
+    return;
 
-  proc_t *current_proc = get_locals()->current_thread->parent;
+  kfree(proc->event->listeners.data);
+  kfree(proc->event);
+  kfree(proc->children.data);
+  kfree(proc->threads.data);
+  kfree(proc);
+}
+
+// Frees what an exited thread couldn't free itself. Its CPU only drops the
+// thread lock once it is off the thread's stack and pagemap, so holding
+// the lock means neither is in use anymore.
+static void sched_reap(thread_t *thread) {
+  proc_t *proc = thread->parent;
+
+  LOCK(thread->lock);
+
+  pagemap_t *pagemap = NULL;
+
+  LOCK(sched_lock);
+  vec_remove(&sched_threads, thread);
+  vec_remove(&proc->threads, thread);
+  if (!proc->threads.length) {
+    if (proc->user)
+      pagemap = proc->pagemap;
+    proc->pagemap = NULL;
+    sched_release_proc(proc);
+  }
+  UNLOCK(sched_lock);
+
+  // Freeing its ranges can close files, which can block
+  if (pagemap)
+    vmm_destroy_pagemap(pagemap);
+
+  sched_destroy_thread(thread);
+}
+
+static void sched_reaper(run_queue_t *run_queue) {
+  event_t *event = &run_queue->reap_event;
+
+  while (1) {
+    event_await(&event, 1, 1);
+
+    // sched_die takes it with interrupts off
+    uint64_t rflags = spin_lock_irqsave(&run_queue->reap_lock);
+    thread_t *dead = run_queue->dead;
+    run_queue->dead = NULL;
+    spin_unlock_irqrestore(&run_queue->reap_lock, rflags);
+
+    while (dead) {
+      thread_t *next = dead->next_dead;
+      sched_reap(dead);
+      dead = next;
+    }
+  }
+}
 
-  /* asm volatile("cli"); */
-  /* LOCK(sched_lock); */
+// The fd table is read without a lock, see rcu.h. A syscall takes a
+// reference on the file it works on, so another thread closing the fd
+// meanwhile only takes it out of the table.
+syscall_file_t *sched_fd_get(proc_t *proc, size_t fd) {
+  if (fd >= FDS_COUNT)
+    return NULL;
+
+  uint64_t rflags = rcu_read_lock();
+  syscall_file_t *file = RCU_READ(proc->fds[fd]);
+
+  // At 0 it's already being closed. The memory is still there until the
+  // read section ends.
+  if (file) {
+    int count = __atomic_load_n(&file->ref_count, __ATOMIC_RELAXED);
+    do {
+      if (!count) {
+        file = NULL;
+        break;
+      }
+    } while (!__atomic_compare_exchange_n(&file->ref_count, &count, count + 1,
+                                          1, __ATOMIC_ACQUIRE,
+                                          __ATOMIC_RELAXED));
+  }
+
+  rcu_read_unlock(rflags);
+  return file;
+}
+
+void sched_fd_put(syscall_file_t *file) {
+  if (__atomic_sub_fetch(&file->ref_count, 1, __ATOMIC_ACQ_REL))
+    return;
+  vfs_close(file->file);
+  rcu_free(file);
+}
+
+// Puts file in the lowest free slot from from on. Returns the fd, or
+// -EMFILE with file left alone.
+int sched_fd_install(proc_t *proc, syscall_file_t *file, size_t from) {
+  file->ref_count = 1;
+  for (size_t i = from; i < FDS_COUNT; i++) {
+    syscall_file_t *empty = NULL;
+    if (__atomic_compare_exchange_n(&proc->fds[i], &empty, file, 0,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      return i;
+  }
+  return -EMFILE;
+}
+
+int sched_fd_close(proc_t *proc, size_t fd) {
+  if (fd >= FDS_COUNT)
+    return -EBADF;
 
-  /* for (size_t i = 0; i < (size_t)current_proc->threads.length; i++) */
-  /* sched_destroy_thread(current_proc->threads.data[i]); */
-  /* kfree(current_proc->threads.data); */
+  syscall_file_t *file =
+    __atomic_exchange_n(&proc->fds[fd], NULL, __ATOMIC_ACQ_REL);
+  if (!file)
+    return -EBADF;
 
-  /* for (size_t i = 0; i < FDS_COUNT; i++)  */
-  /* if (current_proc->fds[i]) { */
-  /* vfs_close(current_proc->fds[i]->file); */
-  /* kfree(current_proc->fds[i]); */
-  /* } */
-  /* kfree(current_proc->fds); */
+  sched_fd_put(file);
+  return 0;
+}
 
-  /* printf("FDS closed"); */
+static void sched_close_fds(proc_t *proc) {
+  for (size_t i = 0; i < FDS_COUNT; i++)
+    sched_fd_close(proc, i);
+}
 
-  /* current_proc->status = code | 0x200; */
-  event_trigger(current_proc->event);
+// Leaves the rest to the reaper: the thread's stack and pagemap stay in use
+// until its CPU has switched away
+static void sched_die(thread_t *thread) {
+  asm volatile("cli");
 
-  /* vmm_destroy_pagemap(current_proc->pagemap); */
+  run_queue_t *run_queue = &get_locals()->run_queue;
 
-  /* UNLOCK(sched_lock); */
+  thread->alive = 0;
+  LOCK(run_queue->reap_lock);
+  thread->next_dead = run_queue->dead;
+  run_queue->dead = thread;
+  UNLOCK(run_queue->reap_lock);
 
-  /* vec_remove(&threads[get_locals()->current_thread->priority],
-   * get_locals()->current_thread); */
+  event_trigger(&run_queue->reap_event, 0);
 
+  sched_block(thread, 0);
   while (1)
-    ;
+    sched_yield();
+}
 
-  sched_await();
+// The first thread to call this decides the status. The process's other
+// threads are sent through sched_thread_exit on their way back to user
+// mode, see sched_kill_check.
+void sched_exit(int code) {
+  thread_t *thread = get_locals()->current_thread;
+  proc_t *proc = thread->parent;
+
+  LOCK(sched_lock);
+
+  if (!proc->exited) {
+    proc->status = (code & 0xff) << 8;
+    proc->exited = 1;
+
+    // One reference for the reaper, one for waitpid if anyone can call it
+    int index = -1;
+    if (proc->parent)
+      vec_find(&proc->parent->children, proc, index);
+    proc->ref_count = (index == -1) ? 1 : 2;
+
+    // Nobody is left to wait for the children
+    for (int i = 0; i < proc->children.length; i++) {
+      proc_t *child = proc->children.data[i];
+      child->parent = NULL;
+      if (child->exited)
+        sched_release_proc(child);
+    }
+    vec_clear(&proc->children);
+
+    // Blocked threads wouldn't get back to user mode to be stopped
+    // otherwise. Ones that aren't blocked are left alone by sched_wake.
+    for (int i = 0; i < proc->threads.length; i++) {
+      thread_t *other = proc->threads.data[i];
+      if (other != thread)
+        sched_wake(other, (size_t)-1);
+    }
+  }
+
+  UNLOCK(sched_lock);
+
+  sched_thread_exit();
+}
+
+// Ends the calling thread. The last one out of a process closes its fds
+// and wakes waitpid, and if nobody called exit before, the process exits
+// with 0.
+void sched_thread_exit() {
+  thread_t *thread = get_locals()->current_thread;
+  proc_t *proc = thread->parent;
+
+  thread->exiting = 1;
+
+  LOCK(sched_lock);
+  if (proc->live_threads == 1 && !proc->exited) {
+    UNLOCK(sched_lock);
+    sched_exit(0);
+  }
+  int last = !--proc->live_threads;
+  UNLOCK(sched_lock);
+
+  if (thread->exit_word) {
+    __atomic_store_n((uint32_t *)thread->exit_word, 0, __ATOMIC_SEQ_CST);
+    futex_wake(proc->pagemap, (uint32_t *)thread->exit_word, SIZE_MAX);
+  }
+
+  if (last) {
+    io_ring_detach(proc);
+    sched_close_fds(proc);
+    event_trigger(proc->event, 1);
+  }
+
+  sched_die(thread);
 }
 
 int sched_waitpid(ssize_t pid, int *status, int options) {
-  event_t **events;
+  // event_await can block, so this can't sit in a scratch scope. The common
+  // case fits on the stack and only a large family touches the heap.
+  event_t *local_events[WAITPID_LOCAL_EVENTS];
+  event_t **events = local_events;
   size_t events_len;
   proc_t *current_proc = get_locals()->current_thread->parent;
-  proc_t *child;
+  proc_t *child = NULL;
 
   if (pid == -1) {
     events_len = current_proc->children.length;
-    events = kmalloc(sizeof(event_t) * events_len);
+    if (!events_len)
+      return -ECHILD;
+    if (events_len > WAITPID_LOCAL_EVENTS)
+      events = kmalloc(sizeof(event_t *) * events_len);
     for (size_t i = 0; i < events_len; i++)
       events[i] = current_proc->children.data[i]->event;
   } else if (pid > 0) {
     events_len = 1;
-    events = kmalloc(sizeof(event_t));
     for (size_t i = 0; i < (size_t)current_proc->children.length; i++)
       if (current_proc->children.data[i]->pid == (size_t)pid) {
         *events = current_proc->children.data[i]->event;
         child = current_proc->children.data[i];
       }
-    if (!*events)
+    if (!child)
       return -ECHILD;
   } else
     return -EINVAL;
 
   ssize_t which = event_await(events, events_len, !(options & WNOHANG));
 
+  if (events != local_events)
+    kfree(events);
+
   if (which == -1)
     return 0;
   if (!child)
     child = current_proc->children.data[which];
 
-  if (!child) {
-    while (1)
-      ;
+  LOCK(sched_lock);
+  int child_status = child->status;
+  size_t child_pid = child->pid;
+  vec_remove(&current_proc->children, child);
+  sched_release_proc(child);
+  UNLOCK(sched_lock);
+
+  if (status)
+    *status = child_status;
+
+  return child_pid;
+}
+
+// Takes one waiting thread off the busiest CPU, as long as that CPU has at
+// least two more than we do. Only one queue lock is ever held at a time, so
+// two CPUs stealing from each other can't deadlock.
+static void sched_steal(cpu_locals_t *locals) {
+  cpu_locals_t *busiest = NULL;
+  size_t own = LOCKED_READ(locals->run_queue.length);
+  size_t most = own + 1;
+
+  for (size_t i = 0; i < smp_cpu_count; i++) {
+    cpu_locals_t *other = smp_get_locals(i);
+    size_t length = LOCKED_READ(other->run_queue.length);
+    if (other != locals && length > most) {
+      busiest = other;
+      most = length;
+    }
   }
 
-  /* if (status) */
-  /* *status = child->status; */
+  if (!busiest)
+    return;
+
+  run_queue_t *victim = &busiest->run_queue;
+  thread_t *stolen = NULL;
+
+  LOCK(victim->lock);
+
+  // Fair threads first, then the lowest priority from the back of its list,
+  // and never whatever is on that CPU right now. Only the top of the heap
+  // is searched, a thread near the front is as good as any.
+  thread_t *fair = victim->fair;
+  for (thread_t *thread = fair; thread && !stolen;
+       thread = (thread == fair) ? fair->fair_child : thread->fair_sibling)
+    if (thread != busiest->current_thread && !(thread->lock.bits & 1))
+      stolen = thread;
+
+  for (uint32_t ready = victim->ready; ready && !stolen;
+       ready &= ~(1u << (31 - __builtin_clz(ready))))
+    for (thread_t *thread = victim->runnable[31 - __builtin_clz(ready)].tail;
+         thread; thread = thread->run_prev)
+      if (thread != busiest->current_thread && !(thread->lock.bits & 1)) {
+        stolen = thread;
+        break;
+      }
+
+  if (stolen)
+    sched_rq_remove(victim, stolen);
 
-  /* vec_remove(&current_proc->children, child); */
+  UNLOCK(victim->lock);
 
-  /* kfree(child); */
+  if (!stolen)
+    return;
 
-  return child->pid;
+  LOCK(locals->run_queue.lock);
+  sched_rq_add(&locals->run_queue, stolen);
+  stolen->cpu = locals->cpu_number;
+  locals->run_queue.stats.steals++;
+  UNLOCK(locals->run_queue.lock);
 }
 
-void schedule(uint64_t rsp) {
-  lapic_timer_stop();
+// How long the LAPIC timer should run for: the timeslice, or less if the
+// timer wheel needs attention first. 0 means it can stay stopped.
+static uint32_t sched_timeslice(cpu_locals_t *locals, uint64_t now,
+                                uint32_t timeslice) {
+  uint64_t next = timer_next(&locals->timers);
 
-  if (!LOCK_ACQUIRE(sched_lock)) {
-    lapic_eoi();
-    lapic_timer_oneshot(SCHEDULE_REG, DEFAULT_TIMESLICE);
-    return;
-  }
+  if (next == UINT64_MAX)
+    return timeslice;
+  if (next <= now)
+    return 1;
+  if (!timeslice || next - now < timeslice)
+    timeslice = (next - now < SCHED_MAX_TIMER) ? next - now : SCHED_MAX_TIMER;
 
-  cpu_locals_t *locals = get_locals();
-  thread_t *current_thread = locals->current_thread;
-  size_t old_index = locals->last_run_thread_index[locals->current_priority];
-  int old_priority = locals->current_priority;
-
-  do {
-    locals->current_priority++;
-    if (locals->current_priority > locals->current_priority_peg) {
-      locals->current_priority = 0;
-      locals->current_priority_peg++;
-      if (locals->current_priority_peg == PRIORITY_LEVELS)
-        locals->current_priority_peg = 0;
+  return timeslice;
+}
+
+// Each CPU's idle thread. The timer stays off while it runs unless a
+// timer is pending; new work arrives either as a write to the run queue
+// length, which MWAIT watches, or as an IPI out of HLT.
+static void sched_idle() {
+  run_queue_t *run_queue = &get_locals()->run_queue;
+
+  while (1) {
+    asm volatile("cli");
+
+    if (LOCKED_READ(run_queue->length)) {
+      sched_yield();
+      continue;
     }
-  } while (!threads[locals->current_priority].length);
 
-  size_t new_index = (size_t)-1;
-  thread_t *new_current_thread = sched_get_next_thread(
-    locals->last_run_thread_index[locals->current_priority],
-    locals->current_priority, &new_index);
+    if (sched_mwait) {
+      asm volatile("monitor" : : "a"(&run_queue->length), "c"(0), "d"(0));
+      // Something may have been queued before the monitor was armed
+      if (!LOCKED_READ(run_queue->length))
+        asm volatile("sti\n"
+                     "mwait"
+                     :
+                     : "a"(0), "c"(0)
+                     : "memory");
+    } else
+      asm volatile("sti\n"
+                   "hlt"
+                   :
+                   :
+                   : "memory");
+  }
+}
 
-  if (!new_current_thread) {
-    lapic_eoi();
-    lapic_timer_oneshot(SCHEDULE_REG, DEFAULT_TIMESLICE);
-    UNLOCK(sched_lock);
+// Once its process has exited, a thread about to return to user mode is
+// pointed at sched_thread_exit instead, on its empty kernel stack
+static inline void sched_kill_check(thread_t *thread, registers_t *regs) {
+  if (!thread->parent->exited || !thread->alive || regs->cs != GDT_SEG_UCODE)
     return;
-  }
+
+  *regs = (registers_t){
+    .rip = (uintptr_t)sched_thread_exit,
+    .cs = GDT_SEG_KCODE,
+    .ss = GDT_SEG_KDATA,
+    .rsp = thread->kernel_stack - 8,
+    .rflags = 0x202,
+  };
+}
+
+// Called with the run queue locked, returns with it unlocked. Saves the
+// running thread, if any, and runs next. A timeslice of 0 leaves the timer
+// stopped.
+static void sched_switch(cpu_locals_t *locals, uint64_t rsp, thread_t *next,
+                         uint32_t timeslice) {
+  run_queue_t *run_queue = &locals->run_queue;
+  thread_t *current_thread = locals->current_thread;
+  lock_t *unlock = NULL;
 
   if (current_thread) {
-    if (locals->current_priority == old_priority && new_index == old_index) {
-      lapic_eoi();
-      lapic_timer_oneshot(SCHEDULE_REG, DEFAULT_TIMESLICE);
-      UNLOCK(sched_lock);
-      return;
+    // Only threads that used the FPU since they were switched in have
+    // anything to save, see fpu_handle_fault
+    if (current_thread->fpu_loaded) {
+      fpu_save(current_thread->fpu_storage);
+      current_thread->fpu_loaded = 0;
     }
-    asm volatile("fxsave %0" : "+m"(current_thread->fpu_storage) : : "memory");
     current_thread->regs = *((registers_t *)rsp);
-    UNLOCK(current_thread->lock);
+    unlock = &current_thread->lock;
+    if (current_thread->queued)
+      current_thread->wait_start = run_queue->exec_start;
+    if (current_thread != run_queue->idle_thread)
+      sched_stats_log2(run_queue->stats.slice_usage,
+                       sched_tsc_ns(locals, run_queue->exec_start -
+                                              run_queue->switched_at) /
+                         1000);
   }
 
-  locals->current_thread = new_current_thread;
-  locals->last_run_thread_index[locals->current_priority] = new_index;
-  current_thread = new_current_thread;
+  if (next->wait_start) {
+    next->wait_time +=
+      sched_tsc_ns(locals, run_queue->exec_start - next->wait_start);
+    next->wait_start = 0;
+  }
+  sched_stats_woken(locals, next);
+  run_queue->switched_at = run_queue->exec_start;
+  run_queue->stats.switches++;
+  sched_kill_check(next, &next->regs);
+
+  // Kernel threads leave theirs at 0, so it only changes between processes
+  // or user threads
+  if (!current_thread || current_thread->fs_base != next->fs_base)
+    wrmsr(MSR_FS_BASE, next->fs_base);
+
+  LOCKED_WRITE(locals->current_thread, next);
 
-  asm volatile("fxrstor %0" : : "m"(current_thread->fpu_storage) : "memory");
+  UNLOCK(run_queue->lock);
 
-  locals->tss.rsp[0] = current_thread->kernel_stack;
+  fpu_disable();
+
+  locals->tss.rsp[0] = next->kernel_stack;
+  locals->kernel_stack = next->kernel_stack;
 
   lapic_eoi();
-  lapic_timer_oneshot(SCHEDULE_REG, DEFAULT_TIMESLICE);
+  if (timeslice)
+    lapic_timer_oneshot(SCHEDULE_REG, timeslice);
 
-  vmm_load_pagemap(current_thread->parent->pagemap);
+  vmm_load_pagemap(next->parent->pagemap);
 
-  UNLOCK(sched_lock);
+  switch_and_run_stack((uintptr_t)&next->regs, unlock);
+}
+
+// Called with the run queue locked when there's nothing this CPU can run
+static void sched_run_idle(cpu_locals_t *locals, uint64_t rsp, uint64_t now,
+                           uint32_t timeslice) {
+  run_queue_t *run_queue = &locals->run_queue;
+  timeslice = sched_timeslice(locals, now, timeslice);
+
+  if (locals->current_thread != run_queue->idle_thread) {
+    sched_switch(locals, rsp, run_queue->idle_thread, timeslice);
+    return;
+  }
+
+  UNLOCK(run_queue->lock);
+  lapic_eoi();
+  if (timeslice)
+    lapic_timer_oneshot(SCHEDULE_REG, timeslice);
+}
+
+// The peg walks levels 0, then 0-1, then 0-2 and so on up to every level,
+// then starts over. Level n comes up PRIORITY_LEVELS - n times per round,
+// so lower priorities run less often but never starve. Empty levels are
+// skipped with the ready bitmap. Within a level, the first thread at the
+// front of its list that isn't running on another CPU wins.
+static thread_t *sched_pick_priority(run_queue_t *run_queue,
+                                     thread_t *current_thread) {
+  uint32_t ready = run_queue->ready;
+  if (!ready)
+    return NULL;
+
+  uint32_t levels = ready & ~((2u << run_queue->current_priority) - 1) &
+                    ((2u << run_queue->current_priority_peg) - 1);
+
+  while (!levels) {
+    if (++run_queue->current_priority_peg == PRIORITY_LEVELS)
+      run_queue->current_priority_peg = 0;
+    levels = ready & ((2u << run_queue->current_priority_peg) - 1);
+  }
+
+  run_queue->current_priority = __builtin_ctz(levels);
+
+  // Everything on that level may still be on another CPU's stack, then
+  // the other levels get a go in priority order
+  levels = ready & ~(1u << run_queue->current_priority);
+  for (int priority = run_queue->current_priority;;
+       priority = __builtin_ctz(levels), levels &= levels - 1) {
+    for (thread_t *thread = run_queue->runnable[priority].head; thread;
+         thread = thread->run_next) {
+      if (thread == current_thread || LOCK_ACQUIRE(thread->lock))
+        return thread;
+      run_queue->stats.lock_misses++;
+    }
+
+    if (!levels)
+      return NULL;
+  }
+}
+
+// The fair thread furthest behind, or the running one if it's still within
+// its timeslice and not too far ahead of that
+static thread_t *sched_pick_fair(run_queue_t *run_queue,
+                                 thread_t *current_thread, int expired) {
+  thread_t *first = run_queue->fair;
+  if (!first)
+    return NULL;
+
+  if (!expired && current_thread && current_thread->queued &&
+      current_thread->policy == SCHED_FAIR &&
+      (int64_t)(current_thread->vruntime - first->vruntime) <=
+        SCHED_WAKEUP_GRANULARITY)
+    return current_thread;
+
+  for (thread_t *thread = first; thread;
+       thread = (thread == first) ? first->fair_child : thread->fair_sibling) {
+    if (thread == current_thread || LOCK_ACQUIRE(thread->lock))
+      return thread;
+    run_queue->stats.lock_misses++;
+  }
 
-  switch_and_run_stack((uintptr_t)&current_thread->regs);
+  return NULL;
+}
+
+// Charges whatever ran since the last call to thread, if any
+static void sched_account(cpu_locals_t *locals, thread_t *thread,
+                          uint64_t tsc) {
+  run_queue_t *run_queue = &locals->run_queue;
+  uint64_t ns = sched_tsc_ns(locals, tsc - run_queue->exec_start);
+  run_queue->exec_start = tsc;
+
+  if (!thread)
+    return;
+
+  if (thread == run_queue->idle_thread)
+    run_queue->stats.idle_time += ns;
+  thread->runtime += ns;
+  if (thread->policy == SCHED_FAIR) {
+    uint64_t delta = ns * sched_weights[0] / sched_weights[thread->priority];
+    thread->vruntime += delta;
+    // Time spent between blocking and switching away still counts
+    if (!thread->queued)
+      thread->vlag += delta;
+  }
+}
+
+void schedule(uint64_t rsp) {
+  lapic_timer_stop();
+
+  cpu_locals_t *locals = get_locals();
+  run_queue_t *run_queue = &locals->run_queue;
+  thread_t *current_thread = locals->current_thread;
+
+  rcu_quiescent(locals);
+
+  // Timers go first, what they wake up is then up for scheduling right away
+  uint64_t tsc = rdtsc();
+  uint64_t now = tsc / (locals->tsc_freq / 1000000);
+  timer_run(&locals->timers, now);
+
+  // A queue holding nothing but what's already running counts as empty.
+  // A blocked thread is still on its stack but no longer on the queue.
+  size_t waiting = run_queue->length -
+                   ((current_thread && current_thread->queued) ? 1 : 0);
+  if (!waiting || !(++run_queue->ticks % SCHED_BALANCE_TICKS))
+    sched_steal(locals);
+
+  LOCK(run_queue->lock);
+  run_queue->stats.schedules++;
+
+  // The running thread is charged for its time, which moves a fair thread
+  // along the heap. Any other goes to the back of its list, a level lower
+  // if it used up its timeslice.
+  int expired = now >= run_queue->slice_end;
+  if (current_thread && current_thread->queued) {
+    sched_class_remove(run_queue, current_thread);
+    sched_account(locals, current_thread, tsc);
+    if (expired && current_thread->policy == SCHED_PRIORITY &&
+        current_thread->dynamic_priority <
+          current_thread->priority + SCHED_MAX_DECAY &&
+        current_thread->dynamic_priority < PRIORITY_LEVELS - 1)
+      current_thread->dynamic_priority++;
+    sched_class_push(run_queue, current_thread);
+  } else
+    sched_account(locals, current_thread, tsc);
+  sched_fair_update_min(run_queue);
+
+  if (!run_queue->length) {
+    sched_run_idle(locals, rsp, now, 0);
+    return;
+  }
+
+  // Kernel threads first, fair threads get the rest
+  thread_t *new_current_thread = sched_pick_priority(run_queue, current_thread);
+  if (!new_current_thread)
+    new_current_thread = sched_pick_fair(run_queue, current_thread, expired);
+  if (!new_current_thread)
+    run_queue->stats.lock_miss_ticks++;
+
+  // Whatever is queued is still on another CPU's stack, try again soon
+  if (!new_current_thread && !(current_thread && current_thread->queued)) {
+    sched_run_idle(locals, rsp, now, DEFAULT_TIMESLICE);
+    return;
+  }
+
+  // A thread that keeps running after an early reschedule, say for a timer
+  // or a yield that found nothing else to run, keeps what's left of its
+  // timeslice
+  if (!new_current_thread || new_current_thread == current_thread) {
+    if (expired)
+      run_queue->slice_end = now + DEFAULT_TIMESLICE;
+    if (current_thread) {
+      current_thread->wait_start = 0;
+      sched_stats_woken(locals, current_thread);
+      sched_kill_check(current_thread, (registers_t *)rsp);
+    }
+    uint32_t timeslice =
+      sched_timeslice(locals, now, run_queue->slice_end - now);
+
+    UNLOCK(run_queue->lock);
+    lapic_eoi();
+    lapic_timer_oneshot(SCHEDULE_REG, timeslice);
+    return;
+  }
+
+  run_queue->slice_end = now + DEFAULT_TIMESLICE;
+  uint32_t timeslice = sched_timeslice(locals, now, DEFAULT_TIMESLICE);
+
+  sched_switch(locals, rsp, new_current_thread, timeslice);
 }
 
 static inline void sched_load_args_to_stack(thread_t *thread,
@@ -436,6 +1387,16 @@ static inline void sched_load_args_to_stack(thread_t *thread,
 
 int sched_run_program(char *path, char *argv[], char *env[], char *stdin,
                       char *stdout, char *stderr, int replace) {
+  // Replacing the image would pull the pagemap out from under the other
+  // threads. With only the caller left, nothing else can start new ones.
+  if (replace) {
+    LOCK(sched_lock);
+    int busy = get_locals()->current_thread->parent->live_threads > 1;
+    UNLOCK(sched_lock);
+    if (busy)
+      return -EBUSY;
+  }
+
   pagemap_t *new_pagemap = vmm_create_new_pagemap();
 
   uintptr_t entry;
@@ -451,6 +1412,7 @@ int sched_run_program(char *path, char *argv[], char *env[], char *stdin,
       *sfile = (syscall_file_t){
         .file = file,
         .flags = O_RDONLY,
+        .ref_count = 1,
       };
       new_proc->fds[0] = sfile;
     }
@@ -460,6 +1422,7 @@ int sched_run_program(char *path, char *argv[], char *env[], char *stdin,
       *sfile = (syscall_file_t){
         .file = file,
         .flags = O_WRONLY,
+        .ref_count = 1,
       };
       new_proc->fds[1] = sfile;
     }
@@ -469,6 +1432,7 @@ int sched_run_program(char *path, char *argv[], char *env[], char *stdin,
       *sfile = (syscall_file_t){
         .file = file,
         .flags = O_WRONLY,
+        .ref_count = 1,
       };
       new_proc->fds[2] = sfile;
     }
@@ -490,10 +1454,14 @@ int sched_run_program(char *path, char *argv[], char *env[], char *stdin,
     proc_t *proc = thread->parent;
     pagemap_t *old_pagemap = proc->pagemap;
 
+    // Rings run as the old image
+    io_ring_detach(proc);
+
     proc->mmap_top = SCHED_MMAP_TOP;
     proc->stack_top = SCHED_STACK_TOP;
-    proc->pid = current_pid++;
+    proc->pid = __atomic_fetch_add(&current_pid, 1, __ATOMIC_RELAXED);
     proc->pagemap = new_pagemap;
+    vdso_set_pid(new_pagemap, proc->pid);
     proc->mmaped_len = 0;
 
     sched_new_thread(thread, proc, entry, thread->priority, thread->uid,
@@ -508,23 +1476,104 @@ int sched_run_program(char *path, char *argv[], char *env[], char *stdin,
       thread->regs.rsp, argv, env);
 
     vmm_load_pagemap(new_pagemap);
-    vmm_destroy_pagemap(old_pagemap);
 
     UNLOCK(sched_lock);
 
-    switch_and_run_stack((uintptr_t)&thread->regs);
+    // Siblings that already exited can still be on the old pagemap until
+    // their CPU switches away, the reaper takes them off the list after
+    while (1) {
+      LOCK(sched_lock);
+      int alone = proc->threads.length == 1;
+      UNLOCK(sched_lock);
+      if (alone)
+        break;
+      sched_yield();
+    }
+
+    vmm_destroy_pagemap(old_pagemap);
+
+    switch_and_run_stack((uintptr_t)&thread->regs, NULL);
   }
 
   return 0;
 }
 
-void init_sched(uintptr_t start_addr) {
-  for (size_t i = 0; i < PRIORITY_LEVELS; i++)
-    threads[i].data = kcalloc(sizeof(thread_t *));
+// Fills in up to max_threads thread records, returns how many it did
+size_t sched_stats_snapshot(sched_stats_t *stats, sched_cpu_stats_t *cpus,
+                            sched_thread_stats_t *threads,
+                            size_t max_threads) {
+  for (size_t i = 0; i < smp_cpu_count; i++) {
+    run_queue_t *run_queue = &smp_get_locals(i)->run_queue;
+    uint64_t rflags = spin_lock_irqsave(&run_queue->lock);
+    cpus[i] = run_queue->stats;
+    spin_unlock_irqrestore(&run_queue->lock, rflags);
+  }
 
+  LOCK(sched_lock);
+
+  size_t count = 0;
+  for (int i = 0; i < sched_threads.length && count < max_threads; i++) {
+    thread_t *thread = sched_threads.data[i];
+    threads[count++] = (sched_thread_stats_t){
+      .tid = thread->tid,
+      .pid = thread->parent->pid,
+      .cpu = thread->cpu,
+      .policy = thread->policy,
+      .priority = thread->priority,
+      .runtime = thread->runtime,
+      .wait_time = thread->wait_time,
+    };
+  }
+
+  *stats = (sched_stats_t){
+    .cpu_count = smp_cpu_count,
+    .thread_count = count,
+    .dropped_threads = sched_threads.length - count,
+  };
+
+  UNLOCK(sched_lock);
+
+  return count;
+}
+
+void sched_stats_reset() {
+  for (size_t i = 0; i < smp_cpu_count; i++) {
+    run_queue_t *run_queue = &smp_get_locals(i)->run_queue;
+    uint64_t rflags = spin_lock_irqsave(&run_queue->lock);
+    run_queue->stats = (sched_cpu_stats_t){0};
+    spin_unlock_irqrestore(&run_queue->lock, rflags);
+  }
+
+  LOCK(sched_lock);
+  for (int i = 0; i < sched_threads.length; i++) {
+    sched_threads.data[i]->runtime = 0;
+    sched_threads.data[i]->wait_time = 0;
+  }
+  UNLOCK(sched_lock);
+}
+
+void init_sched(uintptr_t start_addr) {
   kernel_proc = sched_new_proc(NULL, NULL, 0);
   sched_new_thread(NULL, kernel_proc, start_addr, 0, 0, 0, 1);
 
+  uint32_t eax, ebx, ecx, edx;
+  __cpuid(1, eax, ebx, ecx, edx);
+  sched_mwait = !!(ecx & (1 << 3));
+
+  for (size_t i = 0; i < smp_cpu_count; i++) {
+    thread_t *idle_thread = sched_new_thread(
+      NULL, kernel_proc, (uintptr_t)sched_idle, PRIORITY_LEVELS - 1, 0, 0, 0);
+    idle_thread->cpu = i;
+    smp_get_locals(i)->run_queue.idle_thread = idle_thread;
+
+    thread_t *reaper = sched_new_thread(NULL, kernel_proc,
+                                        (uintptr_t)sched_reaper,
+                                        PRIORITY_LEVELS - 1, 0, 0, 0);
+    reaper->regs.rdi = (uintptr_t)&smp_get_locals(i)->run_queue;
+    reaper->queued = 1;
+    sched_queue_push(i, reaper);
+  }
+
   LOCKED_WRITE(sched_has_started, 1);
   sched_await();
 }
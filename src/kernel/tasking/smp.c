@@ -5,25 +5,35 @@
 #include <lock.h>
 #include <mm/kheap.h>
 #include <mm/pmm.h>
+#include <mm/scratch.h>
 #include <mm/vmm.h>
 #include <printf.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/fpu.h>
 #include <sys/gdt.h>
 #include <sys/idt.h>
+#include <sys/syscall.h>
+#include <sys/vdso.h>
 #include <tasking/scheduler.h>
 #include <tasking/smp.h>
+#include <tasking/timer.h>
 
 static cpu_locals_t *cpu_locals;
 static uint32_t bsp_lapic_id;
 static size_t inited_cpus = 0;
 
+size_t smp_cpu_count = 0;
+
+cpu_locals_t *smp_get_locals(size_t cpu) { return &cpu_locals[cpu]; }
+
 extern void enable_sse();
 
 void smp_init_cpu(struct stivale2_smp_info *smp_info) {
   if (smp_info->lapic_id != bsp_lapic_id) {
     enable_sse();
+    fpu_init_cpu();
     load_gdt();
     load_idt();
   }
@@ -34,15 +44,23 @@ void smp_init_cpu(struct stivale2_smp_info *smp_info) {
 
   set_and_load_tss((uintptr_t)&locals->tss);
 
-  memset(locals->last_run_thread_index, 0, PRIORITY_LEVELS * sizeof(size_t));
-  locals->current_thread = NULL, locals->current_priority_peg = 0;
-  locals->current_priority = 0;
+  locals->current_thread = NULL;
+  sched_init_run_queue(&locals->run_queue);
   locals->lapic_id = smp_info->lapic_id;
 
+  scratch_init(&locals->scratch);
+
   set_locals(locals);
+  vdso_init_cpu(locals);
+
+  // Userspace runs with a GS base of 0, swapgs trades it for locals on the
+  // way in and back on the way out
+  wrmsr(MSR_KERNEL_GS_BASE, 0);
+  syscall_init_cpu();
 
   init_lapic();
   lapic_timer_get_freq();
+  timer_init_wheel(&locals->timers);
 
   klog(3, "Brought up CPU #%lu\n", locals->cpu_number);
 
@@ -56,7 +74,8 @@ void smp_init_cpu(struct stivale2_smp_info *smp_info) {
 
 int init_smp(struct stivale2_struct_tag_smp *smp_info) {
   bsp_lapic_id = smp_info->bsp_lapic_id;
-  cpu_locals = kmalloc(sizeof(cpu_locals_t) * smp_info->cpu_count);
+  cpu_locals = kcalloc(sizeof(cpu_locals_t) * smp_info->cpu_count);
+  smp_cpu_count = smp_info->cpu_count;
 
   for (size_t i = 0; i < smp_info->cpu_count; i++) {
     cpu_locals[i].cpu_number = i;
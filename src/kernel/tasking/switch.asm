@@ -1,7 +1,15 @@
 global switch_and_run_stack
 
+; rdi: registers_t to resume
+; rsi: lock_t of the thread we are leaving, or 0. It is only dropped once
+;      we are off that thread's stack, so another CPU can't pick it up while
+;      we are still running on it.
 switch_and_run_stack:
   mov rsp, rdi
+  test rsi, rsi
+  jz .run
+  lock btr dword [rsi], 0
+.run:
   pop r15
   pop r14
   pop r13
@@ -17,5 +25,11 @@ switch_and_run_stack:
   pop rcx
   pop rbx
   pop rax
+
+  ; Back to the user's GS base if it's a user thread, see interrupts.asm
+  test byte [rsp + 24], 3
+  jz .kernel
+  swapgs
+.kernel:
   add rsp, 16
   iretq
@@ -0,0 +1,193 @@
+#include <cpu_locals.h>
+#include <lock.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <tasking/scheduler.h>
+#include <tasking/timer.h>
+
+static void timer_link(timer_t **head, timer_t *timer) {
+  timer->head = head;
+  timer->prev = NULL;
+  timer->next = *head;
+  if (*head)
+    (*head)->prev = timer;
+  *head = timer;
+}
+
+static void timer_unlink(timer_wheel_t *wheel, timer_t *timer) {
+  if (timer->prev)
+    timer->prev->next = timer->next;
+  else
+    *timer->head = timer->next;
+  if (timer->next)
+    timer->next->prev = timer->prev;
+
+  // Keep the occupancy bit in sync if that emptied a wheel slot
+  if (timer->head != &wheel->expired && !*timer->head) {
+    size_t index = timer->head - &wheel->slots[0][0];
+    wheel->occupied[index / TIMER_SLOTS] &=
+      ~(1ull << (index % TIMER_SLOTS));
+  }
+}
+
+// Picks the lowest level whose turn still covers the timer, counting from
+// wheel->now. Past the top level the timer waits in the furthest slot and is
+// put back in from there.
+static void timer_insert(timer_wheel_t *wheel, timer_t *timer) {
+  uint64_t expires = timer->expires;
+  uint64_t span = 1ull << (TIMER_SLOT_BITS * TIMER_LEVELS);
+
+  if (expires <= wheel->now)
+    expires = wheel->now + 1;
+  if (expires - wheel->now >= span)
+    expires = wheel->now + span - 1;
+
+  size_t level = 0;
+  while (expires - wheel->now >= 1ull << (TIMER_SLOT_BITS * (level + 1)))
+    level++;
+
+  size_t slot = (expires >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+  timer_link(&wheel->slots[level][slot], timer);
+  wheel->occupied[level] |= 1ull << slot;
+}
+
+void timer_init_wheel(timer_wheel_t *wheel) {
+  *wheel = (timer_wheel_t){0};
+  wheel->now = sched_time() / TIMER_TICK;
+}
+
+// Arms a timer on this CPU's wheel for the sched_time() deadline. The
+// timer must not be pending already. Whoever adds a timer is expected to go
+// through schedule() soon, which is what reprograms the LAPIC timer.
+void timer_add(timer_t *timer, uint64_t deadline) {
+  // Wheels are handled from the scheduler interrupt, and this has to stay on
+  // the CPU whose wheel it picked
+  uint64_t rflags = lock_irq_save();
+  timer_wheel_t *wheel = &get_locals()->timers;
+
+  spin_lock(&wheel->lock);
+  timer->deadline = deadline;
+  timer->expires = (deadline + TIMER_TICK - 1) / TIMER_TICK;
+  timer->wheel = wheel;
+  timer->pending = 1;
+  timer_insert(wheel, timer);
+  spin_unlock_irqrestore(&wheel->lock, rflags);
+}
+
+// Returns 1 if the timer was still pending. Once this returns the callback
+// isn't running either, so it must not be called from the callback itself.
+int timer_cancel(timer_t *timer) {
+  timer_wheel_t *wheel = timer->wheel;
+  if (!wheel)
+    return 0;
+
+  uint64_t rflags = spin_lock_irqsave(&wheel->lock);
+
+  int pending = timer->pending;
+  if (pending) {
+    timer_unlink(wheel, timer);
+    timer->pending = 0;
+  }
+
+  while (wheel->running == timer) {
+    UNLOCK(wheel->lock);
+    asm volatile("pause");
+    LOCK(wheel->lock);
+  }
+
+  spin_unlock_irqrestore(&wheel->lock, rflags);
+
+  return pending;
+}
+
+// Moves the wheel forward to now (in microseconds) and runs whatever is
+// due. A level never has more than one turn's worth of slots to look at, no
+// matter how long the CPU was idle.
+void timer_run(timer_wheel_t *wheel, uint64_t now) {
+  uint64_t target = now / TIMER_TICK;
+
+  uint64_t rflags = spin_lock_irqsave(&wheel->lock);
+
+  uint64_t old = wheel->now;
+  if (target > old) {
+    wheel->now = target;
+
+    // Top down, so timers cascading to lower levels are looked at again in
+    // this same pass
+    for (int level = TIMER_LEVELS - 1; level >= 0; level--) {
+      size_t shift = TIMER_SLOT_BITS * level;
+      uint64_t from = (old >> shift) + 1;
+      uint64_t to = target >> shift;
+
+      if (to < from)
+        continue;
+      if (to - from >= TIMER_SLOTS)
+        from = to - TIMER_SLOTS + 1;
+
+      for (uint64_t bucket = from; bucket <= to; bucket++) {
+        size_t slot = bucket & (TIMER_SLOTS - 1);
+        timer_t *timer = wheel->slots[level][slot];
+
+        wheel->slots[level][slot] = NULL;
+        wheel->occupied[level] &= ~(1ull << slot);
+
+        while (timer) {
+          timer_t *next = timer->next;
+          if (timer->expires <= target)
+            timer_link(&wheel->expired, timer);
+          else
+            timer_insert(wheel, timer);
+          timer = next;
+        }
+      }
+    }
+  }
+
+  while (wheel->expired) {
+    timer_t *timer = wheel->expired;
+    timer_unlink(wheel, timer);
+    timer->pending = 0;
+    wheel->running = timer;
+
+    UNLOCK(wheel->lock);
+    timer->callback(timer);
+    LOCK(wheel->lock);
+
+    wheel->running = NULL;
+  }
+
+  spin_unlock_irqrestore(&wheel->lock, rflags);
+}
+
+// The earliest time (in microseconds) the wheel needs timer_run, or
+// UINT64_MAX if nothing is pending. Slots above level 0 only say when they
+// start, so this can be early, in which case timer_run just cascades.
+uint64_t timer_next(timer_wheel_t *wheel) {
+  uint64_t next = UINT64_MAX;
+
+  uint64_t rflags = spin_lock_irqsave(&wheel->lock);
+
+  if (wheel->expired)
+    next = wheel->now;
+
+  // A higher level's slot can start before the first one in use below it
+  for (size_t level = 0; level < TIMER_LEVELS; level++) {
+    if (!wheel->occupied[level])
+      continue;
+
+    size_t shift = TIMER_SLOT_BITS * level;
+    uint64_t bucket = (wheel->now >> shift) + 1;
+    size_t first = bucket & (TIMER_SLOTS - 1);
+    uint64_t mask = wheel->occupied[level];
+    uint64_t rotated =
+      first ? (mask >> first) | (mask << (TIMER_SLOTS - first)) : mask;
+    uint64_t start = (bucket + __builtin_ctzll(rotated)) << shift;
+
+    if (start < next)
+      next = start;
+  }
+
+  spin_unlock_irqrestore(&wheel->lock, rflags);
+
+  return (next == UINT64_MAX) ? next : next * TIMER_TICK;
+}
@@ -2,7 +2,7 @@ global _start
 
 extern main
 extern __crt_load_environ
-extern _exit
+extern exit
 
 _start:
     push rax
@@ -38,4 +38,4 @@ _start:
     pop rax
   call main
   mov rdi, rax
-  call _exit
+  call exit
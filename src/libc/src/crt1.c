@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,6 +7,11 @@
 void __crt_load_environ(int argc, char *argv[], char *env[]) {
   (void)argc;
   (void)argv;
+
+  // errno lives in the thread control block, so this goes first
+  __pthread_init();
+  __string_init();
+
   size_t envc = 0;
   if (env)
     while (env[envc])
@@ -15,17 +21,9 @@ void __crt_load_environ(int argc, char *argv[], char *env[]) {
   for (size_t i = 0; i < envc; i++)
     environ[i] = strdup(env[i]);
 
-  stdin = malloc(sizeof(FILE));
-  stdout = malloc(sizeof(FILE));
-  stderr = malloc(sizeof(FILE));
+  stdin = fdopen(STDIN_FILENO, "r");
+  stdout = fdopen(STDOUT_FILENO, "w");
+  stderr = fdopen(STDERR_FILENO, "w");
 
-  *stdin = (FILE){
-    .fd = STDIN_FILENO,
-  };
-  *stdout = (FILE){
-    .fd = STDOUT_FILENO,
-  };
-  *stderr = (FILE){
-    .fd = STDERR_FILENO,
-  };
+  setvbuf(stderr, NULL, _IONBF, 0);
 }
@@ -1,7 +1,5 @@
 #include <errno.h>
 
-int errno = 0;
-
 char *__sys_errlist[] = {
   [0] = "No error",
   [E2BIG] = "Argument list too long",
@@ -11,14 +11,14 @@ int open(char *pathname, int flags, ...) {
     mode_t mode = va_arg(v, mode_t);
     va_end(v);
 
-    int ret = intsyscall(SYSCALL_OPEN, (uint64_t)pathname, flags, mode, 0, 0);
+    int ret = __syscall_open((uint64_t)pathname, flags, mode);
     if (ret < 0) {
       errno = -ret;
       return -1;
     }
     return ret;
   } else {
-    int ret = intsyscall(SYSCALL_OPEN, (uint64_t)pathname, flags, 0, 0, 0);
+    int ret = __syscall_open((uint64_t)pathname, flags, 0);
     if (ret < 0) {
       errno = -ret;
       return -1;
@@ -81,7 +81,10 @@
 #define EWOULDBLOCK EAGAIN
 #define EXDEV 79
 
-extern int errno;
+// Every thread has its own, see pthread.c
+int *__errno_location();
+#define errno (*__errno_location())
+
 extern char *__sys_errlist[];
 
 #endif
@@ -0,0 +1,63 @@
+#ifndef __PTHREAD_H__
+#define __PTHREAD_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PTHREAD_STACK_MIN 0x4000
+#define PTHREAD_STACK_SIZE 0x40000
+
+typedef struct pthread *pthread_t;
+
+typedef struct pthread_attr {
+  size_t stack_size;
+} pthread_attr_t;
+
+// 0 unlocked, 1 locked, 2 locked with threads asleep on it
+typedef struct pthread_mutex {
+  volatile uint32_t state;
+} pthread_mutex_t;
+
+typedef struct pthread_mutexattr {
+  int unused;
+} pthread_mutexattr_t;
+
+// Bumped by every signal and broadcast, waiters sleep until it moves
+typedef struct pthread_cond {
+  volatile uint32_t sequence;
+  volatile uint32_t waiters;
+} pthread_cond_t;
+
+typedef struct pthread_condattr {
+  int unused;
+} pthread_condattr_t;
+
+#define PTHREAD_MUTEX_INITIALIZER {0}
+#define PTHREAD_COND_INITIALIZER {0, 0}
+
+void __pthread_init();
+
+int pthread_create(pthread_t *thread, pthread_attr_t *attr,
+                   void *(*start)(void *), void *arg);
+int pthread_join(pthread_t thread, void **retval);
+void pthread_exit(void *retval) __attribute__((noreturn));
+pthread_t pthread_self();
+int pthread_equal(pthread_t a, pthread_t b);
+
+int pthread_attr_init(pthread_attr_t *attr);
+int pthread_attr_destroy(pthread_attr_t *attr);
+int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stack_size);
+
+int pthread_mutex_init(pthread_mutex_t *mutex, pthread_mutexattr_t *attr);
+int pthread_mutex_destroy(pthread_mutex_t *mutex);
+int pthread_mutex_lock(pthread_mutex_t *mutex);
+int pthread_mutex_trylock(pthread_mutex_t *mutex);
+int pthread_mutex_unlock(pthread_mutex_t *mutex);
+
+int pthread_cond_init(pthread_cond_t *cond, pthread_condattr_t *attr);
+int pthread_cond_destroy(pthread_cond_t *cond);
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+int pthread_cond_signal(pthread_cond_t *cond);
+int pthread_cond_broadcast(pthread_cond_t *cond);
+
+#endif
@@ -0,0 +1,7 @@
+#ifndef __SCHED_H__
+#define __SCHED_H__
+
+int sched_yield();
+int getcpu(unsigned int *cpu, unsigned int *node);
+
+#endif
@@ -1,19 +1,74 @@
 #ifndef __STDIO_H__
 #define __STDIO_H__
 
+#include <stdarg.h>
+#include <stddef.h>
+
+#define EOF (-1)
+#define BUFSIZ 4096
+
+#define _IOFBF 0
+#define _IOLBF 1
+#define _IONBF 2
+
+#define __FILE_READ 0x1
+#define __FILE_WRITE 0x2
+#define __FILE_READING 0x4
+#define __FILE_WRITING 0x8
+#define __FILE_EOF 0x10
+#define __FILE_ERR 0x20
+#define __FILE_OWN_BUF 0x40
+#define __FILE_APPEND 0x80
+
 struct FILE;
 
 extern struct FILE *stdin;
 extern struct FILE *stdout;
 extern struct FILE *stderr;
 
+// A FILE is only ever reading or writing at one time. buf_pos is the next
+// byte to hand out (reading) or the next free byte (writing), and buf_len is
+// how much of the buffer read() filled.
 typedef struct FILE {
   int fd;
+  int flags;
+  int mode;
+  unsigned char *buf;
+  size_t buf_size;
+  size_t buf_pos;
+  size_t buf_len;
+  struct FILE *next;
 } FILE;
 
+FILE *fopen(char *path, char *mode);
+FILE *fdopen(int fd, char *mode);
+int fclose(FILE *stream);
+int fflush(FILE *stream);
+int setvbuf(FILE *stream, char *buf, int mode, size_t size);
+void setbuf(FILE *stream, char *buf);
+int fileno(FILE *stream);
+int feof(FILE *stream);
+int ferror(FILE *stream);
+void clearerr(FILE *stream);
+
+size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream);
+size_t fwrite(void *ptr, size_t size, size_t nmemb, FILE *stream);
+int fgetc(FILE *stream);
+int getc(FILE *stream);
+int getchar();
+int fputc(int c, FILE *stream);
+int putc(int c, FILE *stream);
+int putchar(int c);
+int fputs(char *s, FILE *stream);
+int puts(char *s);
+char *fgets(char *s, int size, FILE *stream);
+
 __attribute__((format(printf, 1, 2))) int printf(const char *format, ...);
+__attribute__((format(printf, 2, 3))) int fprintf(FILE *stream,
+                                                  const char *format, ...);
+int vprintf(const char *format, va_list args);
+int vfprintf(FILE *stream, const char *format, va_list args);
 void perror(char *str);
-char *fgets(char *s, int size, FILE *stream);
 int remove(char *path);
 
 #endif
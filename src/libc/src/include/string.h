@@ -3,6 +3,9 @@
 
 #include <stddef.h>
 
+// Copies and fills at least this big bypass the cache with streaming stores
+#define __STRING_NT_THRESHOLD 0x100000
+
 char *strchr(char *str, int c);
 size_t strlen(char *s);
 void memcpy(void *dest, void *src, size_t n);
@@ -10,8 +13,28 @@ char *strdup(char *s1);
 int strncmp(char *s1, char *s2, size_t n);
 void strcat(char *dest, char *src);
 void *memset(void *buf, char val, size_t len);
+void *memchr(void *buf, int c, size_t len);
 char *strcpy(char *dest, char *src);
 char *strncpy(char *dest, char *src, size_t n);
 char *strpbrk(char *s, char *b);
+int strcmp(char *s1, char *s2);
+int memcmp(void *s1, void *s2, size_t n);
+
+// Picks the memcpy, memset, strlen, memchr and memcmp implementations for
+// this CPU. crt1 calls it before anything else runs.
+void __string_init();
+extern char *__string_variant;
+
+void __memcpy_sse2(void *dest, void *src, size_t n);
+void *__memset_sse2(void *buf, char val, size_t len);
+size_t __strlen_sse2(char *s);
+void *__memchr_sse2(void *buf, int c, size_t len);
+int __memcmp_sse2(void *s1, void *s2, size_t n);
+
+void __memcpy_avx2(void *dest, void *src, size_t n);
+void *__memset_avx2(void *buf, char val, size_t len);
+size_t __strlen_avx2(char *s);
+void *__memchr_avx2(void *buf, int c, size_t len);
+int __memcmp_avx2(void *s1, void *s2, size_t n);
 
 #endif
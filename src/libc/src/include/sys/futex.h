@@ -0,0 +1,13 @@
+#ifndef __FUTEX_H__
+#define __FUTEX_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_WAKE_N 2
+
+int futex(uint32_t *word, int op, uint32_t value, struct timespec *timeout);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef __SYS_IO_RING_H__
+#define __SYS_IO_RING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Shared with the kernel, which maps it for io_ring_setup's fd
+#include "../../../../kernel/include/sys/io_ring_layout.h"
+
+// A ring mapped into this process. SQEs handed out by io_ring_get_sqe are
+// only seen by the kernel after io_ring_submit. Each ring belongs to one
+// thread at a time.
+typedef struct io_ring {
+  int fd;
+  uint32_t flags;
+  void *map;
+  size_t size;
+  io_ring_header_t *header;
+  io_ring_sqe_t *sqes;
+  io_ring_cqe_t *cqes;
+  uint32_t sq_tail;
+} io_ring_t;
+
+int io_ring_setup(io_ring_params_t *params);
+int io_ring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                  unsigned int flags);
+
+int io_ring_init(io_ring_t *ring, unsigned int entries, unsigned int flags);
+void io_ring_exit(io_ring_t *ring);
+io_ring_sqe_t *io_ring_get_sqe(io_ring_t *ring);
+int io_ring_submit(io_ring_t *ring);
+int io_ring_submit_and_wait(io_ring_t *ring, unsigned int wait_nr);
+int io_ring_peek_cqe(io_ring_t *ring, io_ring_cqe_t **cqe);
+int io_ring_wait_cqe(io_ring_t *ring, io_ring_cqe_t **cqe);
+void io_ring_cqe_seen(io_ring_t *ring);
+
+void io_ring_prep_read(io_ring_sqe_t *sqe, int fd, void *buf, unsigned int len,
+                       off_t offset);
+void io_ring_prep_write(io_ring_sqe_t *sqe, int fd, void *buf,
+                        unsigned int len, off_t offset);
+void io_ring_prep_fsync(io_ring_sqe_t *sqe, int fd);
+void io_ring_prep_open(io_ring_sqe_t *sqe, char *path, int flags, int mode);
+void io_ring_prep_close(io_ring_sqe_t *sqe, int fd);
+
+#endif
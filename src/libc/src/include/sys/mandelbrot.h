@@ -4,6 +4,9 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Shared with the kernel so the numbers can't drift apart
+#include "../../../../kernel/include/sys/syscall_list.h"
+
 #define R_OK 0x4
 #define W_OK 0x2
 #define X_OK 0x1
@@ -17,47 +20,37 @@
 #define O_EXEC 0x400000
 #define O_ACCMODE (O_RDONLY | O_WRONLY | O_RDWR)
 
-#define SYSCALL_OPEN 0
-#define SYSCALL_CLOSE 1
-#define SYSCALL_READ 2
-#define SYSCALL_WRITE 3
-#define SYSCALL_EXEC 4
-#define SYSCALL_MMAP 5
-#define SYSCALL_MUNMAP 6
-#define SYSCALL_STAT 7
-#define SYSCALL_FSTAT 8
-#define SYSCALL_GETPID 9
-#define SYSCALL_EXIT 10
-#define SYSCALL_FORK 11
-#define SYSCALL_GETTIMEOFDAY 12
-#define SYSCALL_FSYNC 13
-#define SYSCALL_IOCTL 14
-#define SYSCALL_GETPPID 15
-#define SYSCALL_SEEK 16
-#define SYSCALL_WAITPID 17
-#define SYSCALL_ACCESS 18
-#define SYSCALL_PIPE 19
-#define SYSCALL_FCNTL 20
-#define SYSCALL_REMOVE 21
-
 #define IOCTL_FBDEV_GET_WIDTH 1
 #define IOCTL_FBDEV_GET_HEIGHT 2
 #define IOCTL_FBDEV_GET_BPP 3
 
+#define IOCTL_SCHEDSTAT_RESET 1
+
+#define IOCTL_LOCKSTAT_RESET 1
+
 #define SEEK_SET 0
 #define SEEK_CUR 1
 #define SEEK_END 2
 
-typedef struct mmap_args {
-  void *addr;
-  size_t length;
-  uint64_t flags;
-  uint64_t prot;
-  int fd;
-  size_t offset;
-} mmap_args_t;
-
+// For calling a system call by its number
 uint64_t intsyscall(uint64_t id, uint64_t arg_1, uint64_t arg_2, uint64_t arg_3,
                     uint64_t arg_4, uint64_t arg_5);
 
+// One stub per system call, __syscall_open and so on, see sys/syscalls.c
+#define SYSCALL_PARAMS_0 void
+#define SYSCALL_PARAMS_1 uint64_t
+#define SYSCALL_PARAMS_2 uint64_t, uint64_t
+#define SYSCALL_PARAMS_3 uint64_t, uint64_t, uint64_t
+#define SYSCALL_PARAMS_4 uint64_t, uint64_t, uint64_t, uint64_t
+#define SYSCALL_PARAMS_5 uint64_t, uint64_t, uint64_t, uint64_t, uint64_t
+#define SYSCALL_PARAMS_6                                                       \
+  uint64_t, uint64_t, uint64_t, uint64_t, uint64_t, uint64_t
+
+#define SYSCALL_PROTOTYPE(NUMBER, CONSTANT, NAME, ARGUMENTS)                   \
+  uint64_t __syscall_##NAME(SYSCALL_PARAMS_##ARGUMENTS);
+
+SYSCALL_LIST(SYSCALL_PROTOTYPE)
+
+#undef SYSCALL_PROTOTYPE
+
 #endif
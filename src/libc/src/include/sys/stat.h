@@ -5,6 +5,21 @@
 #include <stdint.h>
 #include <time.h>
 
+#define S_IFMT 0170000
+#define S_IFSOCK 0140000
+#define S_IFLNK 0120000
+#define S_IFREG 0100000
+#define S_IFBLK 060000
+#define S_IFDIR 040000
+#define S_IFCHR 020000
+#define S_IFIFO 010000
+
+#define S_ISBLK(n) (((n)&S_IFMT) == S_IFBLK)
+#define S_ISCHR(n) (((n)&S_IFMT) == S_IFCHR)
+#define S_ISDIR(n) (((n)&S_IFMT) == S_IFDIR)
+#define S_ISFIFO(n) (((n)&S_IFMT) == S_IFIFO)
+#define S_ISREG(n) (((n)&S_IFMT) == S_IFREG)
+
 // TODO/TOFIX: Make this use the correct names and types according to POSIX
 typedef struct stat {
   uint64_t device_id;
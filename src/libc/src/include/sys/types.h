@@ -7,5 +7,6 @@ typedef int64_t off_t;
 typedef int64_t ssize_t;
 typedef int64_t pid_t;
 typedef int mode_t;
+typedef uint32_t useconds_t;
 
 #endif
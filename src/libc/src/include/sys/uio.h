@@ -0,0 +1,19 @@
+#ifndef __UIO_H__
+#define __UIO_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define IOV_MAX 1024
+
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+
+ssize_t readv(int fd, struct iovec *iov, int iovcnt);
+ssize_t writev(int fd, struct iovec *iov, int iovcnt);
+ssize_t preadv(int fd, struct iovec *iov, int iovcnt, off_t offset);
+ssize_t pwritev(int fd, struct iovec *iov, int iovcnt, off_t offset);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef __SYS_VDSO_H__
+#define __SYS_VDSO_H__
+
+#include <stdint.h>
+
+// Shared with the kernel, which maps it into every process
+#include "../../../../kernel/include/sys/vdso_layout.h"
+
+#define VDSO ((vdso_header_t *)VDSO_CODE)
+
+#endif
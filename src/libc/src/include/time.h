@@ -3,10 +3,22 @@
 
 #include <stddef.h>
 
+#define CLOCK_REALTIME 0
+#define CLOCK_MONOTONIC 1
+
+#define TIMER_ABSTIME 1
+
+typedef int clockid_t;
+
 // TODO: Make this use the right types
 typedef struct timespec {
   size_t tv_sec;
   size_t tv_nsec;
 } timespec_t;
 
+int clock_gettime(clockid_t clock, struct timespec *time);
+int nanosleep(struct timespec *request, struct timespec *remain);
+int clock_nanosleep(clockid_t clock, int flags, struct timespec *request,
+                    struct timespec *remain);
+
 #endif
@@ -13,9 +13,14 @@
 #define X_OK 0x1
 #define F_OK 0x0
 
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
 extern char **environ;
 
 int getpagesize();
+pid_t getpid();
 void _exit(int status);
 int dup(int fildes);
 int access(char *pathname, int mode);
@@ -25,5 +30,10 @@ int close(int fd);
 int execve(char *filename, char *argv[], char *envp[]);
 ssize_t read(int fd, void *buf, size_t count);
 ssize_t write(int fd, void *buf, size_t count);
+ssize_t pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t pwrite(int fd, void *buf, size_t count, off_t offset);
+off_t lseek(int fd, off_t offset, int whence);
+unsigned int sleep(unsigned int seconds);
+int usleep(useconds_t usec);
 
 #endif
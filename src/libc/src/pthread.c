@@ -0,0 +1,247 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/futex.h>
+#include <sys/mandelbrot.h>
+#include <sys/mman.h>
+#include <sys/vdso.h>
+
+// Every thread's FS base points at its control block, which starts with a
+// pointer to itself so pthread_self is a single load. A new thread's block
+// sits at the top of its stack mapping. The kernel zeroes exit_word and
+// wakes its futex once the thread is gone, which is what pthread_join
+// waits for.
+//
+// Mutexes and condition variables only make a syscall when some thread
+// actually has to sleep or be woken.
+
+// A contended mutex is spun on this many times before sleeping
+#define PTHREAD_SPIN_COUNT 128
+
+#define ALIGN_UP(A, B) (((A) + (B)-1) & ~((B)-1))
+
+struct pthread {
+  struct pthread *self;
+  int errno_value;
+  volatile uint32_t exit_word;
+  void *(*start)(void *);
+  void *arg;
+  void *retval;
+  void *stack;
+  size_t stack_size;
+};
+
+static struct pthread main_thread = {0};
+
+void __pthread_init() {
+  main_thread.self = &main_thread;
+  main_thread.exit_word = 1;
+  __syscall_set_fs_base((uint64_t)&main_thread);
+}
+
+pthread_t pthread_self() {
+  pthread_t self;
+  asm volatile("mov %%fs:0, %0" : "=r"(self));
+  return self;
+}
+
+int pthread_equal(pthread_t a, pthread_t b) { return a == b; }
+
+int *__errno_location() { return &pthread_self()->errno_value; }
+
+// Waits that end early and wakes that find nobody are fine here, so errno
+// is left alone
+static inline void pthread_futex(volatile uint32_t *word, int op,
+                                 uint32_t value) {
+  __syscall_futex((uint64_t)word, op, value, 0);
+}
+
+int sched_yield() {
+  __syscall_sched_yield();
+  return 0;
+}
+
+// Which CPU this thread was on a moment ago, it can have moved since
+int getcpu(unsigned int *cpu, unsigned int *node) {
+  int (*vdso_getcpu)(unsigned int *, unsigned int *) = (void *)VDSO->getcpu;
+
+  int ret = vdso_getcpu(cpu, node);
+  if (ret < 0) {
+    errno = -ret;
+    return -1;
+  }
+  return 0;
+}
+
+int pthread_attr_init(pthread_attr_t *attr) {
+  attr->stack_size = PTHREAD_STACK_SIZE;
+  return 0;
+}
+
+int pthread_attr_destroy(pthread_attr_t *attr) {
+  (void)attr;
+  return 0;
+}
+
+int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stack_size) {
+  if (stack_size < PTHREAD_STACK_MIN)
+    return EINVAL;
+  attr->stack_size = stack_size;
+  return 0;
+}
+
+static void pthread_start(struct pthread *thread) {
+  pthread_exit(thread->start(thread->arg));
+}
+
+int pthread_create(pthread_t *thread, pthread_attr_t *attr,
+                   void *(*start)(void *), void *arg) {
+  size_t stack_size =
+    ALIGN_UP(attr ? attr->stack_size : PTHREAD_STACK_SIZE, 0x1000);
+
+  uint8_t *stack = mmap(NULL, stack_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (stack == MAP_FAILED)
+    return EAGAIN;
+
+  struct pthread *new_thread =
+    (struct pthread *)(stack + stack_size -
+                       ALIGN_UP(sizeof(struct pthread), 16));
+  *new_thread = (struct pthread){
+    .self = new_thread,
+    .exit_word = 1,
+    .start = start,
+    .arg = arg,
+    .stack = stack,
+    .stack_size = stack_size,
+  };
+
+  // pthread_start is entered as if called, with a null return address
+  uint64_t *rsp = (uint64_t *)new_thread - 1;
+  *rsp = 0;
+
+  int64_t ret =
+    __syscall_thread_create((uint64_t)pthread_start, (uint64_t)new_thread,
+                            (uint64_t)rsp, (uint64_t)new_thread,
+                            (uint64_t)&new_thread->exit_word);
+  if (ret < 0) {
+    munmap(stack, stack_size);
+    return -ret;
+  }
+
+  *thread = new_thread;
+
+  return 0;
+}
+
+void pthread_exit(void *retval) {
+  pthread_self()->retval = retval;
+  __syscall_thread_exit();
+  __builtin_unreachable();
+}
+
+// The control block is on the thread's stack, so it goes away with it
+int pthread_join(pthread_t thread, void **retval) {
+  if (thread == pthread_self())
+    return EDEADLK;
+  if (!thread->stack)
+    return EINVAL;
+
+  uint32_t exit_word;
+  while ((exit_word = thread->exit_word))
+    pthread_futex(&thread->exit_word, FUTEX_WAIT, exit_word);
+
+  if (retval)
+    *retval = thread->retval;
+  munmap(thread->stack, thread->stack_size);
+
+  return 0;
+}
+
+int pthread_mutex_init(pthread_mutex_t *mutex, pthread_mutexattr_t *attr) {
+  (void)attr;
+  mutex->state = 0;
+  return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex) {
+  return mutex->state ? EBUSY : 0;
+}
+
+static inline int pthread_mutex_cas(pthread_mutex_t *mutex, uint32_t from,
+                                    uint32_t to) {
+  return __atomic_compare_exchange_n(&mutex->state, &from, to, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+  return pthread_mutex_cas(mutex, 0, 1) ? 0 : EBUSY;
+}
+
+// The holder may be about to let go, so spin for a bit before marking the
+// mutex contended and sleeping. Whoever takes it after sleeping leaves it
+// marked, since others may still be asleep.
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  if (pthread_mutex_cas(mutex, 0, 1))
+    return 0;
+
+  for (size_t spins = 0; spins < PTHREAD_SPIN_COUNT; spins++) {
+    asm volatile("pause");
+    if (!__atomic_load_n(&mutex->state, __ATOMIC_RELAXED) &&
+        pthread_mutex_cas(mutex, 0, 1))
+      return 0;
+  }
+
+  while (__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE))
+    pthread_futex(&mutex->state, FUTEX_WAIT, 2);
+
+  return 0;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+  if (__atomic_exchange_n(&mutex->state, 0, __ATOMIC_RELEASE) == 2)
+    pthread_futex(&mutex->state, FUTEX_WAKE, 0);
+  return 0;
+}
+
+int pthread_cond_init(pthread_cond_t *cond, pthread_condattr_t *attr) {
+  (void)attr;
+  cond->sequence = 0;
+  cond->waiters = 0;
+  return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond) {
+  return cond->waiters ? EBUSY : 0;
+}
+
+// The sequence is read before the mutex is dropped, so a signal sent after
+// that makes the futex wait return straight away. A signal can wake more
+// than one waiter, which POSIX allows as a spurious wakeup.
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+  __atomic_add_fetch(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+  uint32_t sequence = __atomic_load_n(&cond->sequence, __ATOMIC_SEQ_CST);
+
+  pthread_mutex_unlock(mutex);
+  pthread_futex(&cond->sequence, FUTEX_WAIT, sequence);
+  __atomic_sub_fetch(&cond->waiters, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(mutex);
+
+  return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *cond) {
+  __atomic_add_fetch(&cond->sequence, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST))
+    pthread_futex(&cond->sequence, FUTEX_WAKE, 0);
+  return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t *cond) {
+  __atomic_add_fetch(&cond->sequence, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&cond->waiters, __ATOMIC_SEQ_CST))
+    pthread_futex(&cond->sequence, FUTEX_WAKE_N, UINT32_MAX);
+  return 0;
+}
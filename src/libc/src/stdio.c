@@ -1,10 +1,13 @@
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mandelbrot.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <wchar.h>
 
@@ -12,6 +15,9 @@ FILE *stdin;
 FILE *stdout;
 FILE *stderr;
 
+// Every open stream, so fflush(NULL) and exit can find them
+static FILE *__open_files = NULL;
+
 static char *__int_str(intmax_t i, char b[], int base, int plusSignIfNeeded,
                        int spaceSignIfNeeded, int paddingNo, int justify,
                        int zeroPad) {
@@ -78,17 +84,18 @@ static char *__int_str(intmax_t i, char b[], int base, int plusSignIfNeeded,
   return b;
 }
 
-static void displayCharacter(int fd, char c, int *a) {
-  write(fd, &c, 1);
+static void displayCharacter(FILE *stream, char c, int *a) {
+  fputc(c, stream);
   *a += 1;
 }
 
-static void displayString(int fd, char *c, int *a) {
-  write(fd, c, strlen(c));
-  *a += strlen(c);
+static void displayString(FILE *stream, char *c, int *a) {
+  size_t len = strlen(c);
+  fwrite(c, 1, len, stream);
+  *a += len;
 }
 
-static int __int_vprintf(int fd, const char *format, va_list list) {
+static int __int_vprintf(FILE *stream, const char *format, va_list list) {
   int chars = 0;
   char intStrBuffer[256] = {0};
 
@@ -195,7 +202,7 @@ static int __int_vprintf(int fd, const char *format, va_list list) {
         base = 8;
         specifier = 'u';
         if (altForm) {
-          displayString(fd, "0", &chars);
+          displayString(stream, "0", &chars);
         }
       }
       if (specifier == 'p') {
@@ -209,7 +216,7 @@ static int __int_vprintf(int fd, const char *format, va_list list) {
         case 'x':
           base = base == 10 ? 17 : base;
           if (altForm) {
-            displayString(fd, "0x", &chars);
+            displayString(stream, "0x", &chars);
           }
 
         case 'u': {
@@ -218,56 +225,56 @@ static int __int_vprintf(int fd, const char *format, va_list list) {
               unsigned int integer = va_arg(list, unsigned int);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 'H': {
               unsigned char integer = (unsigned char)va_arg(list, unsigned int);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 'h': {
               unsigned short int integer = va_arg(list, unsigned int);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 'l': {
               unsigned long integer = va_arg(list, unsigned long);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 'q': {
               unsigned long long integer = va_arg(list, unsigned long long);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 'j': {
               uintmax_t integer = va_arg(list, uintmax_t);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 'z': {
               size_t integer = va_arg(list, size_t);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 't': {
               ptrdiff_t integer = va_arg(list, ptrdiff_t);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             default:
@@ -283,56 +290,56 @@ static int __int_vprintf(int fd, const char *format, va_list list) {
               int integer = va_arg(list, int);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 'H': {
               signed char integer = (signed char)va_arg(list, int);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 'h': {
               short int integer = va_arg(list, int);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 'l': {
               long integer = va_arg(list, long);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 'q': {
               long long integer = va_arg(list, long long);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 'j': {
               intmax_t integer = va_arg(list, intmax_t);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 'z': {
               size_t integer = va_arg(list, size_t);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             case 't': {
               ptrdiff_t integer = va_arg(list, ptrdiff_t);
               __int_str(integer, intStrBuffer, base, plusSign, spaceNoSign,
                         lengthSpec, leftJustify, zeroPad);
-              displayString(fd, intStrBuffer, &chars);
+              displayString(stream, intStrBuffer, &chars);
               break;
             }
             default:
@@ -343,16 +350,16 @@ static int __int_vprintf(int fd, const char *format, va_list list) {
 
         case 'c': {
           if (length == 'l') {
-            displayCharacter(fd, va_arg(list, wint_t), &chars);
+            displayCharacter(stream, va_arg(list, wint_t), &chars);
           } else {
-            displayCharacter(fd, va_arg(list, int), &chars);
+            displayCharacter(stream, va_arg(list, int), &chars);
           }
 
           break;
         }
 
         case 's': {
-          displayString(fd, va_arg(list, char *), &chars);
+          displayString(stream, va_arg(list, char *), &chars);
           break;
         }
 
@@ -419,7 +426,7 @@ static int __int_vprintf(int fd, const char *format, va_list list) {
           __int_str(floating, intStrBuffer, base, plusSign, spaceNoSign, form,
                     leftJustify, zeroPad);
 
-          displayString(fd, intStrBuffer, &chars);
+          displayString(stream, intStrBuffer, &chars);
 
           floating -= (int)floating;
 
@@ -429,12 +436,12 @@ static int __int_vprintf(int fd, const char *format, va_list list) {
           intmax_t decPlaces = (intmax_t)(floating + 0.5);
 
           if (precSpec) {
-            displayCharacter(fd, '.', &chars);
+            displayCharacter(stream, '.', &chars);
             __int_str(decPlaces, intStrBuffer, 10, 0, 0, 0, 0, 0);
             intStrBuffer[precSpec] = 0;
-            displayString(fd, intStrBuffer, &chars);
+            displayString(stream, intStrBuffer, &chars);
           } else if (altForm) {
-            displayCharacter(fd, '.', &chars);
+            displayCharacter(stream, '.', &chars);
           }
 
           break;
@@ -450,33 +457,436 @@ static int __int_vprintf(int fd, const char *format, va_list list) {
       }
 
       if (specifier == 'e') {
-        displayString(fd, "e+", &chars);
+        displayString(stream, "e+", &chars);
       } else if (specifier == 'E') {
-        displayString(fd, "E+", &chars);
+        displayString(stream, "E+", &chars);
       }
 
       if (specifier == 'e' || specifier == 'E') {
         __int_str(expo, intStrBuffer, 10, 0, 0, 2, 0, 1);
-        displayString(fd, intStrBuffer, &chars);
+        displayString(stream, intStrBuffer, &chars);
       }
 
     } else {
-      displayCharacter(fd, format[i], &chars);
+      displayCharacter(stream, format[i], &chars);
     }
   }
 
   return chars;
 }
 
-int vprintf(int fd, const char *format, va_list args) {
-  int i = __int_vprintf(fd, format, args);
-  return i;
+static int __stdio_parse_mode(char *mode) {
+  int flags;
+
+  switch (*mode) {
+    case 'r':
+      flags = __FILE_READ;
+      break;
+    case 'w':
+      flags = __FILE_WRITE;
+      break;
+    case 'a':
+      flags = __FILE_WRITE | __FILE_APPEND;
+      break;
+    default:
+      return 0;
+  }
+
+  for (mode++; *mode; mode++)
+    if (*mode == '+')
+      flags |= __FILE_READ | __FILE_WRITE;
+
+  return flags;
+}
+
+static FILE *__stdio_new(int fd, int flags) {
+  FILE *stream = malloc(sizeof(FILE));
+  if (!stream) {
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  // Terminals get their output a line at a time, everything else waits for
+  // a full buffer
+  struct stat st;
+  int mode = (!fstat(fd, &st) && S_ISCHR(st.file_mode)) ? _IOLBF : _IOFBF;
+
+  *stream = (FILE){
+    .fd = fd,
+    .flags = flags,
+    .mode = mode,
+    .buf = NULL,
+    .buf_size = BUFSIZ,
+    .buf_pos = 0,
+    .buf_len = 0,
+    .next = __open_files,
+  };
+  __open_files = stream;
+
+  return stream;
+}
+
+// Buffers are only allocated on first use, so a setvbuf straight after
+// opening never wastes one
+static int __stdio_get_buf(FILE *stream) {
+  if (stream->buf || stream->mode == _IONBF)
+    return 0;
+
+  stream->buf = malloc(stream->buf_size);
+  if (!stream->buf) {
+    stream->mode = _IONBF;
+    return 0;
+  }
+
+  stream->flags |= __FILE_OWN_BUF;
+  return 0;
+}
+
+static int __stdio_write_out(FILE *stream, unsigned char *buf, size_t len) {
+  while (len) {
+    ssize_t written = write(stream->fd, buf, len);
+    if (written <= 0) {
+      stream->flags |= __FILE_ERR;
+      return EOF;
+    }
+    buf += written;
+    len -= written;
+  }
+  return 0;
 }
 
-int fprintf(int fd, const char *format, ...) {
+static int __stdio_flush_one(FILE *stream) {
+  int ret = 0;
+
+  if (stream->flags & __FILE_WRITING) {
+    ret = __stdio_write_out(stream, stream->buf, stream->buf_pos);
+  } else if (stream->flags & __FILE_READING &&
+             stream->buf_pos < stream->buf_len) {
+    // Give back what we read ahead so the fd offset matches the stream.
+    // Pipes and terminals can't seek, and there it's simply dropped.
+    lseek(stream->fd, -(off_t)(stream->buf_len - stream->buf_pos), SEEK_CUR);
+  }
+
+  stream->flags &= ~(__FILE_READING | __FILE_WRITING);
+  stream->buf_pos = stream->buf_len = 0;
+
+  return ret;
+}
+
+int fflush(FILE *stream) {
+  if (stream)
+    return __stdio_flush_one(stream);
+
+  int ret = 0;
+  for (FILE *file = __open_files; file; file = file->next)
+    if (file->flags & __FILE_WRITING && __stdio_flush_one(file))
+      ret = EOF;
+  return ret;
+}
+
+static int __stdio_to_write(FILE *stream) {
+  if (!(stream->flags & __FILE_WRITE)) {
+    stream->flags |= __FILE_ERR;
+    errno = EBADF;
+    return EOF;
+  }
+
+  if (!(stream->flags & __FILE_WRITING)) {
+    __stdio_flush_one(stream);
+    if (stream->flags & __FILE_APPEND)
+      lseek(stream->fd, 0, SEEK_END);
+    stream->flags |= __FILE_WRITING;
+  }
+
+  return __stdio_get_buf(stream);
+}
+
+static int __stdio_to_read(FILE *stream) {
+  if (!(stream->flags & __FILE_READ)) {
+    stream->flags |= __FILE_ERR;
+    errno = EBADF;
+    return EOF;
+  }
+
+  if (!(stream->flags & __FILE_READING)) {
+    __stdio_flush_one(stream);
+    stream->flags |= __FILE_READING;
+  }
+
+  return __stdio_get_buf(stream);
+}
+
+// Anything waiting in a line buffered stream (a prompt, usually) has to be
+// out before we block on input
+static void __stdio_flush_lines() {
+  for (FILE *file = __open_files; file; file = file->next)
+    if (file->mode == _IOLBF && file->flags & __FILE_WRITING)
+      __stdio_flush_one(file);
+}
+
+static int __stdio_fill(FILE *stream) {
+  __stdio_flush_lines();
+
+  ssize_t len = read(stream->fd, stream->buf, stream->buf_size);
+  if (len <= 0) {
+    stream->flags |= len ? __FILE_ERR : __FILE_EOF;
+    return EOF;
+  }
+
+  stream->buf_pos = 0;
+  stream->buf_len = len;
+  return 0;
+}
+
+FILE *fdopen(int fd, char *mode) {
+  int flags = __stdio_parse_mode(mode);
+  if (!flags) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return __stdio_new(fd, flags);
+}
+
+// There is no O_TRUNC or O_APPEND, so "w" doesn't truncate and "a" is done
+// by seeking to the end before each write
+FILE *fopen(char *path, char *mode) {
+  int flags = __stdio_parse_mode(mode);
+  if (!flags) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  int oflags;
+  if ((flags & (__FILE_READ | __FILE_WRITE)) == (__FILE_READ | __FILE_WRITE))
+    oflags = O_RDWR;
+  else if (flags & __FILE_WRITE)
+    oflags = O_WRONLY;
+  else
+    oflags = O_RDONLY;
+
+  int fd;
+  if (*mode != 'r')
+    fd = open(path, oflags | O_CREAT, 0666);
+  else
+    fd = open(path, oflags);
+
+  if (fd < 0)
+    return NULL;
+
+  FILE *stream = __stdio_new(fd, flags);
+  if (!stream)
+    close(fd);
+
+  return stream;
+}
+
+int fclose(FILE *stream) {
+  int ret = __stdio_flush_one(stream);
+
+  if (close(stream->fd) < 0)
+    ret = EOF;
+
+  for (FILE **file = &__open_files; *file; file = &(*file)->next)
+    if (*file == stream) {
+      *file = stream->next;
+      break;
+    }
+
+  if (stream->flags & __FILE_OWN_BUF)
+    free(stream->buf);
+  free(stream);
+
+  return ret;
+}
+
+int setvbuf(FILE *stream, char *buf, int mode, size_t size) {
+  if (mode != _IOFBF && mode != _IOLBF && mode != _IONBF)
+    return EOF;
+
+  __stdio_flush_one(stream);
+
+  if (stream->flags & __FILE_OWN_BUF)
+    free(stream->buf);
+  stream->flags &= ~__FILE_OWN_BUF;
+
+  stream->mode = mode;
+  stream->buf = (unsigned char *)buf;
+  stream->buf_size = (buf && size) ? size : BUFSIZ;
+
+  return 0;
+}
+
+void setbuf(FILE *stream, char *buf) {
+  setvbuf(stream, buf, buf ? _IOFBF : _IONBF, BUFSIZ);
+}
+
+int fileno(FILE *stream) { return stream->fd; }
+
+int feof(FILE *stream) { return !!(stream->flags & __FILE_EOF); }
+
+int ferror(FILE *stream) { return !!(stream->flags & __FILE_ERR); }
+
+void clearerr(FILE *stream) { stream->flags &= ~(__FILE_EOF | __FILE_ERR); }
+
+size_t fwrite(void *ptr, size_t size, size_t nmemb, FILE *stream) {
+  size_t len = size * nmemb;
+  unsigned char *data = ptr;
+
+  if (!len || __stdio_to_write(stream))
+    return 0;
+
+  if (stream->mode == _IONBF)
+    return __stdio_write_out(stream, data, len) ? 0 : nmemb;
+
+  // Too big to be worth copying, send it along with whatever is queued
+  if (len >= stream->buf_size) {
+    if (__stdio_write_out(stream, stream->buf, stream->buf_pos) ||
+        __stdio_write_out(stream, data, len))
+      return 0;
+    stream->buf_pos = 0;
+    return nmemb;
+  }
+
+  size_t done = 0;
+  while (done < len) {
+    if (stream->buf_pos == stream->buf_size) {
+      if (__stdio_write_out(stream, stream->buf, stream->buf_pos))
+        return done / size;
+      stream->buf_pos = 0;
+    }
+
+    size_t chunk = stream->buf_size - stream->buf_pos;
+    if (chunk > len - done)
+      chunk = len - done;
+
+    memcpy(stream->buf + stream->buf_pos, data + done, chunk);
+    stream->buf_pos += chunk;
+    done += chunk;
+  }
+
+  if (stream->mode == _IOLBF && memchr(data, '\n', len)) {
+    if (__stdio_write_out(stream, stream->buf, stream->buf_pos))
+      return 0;
+    stream->buf_pos = 0;
+  }
+
+  return nmemb;
+}
+
+size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream) {
+  size_t len = size * nmemb;
+  unsigned char *data = ptr;
+
+  if (!len || __stdio_to_read(stream))
+    return 0;
+
+  size_t done = 0;
+  while (done < len) {
+    size_t avail = stream->buf_len - stream->buf_pos;
+
+    if (avail) {
+      if (avail > len - done)
+        avail = len - done;
+      memcpy(data + done, stream->buf + stream->buf_pos, avail);
+      stream->buf_pos += avail;
+      done += avail;
+      continue;
+    }
+
+    // Big reads skip the buffer entirely
+    if (stream->mode == _IONBF || len - done >= stream->buf_size) {
+      __stdio_flush_lines();
+
+      ssize_t got = read(stream->fd, data + done, len - done);
+      if (got <= 0) {
+        stream->flags |= got ? __FILE_ERR : __FILE_EOF;
+        break;
+      }
+      done += got;
+      continue;
+    }
+
+    if (__stdio_fill(stream))
+      break;
+  }
+
+  return done / size;
+}
+
+int fgetc(FILE *stream) {
+  if (stream->flags & __FILE_READING && stream->buf_pos < stream->buf_len)
+    return stream->buf[stream->buf_pos++];
+
+  unsigned char c;
+  return fread(&c, 1, 1, stream) ? c : EOF;
+}
+
+int getc(FILE *stream) { return fgetc(stream); }
+
+int getchar() { return fgetc(stdin); }
+
+int fputc(int c, FILE *stream) {
+  if (stream->flags & __FILE_WRITING && stream->mode != _IONBF &&
+      stream->buf_pos < stream->buf_size) {
+    stream->buf[stream->buf_pos++] = c;
+    if (stream->mode == _IOLBF && c == '\n' &&
+        __stdio_flush_one(stream) == EOF)
+      return EOF;
+    return (unsigned char)c;
+  }
+
+  unsigned char ch = c;
+  return fwrite(&ch, 1, 1, stream) ? ch : EOF;
+}
+
+int putc(int c, FILE *stream) { return fputc(c, stream); }
+
+int putchar(int c) { return fputc(c, stdout); }
+
+int fputs(char *s, FILE *stream) {
+  size_t len = strlen(s);
+  return (fwrite(s, 1, len, stream) == len) ? 0 : EOF;
+}
+
+int puts(char *s) {
+  if (fputs(s, stdout) == EOF)
+    return EOF;
+  return fputc('\n', stdout) == EOF ? EOF : 0;
+}
+
+char *fgets(char *s, int size, FILE *stream) {
+  int i = 0;
+
+  while (i < size - 1) {
+    int c = fgetc(stream);
+    if (c == EOF)
+      break;
+    s[i++] = c;
+    if (c == '\n')
+      break;
+  }
+
+  if (!i)
+    return NULL;
+
+  s[i] = 0;
+  return s;
+}
+
+int vfprintf(FILE *stream, const char *format, va_list args) {
+  return __int_vprintf(stream, format, args);
+}
+
+int vprintf(const char *format, va_list args) {
+  return __int_vprintf(stdout, format, args);
+}
+
+__attribute__((format(printf, 2, 3))) int fprintf(FILE *stream,
+                                                  const char *format, ...) {
   va_list list;
   va_start(list, format);
-  int i = __int_vprintf(fd, format, list);
+  int i = __int_vprintf(stream, format, list);
   va_end(list);
   return i;
 }
@@ -484,26 +894,20 @@ int fprintf(int fd, const char *format, ...) {
 __attribute__((format(printf, 1, 2))) int printf(const char *format, ...) {
   va_list list;
   va_start(list, format);
-  int i = __int_vprintf(STDOUT_FILENO, format, list);
+  int i = __int_vprintf(stdout, format, list);
   va_end(list);
   return i;
 }
 
 void perror(char *str) {
   if (str && str[0])
-    fprintf(STDERR_FILENO, "%s: %s\n", str, __sys_errlist[errno]);
+    fprintf(stderr, "%s: %s\n", str, __sys_errlist[errno]);
   else
-    fprintf(STDERR_FILENO, "%s\n", __sys_errlist[errno]);
-}
-
-char *fgets(char *s, int size, FILE *stream) {
-  if (read(stream->fd, s, size) < 0)
-    return NULL;
-  return s;
+    fprintf(stderr, "%s\n", __sys_errlist[errno]);
 }
 
 int remove(char *path) {
-  pid_t ret = intsyscall(SYSCALL_REMOVE, (uint64_t)path, 0, 0, 0, 0);
+  pid_t ret = __syscall_remove((uint64_t)path);
   if (ret < 0) {
     errno = -ret;
     return -1;
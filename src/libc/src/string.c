@@ -1,25 +1,62 @@
+#include <cpuid.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+// SSE2 is part of x86_64, so it is the default until __string_init has
+// looked at CPUID. Everything goes through these pointers after that.
+static void (*__memcpy_impl)(void *, void *, size_t) = __memcpy_sse2;
+static void *(*__memset_impl)(void *, char, size_t) = __memset_sse2;
+static size_t (*__strlen_impl)(char *) = __strlen_sse2;
+static void *(*__memchr_impl)(void *, int, size_t) = __memchr_sse2;
+static int (*__memcmp_impl)(void *, void *, size_t) = __memcmp_sse2;
+
+char *__string_variant = "sse2";
+
+static int __cpu_has_avx2() {
+  uint32_t eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    return 0;
+
+  // AVX instructions fault unless the kernel set OSXSAVE and enabled the
+  // SSE and AVX state components in XCR0
+  if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+    return 0;
+
+  uint32_t xcr0_low, xcr0_high;
+  asm volatile("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+  if ((xcr0_low & 0x6) != 0x6)
+    return 0;
+
+  if (__get_cpuid_max(0, NULL) < 7)
+    return 0;
+
+  __cpuid_count(7, 0, eax, ebx, ecx, edx);
+  return !!(ebx & bit_AVX2);
+}
+
+void __string_init() {
+  if (__cpu_has_avx2()) {
+    __memcpy_impl = __memcpy_avx2;
+    __memset_impl = __memset_avx2;
+    __strlen_impl = __strlen_avx2;
+    __memchr_impl = __memchr_avx2;
+    __memcmp_impl = __memcmp_avx2;
+    __string_variant = "avx2";
+  }
+}
+
 char *strchr(char *str, int c) {
   for (; *str && *str != c; str++)
     ;
   return (*str) ? str : (c) ? NULL : str;
 }
 
-size_t strlen(char *s) {
-  size_t i;
-  for (i = 0; s[i] != '\0'; i++)
-    ;
-  return i;
-}
+size_t strlen(char *s) { return __strlen_impl(s); }
 
-void memcpy(void *dest, void *src, size_t n) {
-  for (size_t i = 0; i < n; i++)
-    ((char *)dest)[i] = ((char *)src)[i];
-}
+void memcpy(void *dest, void *src, size_t n) { __memcpy_impl(dest, src, n); }
 
 char *strdup(char *s) {
   char *str = malloc(strlen(s) + 1);
@@ -45,9 +82,21 @@ void strcat(char *dest, char *src) {
 }
 
 void *memset(void *buf, char val, size_t len) {
-  while (len--)
-    ((char *)buf)[len] = val;
-  return buf;
+  return __memset_impl(buf, val, len);
+}
+
+void *memchr(void *buf, int c, size_t len) {
+  return __memchr_impl(buf, c, len);
+}
+
+int memcmp(void *s1, void *s2, size_t n) { return __memcmp_impl(s1, s2, n); }
+
+int strcmp(char *_l, char *_r) {
+  uint8_t *l = (void *)_l;
+  uint8_t *r = (void *)_r;
+  for (; *l && *l == *r; l++, r++)
+    ;
+  return *l - *r;
 }
 
 char *strcpy(char *dest, char *src) {
@@ -0,0 +1,168 @@
+#include <immintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// AVX2 versions of the routines in string_sse2.c, same structure with 32
+// byte vectors. string.c only picks these when the CPU has AVX2 and the
+// kernel has enabled YMM state in XCR0.
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 void __memcpy_avx2(void *dest, void *src, size_t n) {
+  uint8_t *d = dest;
+  uint8_t *s = src;
+
+  if (n < 32) {
+    __memcpy_sse2(dest, src, n);
+    return;
+  }
+
+  __m256i head = _mm256_loadu_si256((__m256i *)s);
+  __m256i tail = _mm256_loadu_si256((__m256i *)(s + n - 32));
+
+  size_t skew = 32 - ((uintptr_t)d & 31);
+  uint8_t *end = d + n - 32;
+  uint8_t *out = d + skew;
+  s += skew;
+
+  if (n >= __STRING_NT_THRESHOLD) {
+    for (; out + 128 <= end; out += 128, s += 128) {
+      __m256i a = _mm256_loadu_si256((__m256i *)s);
+      __m256i b = _mm256_loadu_si256((__m256i *)(s + 32));
+      __m256i c = _mm256_loadu_si256((__m256i *)(s + 64));
+      __m256i e = _mm256_loadu_si256((__m256i *)(s + 96));
+      _mm256_stream_si256((__m256i *)out, a);
+      _mm256_stream_si256((__m256i *)(out + 32), b);
+      _mm256_stream_si256((__m256i *)(out + 64), c);
+      _mm256_stream_si256((__m256i *)(out + 96), e);
+    }
+    _mm_sfence();
+  }
+
+  for (; out < end; out += 32, s += 32)
+    _mm256_store_si256((__m256i *)out, _mm256_loadu_si256((__m256i *)s));
+
+  _mm256_storeu_si256((__m256i *)d, head);
+  _mm256_storeu_si256((__m256i *)end, tail);
+
+  // Avoid the AVX to SSE transition penalty in whatever runs next
+  _mm256_zeroupper();
+}
+
+AVX2 void *__memset_avx2(void *buf, char val, size_t len) {
+  uint8_t *d = buf;
+
+  if (len < 32)
+    return __memset_sse2(buf, val, len);
+
+  __m256i v = _mm256_set1_epi8(val);
+
+  uint8_t *end = d + len - 32;
+  uint8_t *out = d + 32 - ((uintptr_t)d & 31);
+
+  if (len >= __STRING_NT_THRESHOLD) {
+    for (; out + 128 <= end; out += 128) {
+      _mm256_stream_si256((__m256i *)out, v);
+      _mm256_stream_si256((__m256i *)(out + 32), v);
+      _mm256_stream_si256((__m256i *)(out + 64), v);
+      _mm256_stream_si256((__m256i *)(out + 96), v);
+    }
+    _mm_sfence();
+  }
+
+  for (; out < end; out += 32)
+    _mm256_store_si256((__m256i *)out, v);
+
+  _mm256_storeu_si256((__m256i *)d, v);
+  _mm256_storeu_si256((__m256i *)end, v);
+
+  _mm256_zeroupper();
+
+  return buf;
+}
+
+AVX2 size_t __strlen_avx2(char *s) {
+  __m256i zero = _mm256_setzero_si256();
+  char *p = (char *)((uintptr_t)s & ~(uintptr_t)31);
+  size_t len;
+
+  uint32_t mask = _mm256_movemask_epi8(
+    _mm256_cmpeq_epi8(_mm256_load_si256((__m256i *)p), zero));
+  mask >>= s - p;
+
+  if (mask) {
+    len = __builtin_ctz(mask);
+  } else {
+    for (;;) {
+      p += 32;
+      mask = _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_load_si256((__m256i *)p), zero));
+      if (mask)
+        break;
+    }
+    len = p + __builtin_ctz(mask) - s;
+  }
+
+  _mm256_zeroupper();
+
+  return len;
+}
+
+AVX2 void *__memchr_avx2(void *buf, int c, size_t len) {
+  if (!len)
+    return NULL;
+
+  __m256i v = _mm256_set1_epi8(c);
+  uint8_t *s = buf;
+  uint8_t *p = (uint8_t *)((uintptr_t)s & ~(uintptr_t)31);
+  uint8_t *end = s + len;
+  uint8_t *found = NULL;
+
+  uint32_t mask = _mm256_movemask_epi8(
+    _mm256_cmpeq_epi8(_mm256_load_si256((__m256i *)p), v));
+  mask = (uint32_t)((uint64_t)mask >> (s - p) << (s - p));
+
+  for (;;) {
+    if (mask) {
+      found = p + __builtin_ctz(mask);
+      if (found >= end)
+        found = NULL;
+      break;
+    }
+
+    p += 32;
+    if (p >= end)
+      break;
+
+    mask = _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_load_si256((__m256i *)p), v));
+  }
+
+  _mm256_zeroupper();
+
+  return found;
+}
+
+AVX2 int __memcmp_avx2(void *s1, void *s2, size_t n) {
+  uint8_t *l = s1;
+  uint8_t *r = s2;
+  int ret = 0;
+
+  for (; n >= 32; l += 32, r += 32, n -= 32) {
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+      _mm256_loadu_si256((__m256i *)l), _mm256_loadu_si256((__m256i *)r)));
+    if (mask != 0xffffffff) {
+      size_t i = __builtin_ctz(~mask);
+      ret = l[i] - r[i];
+      break;
+    }
+  }
+
+  _mm256_zeroupper();
+
+  if (n < 32)
+    ret = __memcmp_sse2(l, r, n);
+
+  return ret;
+}
@@ -0,0 +1,151 @@
+#include <emmintrin.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// SSE2 versions of the hot string routines. Every x86_64 CPU has SSE2, so
+// these are the baseline the dispatcher in string.c falls back to.
+//
+// The scanning routines (strlen, memchr) only ever do aligned loads, which
+// can't cross into a page the string doesn't touch. They may read past the
+// end of the buffer within that page, and mask the excess off.
+
+void __memcpy_sse2(void *dest, void *src, size_t n) {
+  uint8_t *d = dest;
+  uint8_t *s = src;
+
+  if (n < 16) {
+    while (n--)
+      *d++ = *s++;
+    return;
+  }
+
+  // Head and tail are done with overlapping unaligned moves, the middle
+  // with aligned stores
+  __m128i head = _mm_loadu_si128((__m128i *)s);
+  __m128i tail = _mm_loadu_si128((__m128i *)(s + n - 16));
+
+  size_t skew = 16 - ((uintptr_t)d & 15);
+  uint8_t *end = d + n - 16;
+  uint8_t *out = d + skew;
+  s += skew;
+
+  if (n >= __STRING_NT_THRESHOLD) {
+    for (; out + 64 <= end; out += 64, s += 64) {
+      __m128i a = _mm_loadu_si128((__m128i *)s);
+      __m128i b = _mm_loadu_si128((__m128i *)(s + 16));
+      __m128i c = _mm_loadu_si128((__m128i *)(s + 32));
+      __m128i e = _mm_loadu_si128((__m128i *)(s + 48));
+      _mm_stream_si128((__m128i *)out, a);
+      _mm_stream_si128((__m128i *)(out + 16), b);
+      _mm_stream_si128((__m128i *)(out + 32), c);
+      _mm_stream_si128((__m128i *)(out + 48), e);
+    }
+    _mm_sfence();
+  }
+
+  for (; out < end; out += 16, s += 16)
+    _mm_store_si128((__m128i *)out, _mm_loadu_si128((__m128i *)s));
+
+  _mm_storeu_si128((__m128i *)d, head);
+  _mm_storeu_si128((__m128i *)end, tail);
+}
+
+void *__memset_sse2(void *buf, char val, size_t len) {
+  uint8_t *d = buf;
+
+  if (len < 16) {
+    while (len--)
+      *d++ = val;
+    return buf;
+  }
+
+  __m128i v = _mm_set1_epi8(val);
+
+  uint8_t *end = d + len - 16;
+  uint8_t *out = d + 16 - ((uintptr_t)d & 15);
+
+  if (len >= __STRING_NT_THRESHOLD) {
+    for (; out + 64 <= end; out += 64) {
+      _mm_stream_si128((__m128i *)out, v);
+      _mm_stream_si128((__m128i *)(out + 16), v);
+      _mm_stream_si128((__m128i *)(out + 32), v);
+      _mm_stream_si128((__m128i *)(out + 48), v);
+    }
+    _mm_sfence();
+  }
+
+  for (; out < end; out += 16)
+    _mm_store_si128((__m128i *)out, v);
+
+  _mm_storeu_si128((__m128i *)d, v);
+  _mm_storeu_si128((__m128i *)end, v);
+
+  return buf;
+}
+
+size_t __strlen_sse2(char *s) {
+  __m128i zero = _mm_setzero_si128();
+  char *p = (char *)((uintptr_t)s & ~(uintptr_t)15);
+
+  uint32_t mask =
+    _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((__m128i *)p), zero));
+  mask >>= s - p;
+  if (mask)
+    return __builtin_ctz(mask);
+
+  for (;;) {
+    p += 16;
+    mask =
+      _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((__m128i *)p), zero));
+    if (mask)
+      return p + __builtin_ctz(mask) - s;
+  }
+}
+
+void *__memchr_sse2(void *buf, int c, size_t len) {
+  if (!len)
+    return NULL;
+
+  __m128i v = _mm_set1_epi8(c);
+  uint8_t *s = buf;
+  uint8_t *p = (uint8_t *)((uintptr_t)s & ~(uintptr_t)15);
+  uint8_t *end = s + len;
+
+  uint32_t mask =
+    _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((__m128i *)p), v));
+  mask = (mask >> (s - p)) << (s - p);
+
+  for (;;) {
+    if (mask) {
+      uint8_t *found = p + __builtin_ctz(mask);
+      return (found < end) ? found : NULL;
+    }
+
+    p += 16;
+    if (p >= end)
+      return NULL;
+
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_load_si128((__m128i *)p), v));
+  }
+}
+
+int __memcmp_sse2(void *s1, void *s2, size_t n) {
+  uint8_t *l = s1;
+  uint8_t *r = s2;
+
+  for (; n >= 16; l += 16, r += 16, n -= 16) {
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+      _mm_loadu_si128((__m128i *)l), _mm_loadu_si128((__m128i *)r)));
+    if (mask != 0xffff) {
+      size_t i = __builtin_ctz(~mask);
+      return l[i] - r[i];
+    }
+  }
+
+  for (; n; l++, r++, n--)
+    if (*l != *r)
+      return *l - *r;
+
+  return 0;
+}
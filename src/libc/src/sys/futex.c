@@ -0,0 +1,16 @@
+#include <errno.h>
+#include <stdint.h>
+#include <sys/futex.h>
+#include <sys/mandelbrot.h>
+#include <time.h>
+
+// FUTEX_WAIT sleeps while *word is value, for at most timeout (NULL waits
+// forever). FUTEX_WAKE wakes one waiter, FUTEX_WAKE_N up to value of them.
+int futex(uint32_t *word, int op, uint32_t value, struct timespec *timeout) {
+  int ret = __syscall_futex((uint64_t)word, op, value, (uint64_t)timeout);
+  if (ret < 0) {
+    errno = -ret;
+    return -1;
+  }
+  return ret;
+}
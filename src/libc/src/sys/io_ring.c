@@ -0,0 +1,170 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/io_ring.h>
+#include <sys/mandelbrot.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+int io_ring_setup(io_ring_params_t *params) {
+  int ret = __syscall_io_ring_setup((uint64_t)params);
+  if (ret < 0) {
+    errno = -ret;
+    return -1;
+  }
+  return ret;
+}
+
+// Returns how many SQEs the kernel took, waits for min_complete CQEs with
+// IO_RING_ENTER_GETEVENTS
+int io_ring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+                  unsigned int flags) {
+  int ret = __syscall_io_ring_enter(fd, to_submit, min_complete, flags);
+  if (ret < 0) {
+    errno = -ret;
+    return -1;
+  }
+  return ret;
+}
+
+int io_ring_init(io_ring_t *ring, unsigned int entries, unsigned int flags) {
+  io_ring_params_t params = {
+    .sq_entries = entries,
+    .flags = flags,
+  };
+
+  int fd = io_ring_setup(&params);
+  if (fd < 0)
+    return -1;
+
+  void *map =
+    mmap(NULL, params.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+
+  *ring = (io_ring_t){
+    .fd = fd,
+    .flags = flags,
+    .map = map,
+    .size = params.size,
+    .header = map,
+    .sqes = map + params.sqes_offset,
+    .cqes = map + params.cqes_offset,
+    .sq_tail = 0,
+  };
+
+  return 0;
+}
+
+void io_ring_exit(io_ring_t *ring) {
+  munmap(ring->map, ring->size);
+  close(ring->fd);
+}
+
+// NULL while the SQ is full
+io_ring_sqe_t *io_ring_get_sqe(io_ring_t *ring) {
+  io_ring_header_t *header = ring->header;
+  uint32_t head = __atomic_load_n(&header->sq_head, __ATOMIC_ACQUIRE);
+
+  if (ring->sq_tail - head > header->sq_mask)
+    return NULL;
+
+  io_ring_sqe_t *sqe = &ring->sqes[ring->sq_tail++ & header->sq_mask];
+  memset(sqe, 0, sizeof(io_ring_sqe_t));
+  return sqe;
+}
+
+// Makes the new SQEs visible and enters the kernel if it has to: always
+// without SQPOLL, with it only to wake the worker up or to wait
+int io_ring_submit_and_wait(io_ring_t *ring, unsigned int wait_nr) {
+  io_ring_header_t *header = ring->header;
+  unsigned int submitted = ring->sq_tail - header->sq_tail;
+  unsigned int flags = wait_nr ? IO_RING_ENTER_GETEVENTS : 0;
+
+  __atomic_store_n(&header->sq_tail, ring->sq_tail, __ATOMIC_SEQ_CST);
+
+  if (ring->flags & IO_RING_SETUP_SQPOLL) {
+    if (__atomic_load_n(&header->sq_flags, __ATOMIC_SEQ_CST) &
+        IO_RING_SQ_NEED_WAKEUP)
+      flags |= IO_RING_ENTER_SQ_WAKEUP;
+    if (!flags)
+      return submitted;
+  } else if (!submitted && !flags) {
+    return 0;
+  }
+
+  if (io_ring_enter(ring->fd, submitted, wait_nr, flags) < 0)
+    return -1;
+  return submitted;
+}
+
+int io_ring_submit(io_ring_t *ring) { return io_ring_submit_and_wait(ring, 0); }
+
+// -1 with errno EAGAIN if there's no CQE yet
+int io_ring_peek_cqe(io_ring_t *ring, io_ring_cqe_t **cqe) {
+  io_ring_header_t *header = ring->header;
+  uint32_t head = header->cq_head;
+
+  if (head == __atomic_load_n(&header->cq_tail, __ATOMIC_ACQUIRE)) {
+    errno = EAGAIN;
+    return -1;
+  }
+
+  *cqe = &ring->cqes[head & header->cq_mask];
+  return 0;
+}
+
+int io_ring_wait_cqe(io_ring_t *ring, io_ring_cqe_t **cqe) {
+  while (io_ring_peek_cqe(ring, cqe))
+    if (io_ring_enter(ring->fd, 0, 1, IO_RING_ENTER_GETEVENTS) < 0)
+      return -1;
+  return 0;
+}
+
+// Hands the CQE from peek or wait back to the kernel
+void io_ring_cqe_seen(io_ring_t *ring) {
+  __atomic_store_n(&ring->header->cq_head, ring->header->cq_head + 1,
+                   __ATOMIC_RELEASE);
+}
+
+static void io_ring_prep_rw(io_ring_sqe_t *sqe, int opcode, int fd, void *buf,
+                            unsigned int len, off_t offset) {
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uint64_t)buf;
+  sqe->len = len;
+  sqe->offset = offset;
+}
+
+// An offset of -1 goes from the file's own offset and moves it along
+void io_ring_prep_read(io_ring_sqe_t *sqe, int fd, void *buf, unsigned int len,
+                       off_t offset) {
+  io_ring_prep_rw(sqe, IO_RING_OP_READ, fd, buf, len, offset);
+}
+
+void io_ring_prep_write(io_ring_sqe_t *sqe, int fd, void *buf,
+                        unsigned int len, off_t offset) {
+  io_ring_prep_rw(sqe, IO_RING_OP_WRITE, fd, buf, len, offset);
+}
+
+void io_ring_prep_fsync(io_ring_sqe_t *sqe, int fd) {
+  sqe->opcode = IO_RING_OP_FSYNC;
+  sqe->fd = fd;
+}
+
+// The CQE's res is the new fd
+void io_ring_prep_open(io_ring_sqe_t *sqe, char *path, int flags, int mode) {
+  sqe->opcode = IO_RING_OP_OPEN;
+  sqe->addr = (uint64_t)path;
+  sqe->open_flags = flags;
+  sqe->mode = mode;
+}
+
+void io_ring_prep_close(io_ring_sqe_t *sqe, int fd) {
+  sqe->opcode = IO_RING_OP_CLOSE;
+  sqe->fd = fd;
+}
@@ -6,7 +6,7 @@
 
 int ioctl(int d, int request,
           void *arg) { // TODO: This is not compliant to the standard
-  int ret = intsyscall(SYSCALL_IOCTL, d, request, (uint64_t)arg, 0, 0);
+  int ret = __syscall_ioctl(d, request, (uint64_t)arg);
   if (ret < 0) {
     errno = -ret;
     return -1;
@@ -0,0 +1,271 @@
+#include <stddef.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Size class allocator. Small requests are rounded up to one of
+// MALLOC_CLASSES sizes and carved out of MALLOC_SPAN_SIZE spans, each span
+// only ever holding blocks of one class. Anything bigger than the largest
+// class gets its own mapping. All the state lives in a malloc_heap_t, so
+// giving each thread its own heap later only means changing malloc_heap_get.
+// Until then threads take turns on the one heap behind its lock.
+
+#define MALLOC_MAGIC 0x6d616c63
+#define MALLOC_DEAD 0x64656164
+
+#define MALLOC_CLASSES 24
+#define MALLOC_MAX_SMALL 2048
+#define MALLOC_LARGE 0xffffffff
+
+#define MALLOC_SPAN_SIZE 0x10000
+
+#define ALIGN_UP(A, B) (((A) + (B)-1) & ~((B)-1))
+
+struct malloc_span;
+
+// Sits in front of every pointer we hand out. Kept at 16 bytes so user
+// pointers stay 16 byte aligned.
+typedef struct malloc_block {
+  union {
+    struct malloc_span *span; // Small blocks
+    size_t length;            // Large blocks, the size of the mapping
+  };
+  uint32_t size_class;
+  uint32_t magic;
+} malloc_block_t;
+
+typedef struct malloc_free {
+  struct malloc_free *next;
+} malloc_free_t;
+
+typedef struct malloc_span {
+  struct malloc_span *next;
+  struct malloc_span *prev;
+  malloc_free_t *free_list;
+  uint32_t size_class;
+  uint32_t used;
+  uint32_t capacity;
+  uint32_t carved;
+} malloc_span_t;
+
+typedef struct malloc_heap {
+  // Spans that still have room, per class. Full spans are dropped from the
+  // list and put back once something in them is freed.
+  malloc_span_t *partial[MALLOC_CLASSES];
+  pthread_mutex_t lock;
+} malloc_heap_t;
+
+#define MALLOC_SPAN_HEADER ALIGN_UP(sizeof(malloc_span_t), 16)
+
+static const uint32_t malloc_class_sizes[MALLOC_CLASSES] = {
+  16,  32,  48,  64,  80,  96,   112,  128,  160,  192,  224,  256,
+  320, 384, 448, 512, 640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+};
+
+static malloc_heap_t main_heap = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static inline malloc_heap_t *malloc_heap_get() { return &main_heap; }
+
+static inline void malloc_heap_lock(malloc_heap_t *heap) {
+  pthread_mutex_lock(&heap->lock);
+}
+
+static inline void malloc_heap_unlock(malloc_heap_t *heap) {
+  pthread_mutex_unlock(&heap->lock);
+}
+
+// 16 byte steps up to 128, then four classes per power of two
+static inline uint32_t malloc_size_class(size_t size) {
+  if (size <= 128)
+    return (size + 15) / 16 - 1;
+
+  uint32_t log = 63 - __builtin_clzll(size - 1);
+  return 8 + (log - 7) * 4 + ((size - 1) >> (log - 2)) - 4;
+}
+
+static inline malloc_block_t *malloc_span_block(malloc_span_t *span,
+                                                size_t index) {
+  return (malloc_block_t *)((uint8_t *)span + MALLOC_SPAN_HEADER +
+                            index * (sizeof(malloc_block_t) +
+                                     malloc_class_sizes[span->size_class]));
+}
+
+static void malloc_span_push(malloc_heap_t *heap, malloc_span_t *span) {
+  span->prev = NULL;
+  span->next = heap->partial[span->size_class];
+  if (span->next)
+    span->next->prev = span;
+  heap->partial[span->size_class] = span;
+}
+
+static void malloc_span_unlink(malloc_heap_t *heap, malloc_span_t *span) {
+  if (span->prev)
+    span->prev->next = span->next;
+  else
+    heap->partial[span->size_class] = span->next;
+
+  if (span->next)
+    span->next->prev = span->prev;
+
+  span->next = span->prev = NULL;
+}
+
+static malloc_span_t *malloc_span_new(malloc_heap_t *heap,
+                                      uint32_t size_class) {
+  malloc_span_t *span = mmap(NULL, MALLOC_SPAN_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (span == MAP_FAILED)
+    return NULL;
+
+  *span = (malloc_span_t){
+    .free_list = NULL,
+    .size_class = size_class,
+    .used = 0,
+    .capacity = (MALLOC_SPAN_SIZE - MALLOC_SPAN_HEADER) /
+                (sizeof(malloc_block_t) + malloc_class_sizes[size_class]),
+    .carved = 0,
+  };
+
+  malloc_span_push(heap, span);
+
+  return span;
+}
+
+static void *malloc_large(size_t size) {
+  size_t length = ALIGN_UP(size + sizeof(malloc_block_t), 0x1000);
+
+  malloc_block_t *block = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANON, -1, 0);
+  if (block == MAP_FAILED)
+    return NULL;
+
+  block->length = length;
+  block->size_class = MALLOC_LARGE;
+  block->magic = MALLOC_MAGIC;
+
+  return block + 1;
+}
+
+static size_t malloc_usable_size(malloc_block_t *block) {
+  if (block->size_class == MALLOC_LARGE)
+    return block->length - sizeof(malloc_block_t);
+  return malloc_class_sizes[block->size_class];
+}
+
+void *malloc(size_t size) {
+  if (!size)
+    size = 1;
+
+  if (size > MALLOC_MAX_SMALL)
+    return malloc_large(size);
+
+  malloc_heap_t *heap = malloc_heap_get();
+  uint32_t size_class = malloc_size_class(size);
+
+  malloc_heap_lock(heap);
+
+  malloc_span_t *span = heap->partial[size_class];
+  if (!span) {
+    span = malloc_span_new(heap, size_class);
+    if (!span) {
+      malloc_heap_unlock(heap);
+      return NULL;
+    }
+  }
+
+  malloc_block_t *block;
+  if (span->free_list) {
+    block = (malloc_block_t *)span->free_list - 1;
+    span->free_list = span->free_list->next;
+  } else
+    block = malloc_span_block(span, span->carved++);
+
+  block->span = span;
+  block->size_class = size_class;
+  block->magic = MALLOC_MAGIC;
+
+  if (++span->used == span->capacity)
+    malloc_span_unlink(heap, span);
+
+  malloc_heap_unlock(heap);
+
+  return block + 1;
+}
+
+void free(void *ptr) {
+  if (!ptr)
+    return;
+
+  malloc_block_t *block = (malloc_block_t *)ptr - 1;
+  if (block->magic != MALLOC_MAGIC)
+    return;
+
+  block->magic = MALLOC_DEAD;
+
+  if (block->size_class == MALLOC_LARGE) {
+    munmap(block, block->length);
+    return;
+  }
+
+  malloc_heap_t *heap = malloc_heap_get();
+  malloc_span_t *span = block->span;
+
+  malloc_heap_lock(heap);
+
+  if (span->used == span->capacity)
+    malloc_span_push(heap, span);
+
+  malloc_free_t *entry = ptr;
+  entry->next = span->free_list;
+  span->free_list = entry;
+
+  // Give the pages back once a span empties, unless it's the last one this
+  // class has. Keeping that one around stops a malloc/free loop from
+  // mapping and unmapping a span on every call.
+  if (!--span->used && (span->prev || span->next)) {
+    malloc_span_unlink(heap, span);
+    munmap(span, MALLOC_SPAN_SIZE);
+  }
+
+  malloc_heap_unlock(heap);
+}
+
+void *calloc(size_t size, size_t size2) {
+  size_t total;
+  if (__builtin_mul_overflow(size, size2, &total))
+    return NULL;
+
+  void *ptr = malloc(total);
+  if (ptr)
+    memset(ptr, 0, total);
+  return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+  if (!ptr)
+    return malloc(size);
+
+  if (!size) {
+    free(ptr);
+    return NULL;
+  }
+
+  malloc_block_t *block = (malloc_block_t *)ptr - 1;
+  if (block->magic != MALLOC_MAGIC)
+    return NULL;
+
+  size_t old_size = malloc_usable_size(block);
+  if (size <= old_size)
+    return ptr;
+
+  void *new_ptr = malloc(size);
+  if (!new_ptr)
+    return NULL;
+
+  memcpy(new_ptr, ptr, old_size);
+  free(ptr);
+
+  return new_ptr;
+}
@@ -1,5 +1,13 @@
 global intsyscall
 
+; The number goes in rax and the arguments move down a register. SYSCALL
+; takes the return address in rcx, so the fourth argument goes in r10.
 intsyscall:
-  int 0x45
+  mov rax, rdi
+  mov rdi, rsi
+  mov rsi, rdx
+  mov rdx, rcx
+  mov r10, r8
+  mov r8, r9
+  syscall
   ret
@@ -7,15 +7,8 @@
 
 void *mmap(void *addr, size_t length, int prot, int flags, int fd,
            off_t offset) {
-  mmap_args_t args = (mmap_args_t){
-    .addr = addr,
-    .length = length,
-    .prot = prot,
-    .flags = flags,
-    .fd = fd,
-    .offset = offset,
-  };
-  void *ret = (void *)intsyscall(SYSCALL_MMAP, (uint64_t)&args, 0, 0, 0, 0);
+  void *ret = (void *)__syscall_mmap((uint64_t)addr, length, prot, flags, fd,
+                                     offset);
   if ((int64_t)ret < (int64_t)0) {
     errno = -(int64_t)ret;
     return MAP_FAILED;
@@ -24,7 +17,7 @@ void *mmap(void *addr, size_t length, int prot, int flags, int fd,
 }
 
 int munmap(void *addr, size_t length) {
-  int ret = intsyscall(SYSCALL_MUNMAP, (uint64_t)addr, length, 0, 0, 0);
+  int ret = __syscall_munmap((uint64_t)addr, length);
   if (ret < 0) {
     errno = -ret;
     return -1;
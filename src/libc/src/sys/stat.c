@@ -4,7 +4,7 @@
 #include <sys/stat.h>
 
 int fstat(int fd, struct stat *statbuf) {
-  int ret = intsyscall(SYSCALL_FSTAT, fd, (uint64_t)statbuf, 0, 0, 0);
+  int ret = __syscall_fstat(fd, (uint64_t)statbuf);
   if (ret < 0) {
     errno = -ret;
     return -1;
@@ -0,0 +1,16 @@
+#include <stdint.h>
+#include <sys/mandelbrot.h>
+
+// The stubs behind the prototypes in sys/mandelbrot.h, one per entry of the
+// list the kernel builds its table from. Arguments are already where the
+// kernel wants them except the fourth, since SYSCALL takes rcx.
+
+#define SYSCALL_STUB(NUMBER, CONSTANT, NAME, ARGUMENTS)                        \
+  ".global __syscall_" #NAME "\n"                                              \
+  "__syscall_" #NAME ":\n"                                                     \
+  "  mov %rcx, %r10\n"                                                         \
+  "  mov $" #NUMBER ", %eax\n"                                                 \
+  "  syscall\n"                                                                \
+  "  ret\n"
+
+asm(".text\n" SYSCALL_LIST(SYSCALL_STUB));
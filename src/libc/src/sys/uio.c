@@ -0,0 +1,42 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mandelbrot.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+ssize_t readv(int fd, struct iovec *iov, int iovcnt) {
+  ssize_t ret = __syscall_readv(fd, (uint64_t)iov, iovcnt);
+  if (ret < 0) {
+    errno = -ret;
+    return -1;
+  }
+  return ret;
+}
+
+ssize_t writev(int fd, struct iovec *iov, int iovcnt) {
+  ssize_t ret = __syscall_writev(fd, (uint64_t)iov, iovcnt);
+  if (ret < 0) {
+    errno = -ret;
+    return -1;
+  }
+  return ret;
+}
+
+ssize_t preadv(int fd, struct iovec *iov, int iovcnt, off_t offset) {
+  ssize_t ret = __syscall_preadv(fd, (uint64_t)iov, iovcnt, offset);
+  if (ret < 0) {
+    errno = -ret;
+    return -1;
+  }
+  return ret;
+}
+
+ssize_t pwritev(int fd, struct iovec *iov, int iovcnt, off_t offset) {
+  ssize_t ret = __syscall_pwritev(fd, (uint64_t)iov, iovcnt, offset);
+  if (ret < 0) {
+    errno = -ret;
+    return -1;
+  }
+  return ret;
+}
@@ -5,7 +5,7 @@
 #include <sys/wait.h>
 
 pid_t waitpid(pid_t pid, int *status, int options) {
-  pid_t ret = intsyscall(SYSCALL_WAITPID, pid, (uint64_t)status, options, 0, 0);
+  pid_t ret = __syscall_waitpid(pid, (uint64_t)status, options);
   if (ret < 0) {
     errno = -ret;
     return -1;
@@ -0,0 +1,36 @@
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mandelbrot.h>
+#include <sys/vdso.h>
+#include <time.h>
+
+// Through the vDSO, which only makes the system call for clocks it doesn't
+// know
+int clock_gettime(clockid_t clock, struct timespec *time) {
+  int (*vdso_clock_gettime)(clockid_t, struct timespec *) =
+    (void *)VDSO->clock_gettime;
+
+  int ret = vdso_clock_gettime(clock, time);
+  if (ret < 0) {
+    errno = -ret;
+    return -1;
+  }
+  return ret;
+}
+
+int nanosleep(struct timespec *request, struct timespec *remain) {
+  int ret = __syscall_nanosleep((uint64_t)request, (uint64_t)remain);
+  if (ret < 0) {
+    errno = -ret;
+    return -1;
+  }
+  return ret;
+}
+
+// Unlike nanosleep this hands the error back instead of setting errno
+int clock_nanosleep(clockid_t clock, int flags, struct timespec *request,
+                    struct timespec *remain) {
+  int ret = __syscall_clock_nanosleep(clock, flags, (uint64_t)request,
+                                      (uint64_t)remain);
+  return (ret < 0) ? -ret : 0;
+}
@@ -1,8 +1,12 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <sys/mandelbrot.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/vdso.h>
+#include <time.h>
 #include <unistd.h>
 
 char **environ;
@@ -11,10 +15,15 @@ int getpagesize() {
   return 0x1000;
 } // TODO: maybe make the kernel give this back?
 
-void _exit(int status) { intsyscall(SYSCALL_EXIT, status, 0, 0, 0, 0); }
+pid_t getpid() {
+  pid_t (*vdso_getpid)(void) = (void *)VDSO->getpid;
+  return vdso_getpid();
+}
+
+void _exit(int status) { __syscall_exit(status); }
 
 int dup(int fildes) {
-  int ret = intsyscall(SYSCALL_FCNTL, fildes, F_DUPFD, 0, 0, 0);
+  int ret = __syscall_fcntl(fildes, F_DUPFD, 0);
   if (ret < 0) {
     errno = -ret;
     return -1;
@@ -23,7 +32,7 @@ int dup(int fildes) {
 }
 
 int access(char *pathname, int mode) {
-  int ret = intsyscall(SYSCALL_ACCESS, (uint64_t)pathname, mode, 0, 0, 0);
+  int ret = __syscall_access((uint64_t)pathname, mode);
   if (ret < 0) {
     errno = -ret;
     return -1;
@@ -32,7 +41,10 @@ int access(char *pathname, int mode) {
 }
 
 pid_t fork() {
-  pid_t ret = intsyscall(SYSCALL_FORK, 0, 0, 0, 0, 0);
+  // Otherwise anything still buffered would come out of both processes
+  fflush(NULL);
+
+  pid_t ret = __syscall_fork();
   if (ret < 0) {
     errno = -ret;
     return -1;
@@ -41,7 +53,7 @@ pid_t fork() {
 }
 
 int pipe(int pipefd[2]) {
-  int ret = intsyscall(SYSCALL_PIPE, (uint64_t)pipefd, 0, 0, 0, 0);
+  int ret = __syscall_pipe((uint64_t)pipefd);
   if (ret < 0) {
     errno = -ret;
     return -1;
@@ -50,7 +62,7 @@ int pipe(int pipefd[2]) {
 }
 
 int close(int fd) {
-  int ret = intsyscall(SYSCALL_CLOSE, fd, 0, 0, 0, 0);
+  int ret = __syscall_close(fd);
   if (ret < 0) {
     errno = -ret;
     return -1;
@@ -59,8 +71,8 @@ int close(int fd) {
 }
 
 int execve(char *filename, char *argv[], char *envp[]) {
-  int ret = intsyscall(SYSCALL_EXEC, (uint64_t)filename, (uint64_t)argv,
-                       (uint64_t)envp, 0, 0);
+  int ret =
+    __syscall_execve((uint64_t)filename, (uint64_t)argv, (uint64_t)envp);
   if (ret < 0) {
     errno = -ret;
     return -1;
@@ -69,7 +81,7 @@ int execve(char *filename, char *argv[], char *envp[]) {
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
-  int ret = intsyscall(SYSCALL_READ, fd, (uint64_t)buf, count, 0, 0);
+  int ret = __syscall_read(fd, (uint64_t)buf, count);
   if (ret < 0) {
     errno = -ret;
     return -1;
@@ -78,10 +90,43 @@ ssize_t read(int fd, void *buf, size_t count) {
 }
 
 ssize_t write(int fd, void *buf, size_t count) {
-  int ret = intsyscall(SYSCALL_WRITE, fd, (uint64_t)buf, count, 0, 0);
+  int ret = __syscall_write(fd, (uint64_t)buf, count);
+  if (ret < 0) {
+    errno = -ret;
+    return -1;
+  }
+  return ret;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
+  struct iovec iov = {.iov_base = buf, .iov_len = count};
+  return preadv(fd, &iov, 1, offset);
+}
+
+ssize_t pwrite(int fd, void *buf, size_t count, off_t offset) {
+  struct iovec iov = {.iov_base = buf, .iov_len = count};
+  return pwritev(fd, &iov, 1, offset);
+}
+
+off_t lseek(int fd, off_t offset, int whence) {
+  off_t ret = __syscall_seek(fd, offset, whence);
   if (ret < 0) {
     errno = -ret;
     return -1;
   }
   return ret;
 }
+
+unsigned int sleep(unsigned int seconds) {
+  struct timespec request = {.tv_sec = seconds, .tv_nsec = 0};
+  nanosleep(&request, NULL);
+  return 0;
+}
+
+int usleep(useconds_t usec) {
+  struct timespec request = {
+    .tv_sec = usec / 1000000,
+    .tv_nsec = (usec % 1000000) * 1000,
+  };
+  return nanosleep(&request, NULL);
+}
@@ -0,0 +1,64 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mandelbrot.h>
+#include <unistd.h>
+
+// Prints the kernel's ticket lock counters from /dev/lockstat.
+// "lockstat -r" resets them, so a workload can be measured on its own:
+//   lockstat -r; <workload>; lockstat
+
+// Same layout as the kernel's, see lock.h
+#define LOCK_STATS_NAME 32
+
+typedef struct lock_stat {
+  char name[LOCK_STATS_NAME];
+  uint64_t acquisitions;
+  uint64_t contended;
+  uint64_t spins;
+  uint64_t max_hold;
+} lock_stat_t;
+
+#define BUFFER_SIZE (256 * sizeof(lock_stat_t))
+
+int main(int argc, char *argv[]) {
+  int fd = open("/dev/lockstat", O_RDONLY);
+  if (fd < 0) {
+    printf("lockstat: can't open /dev/lockstat\n");
+    return 1;
+  }
+
+  if (argc > 1 && !strcmp(argv[1], "-r")) {
+    ioctl(fd, IOCTL_LOCKSTAT_RESET, NULL);
+    close(fd);
+    return 0;
+  }
+
+  lock_stat_t *locks = malloc(BUFFER_SIZE);
+  ssize_t size = read(fd, locks, BUFFER_SIZE);
+  close(fd);
+
+  if (size < 0) {
+    printf("lockstat: read failed\n");
+    return 1;
+  }
+
+  printf("%-20s %12s %12s %12s %14s\n", "LOCK", "ACQUIRED", "CONTENDED",
+         "SPINS/WAIT", "MAX HOLD (cyc)");
+  for (size_t i = 0; i < size / sizeof(lock_stat_t); i++) {
+    lock_stat_t *lock = &locks[i];
+    lock->name[LOCK_STATS_NAME - 1] = 0;
+    printf("%-20s %12lu %12lu %12lu %14lu\n", lock->name, lock->acquisitions,
+           lock->contended,
+           lock->contended ? lock->spins / lock->contended : 0,
+           lock->max_hold);
+  }
+
+  free(locks);
+
+  return 0;
+}
@@ -0,0 +1,90 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/liballoc.h>
+
+// Times libc's malloc against the liballoc it replaced. Numbers are TSC
+// cycles per operation, so only compare them within one machine.
+
+#define LIVE_SLOTS 1024
+#define CHURN_ROUNDS 200000
+#define PAIR_ROUNDS 100000
+
+typedef struct allocator {
+  char *name;
+  void *(*alloc)(size_t);
+  void (*free)(void *);
+} allocator_t;
+
+static void *slots[LIVE_SLOTS];
+
+static inline uint64_t rdtsc() {
+  uint32_t low, high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
+
+static inline uint32_t next_random(uint32_t *state) {
+  *state = *state * 1103515245 + 12345;
+  return *state >> 8;
+}
+
+// malloc then free straight away, the best case for any allocator
+static uint64_t bench_pairs(allocator_t *allocator, size_t size) {
+  uint64_t start = rdtsc();
+
+  for (size_t i = 0; i < PAIR_ROUNDS; i++) {
+    void *ptr = allocator->alloc(size);
+    *(volatile uint8_t *)ptr = 1;
+    allocator->free(ptr);
+  }
+
+  return (rdtsc() - start) / (PAIR_ROUNDS * 2);
+}
+
+// Keeps LIVE_SLOTS blocks of mixed sizes alive and replaces random ones
+static uint64_t bench_churn(allocator_t *allocator, size_t max_size) {
+  uint32_t seed = 0x1234;
+
+  for (size_t i = 0; i < LIVE_SLOTS; i++)
+    slots[i] = allocator->alloc(next_random(&seed) % max_size + 1);
+
+  uint64_t start = rdtsc();
+
+  for (size_t i = 0; i < CHURN_ROUNDS; i++) {
+    size_t slot = next_random(&seed) % LIVE_SLOTS;
+    allocator->free(slots[slot]);
+    slots[slot] = allocator->alloc(next_random(&seed) % max_size + 1);
+  }
+
+  uint64_t cycles = rdtsc() - start;
+
+  for (size_t i = 0; i < LIVE_SLOTS; i++)
+    allocator->free(slots[i]);
+
+  return cycles / (CHURN_ROUNDS * 2);
+}
+
+int main() {
+  allocator_t allocators[] = {
+    {"malloc", malloc, free},
+    {"liballoc", liballoc_malloc, liballoc_free},
+  };
+  size_t pair_sizes[] = {16, 64, 256, 1024, 8192};
+  size_t churn_sizes[] = {64, 512, 4096};
+
+  for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+    allocator_t *allocator = &allocators[i];
+
+    for (size_t j = 0; j < sizeof(pair_sizes) / sizeof(pair_sizes[0]); j++)
+      printf("%s: pairs of %lu bytes: %lu cycles/op\n", allocator->name,
+             pair_sizes[j], bench_pairs(allocator, pair_sizes[j]));
+
+    for (size_t j = 0; j < sizeof(churn_sizes) / sizeof(churn_sizes[0]); j++)
+      printf("%s: churn up to %lu bytes: %lu cycles/op\n", allocator->name,
+             churn_sizes[j], bench_churn(allocator, churn_sizes[j]));
+  }
+
+  return 0;
+}
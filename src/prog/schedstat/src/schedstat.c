@@ -0,0 +1,107 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mandelbrot.h>
+#include <unistd.h>
+
+// Prints what /dev/schedstat has gathered since boot or the last reset.
+// "schedstat -r" resets it, so a workload can be measured on its own:
+//   schedstat -r; <workload>; schedstat
+
+// Same layout as the kernel's, see tasking/scheduler.h
+#define SCHED_STATS_BUCKETS 32
+
+typedef struct sched_cpu_stats {
+  uint64_t schedules;
+  uint64_t switches;
+  uint64_t lock_misses;
+  uint64_t lock_miss_ticks;
+  uint64_t steals;
+  uint64_t idle_time;
+  uint64_t wakeup_latency[SCHED_STATS_BUCKETS];
+  uint64_t slice_usage[SCHED_STATS_BUCKETS];
+} sched_cpu_stats_t;
+
+typedef struct sched_thread_stats {
+  uint64_t tid;
+  uint64_t pid;
+  uint64_t cpu;
+  int32_t policy;
+  int32_t priority;
+  uint64_t runtime;
+  uint64_t wait_time;
+} sched_thread_stats_t;
+
+typedef struct sched_stats {
+  uint64_t cpu_count;
+  uint64_t thread_count;
+  uint64_t dropped_threads;
+} sched_stats_t;
+
+#define BUFFER_SIZE (64 * 1024)
+
+static void print_histogram(char *name, uint64_t *histogram) {
+  printf("  %s (us):\n", name);
+  for (size_t i = 0; i < SCHED_STATS_BUCKETS; i++)
+    if (histogram[i])
+      printf("    %10lu - %-10lu %lu\n", i ? 1ul << i : 0,
+             (1ul << (i + 1)) - 1, histogram[i]);
+}
+
+int main(int argc, char *argv[]) {
+  int fd = open("/dev/schedstat", O_RDONLY);
+  if (fd < 0) {
+    printf("schedstat: can't open /dev/schedstat\n");
+    return 1;
+  }
+
+  if (argc > 1 && !strcmp(argv[1], "-r")) {
+    ioctl(fd, IOCTL_SCHEDSTAT_RESET, NULL);
+    close(fd);
+    return 0;
+  }
+
+  uint8_t *buffer = malloc(BUFFER_SIZE);
+  ssize_t size = read(fd, buffer, BUFFER_SIZE);
+  close(fd);
+
+  if (size < (ssize_t)sizeof(sched_stats_t)) {
+    printf("schedstat: short read\n");
+    return 1;
+  }
+
+  sched_stats_t *stats = (sched_stats_t *)buffer;
+  sched_cpu_stats_t *cpus = (sched_cpu_stats_t *)(stats + 1);
+  sched_thread_stats_t *threads =
+    (sched_thread_stats_t *)(cpus + stats->cpu_count);
+
+  for (size_t i = 0; i < stats->cpu_count; i++) {
+    sched_cpu_stats_t *cpu = &cpus[i];
+    printf("CPU %lu: %lu schedules, %lu switches, %lu steals\n", i,
+           cpu->schedules, cpu->switches, cpu->steals);
+    printf("  %lu lock misses in %lu schedules, %lu ms idle\n",
+           cpu->lock_misses, cpu->lock_miss_ticks, cpu->idle_time / 1000000);
+    print_histogram("wakeup to run", cpu->wakeup_latency);
+    print_histogram("timeslice used", cpu->slice_usage);
+  }
+
+  printf("%5s %5s %3s %5s %4s %12s %12s\n", "TID", "PID", "CPU", "CLASS",
+         "PRIO", "RUN (us)", "WAIT (us)");
+  for (size_t i = 0; i < stats->thread_count; i++) {
+    sched_thread_stats_t *thread = &threads[i];
+    printf("%5lu %5lu %3lu %5s %4d %12lu %12lu\n", thread->tid, thread->pid,
+           thread->cpu, thread->policy ? "fair" : "prio", thread->priority,
+           thread->runtime / 1000, thread->wait_time / 1000);
+  }
+
+  if (stats->dropped_threads)
+    printf("... and %lu more threads\n", stats->dropped_threads);
+
+  free(buffer);
+
+  return 0;
+}
@@ -4,6 +4,7 @@
 #include <sys/ioctl.h>
 #include <sys/mandelbrot.h>
 #include <sys/mman.h>
+#include <time.h>
 
 uint16_t width;
 uint16_t height;
@@ -152,6 +153,9 @@ uint32_t rgb2hex(pixel_t pix) {
 
 #define pi 3.141592
 
+// Nanoseconds between drawing two columns
+#define COLUMN_DELAY 500000
+
 double pow(double base, int exponent) {
   double result = 1;
   while (exponent--)
@@ -222,6 +226,9 @@ void main() {
   /* asm volatile("nop"); */
   /* } */
 
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
   while (1) {
     double amp = 300;
     double ang_inc = 1;
@@ -263,9 +270,13 @@ void main() {
 
       prev_y3 = y;
 
-      /* for (volatile size_t i = 0; i < 7000000; i++) */
-      for (volatile size_t i = 0; i < 100000; i++)
-        asm volatile("nop");
+      // Absolute deadlines keep the pace steady however long drawing took
+      next.tv_nsec += COLUMN_DELAY;
+      if (next.tv_nsec >= 1000000000) {
+        next.tv_nsec -= 1000000000;
+        next.tv_sec++;
+      }
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
     }
   }
 }
@@ -0,0 +1,118 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mandelbrot.h>
+#include <time.h>
+
+// Reports memcpy, memset and strlen throughput from 8 bytes up to 64 MiB.
+// The TSC is calibrated against the RTC first, which takes a couple of
+// seconds since the RTC only counts whole seconds.
+
+#define MIN_SIZE 8
+#define MAX_SIZE (64 * 1024 * 1024)
+
+// Enough work per size that the rdtsc overhead disappears
+#define BYTES_PER_RUN (256 * 1024 * 1024)
+
+static inline uint64_t rdtsc() {
+  uint32_t low, high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
+
+static size_t rtc_seconds() {
+  struct timespec time;
+  intsyscall(SYSCALL_GETTIMEOFDAY, (uint64_t)&time, 0, 0, 0, 0);
+  return time.tv_sec;
+}
+
+static uint64_t tsc_hz() {
+  size_t start = rtc_seconds();
+  while (rtc_seconds() == start)
+    ;
+
+  start++;
+  uint64_t tsc = rdtsc();
+  while (rtc_seconds() == start)
+    ;
+
+  return rdtsc() - tsc;
+}
+
+static void print_rate(char *name, size_t size, size_t iterations,
+                       uint64_t cycles, uint64_t hz) {
+  if (!cycles)
+    cycles = 1;
+
+  // MB/s, printed as GB/s with two decimals
+  uint64_t mbs = (uint64_t)size * iterations / 1000 * (hz / 1000) / cycles;
+  printf("%-7s %9lu B  %4lu.%02lu GB/s\n", name, size, mbs / 1000,
+         (mbs % 1000) / 10);
+}
+
+int main() {
+  size_t max_size = MAX_SIZE;
+  uint8_t *src = NULL;
+  uint8_t *dest = NULL;
+
+  // Default QEMU machines don't have room for two 64 MiB buffers, take
+  // what we can get
+  while (max_size >= MIN_SIZE) {
+    src = malloc(max_size + 64);
+    dest = malloc(max_size + 64);
+    if (src && dest)
+      break;
+    free(src);
+    free(dest);
+    src = dest = NULL;
+    max_size /= 2;
+  }
+
+  if (!src) {
+    printf("stringbench: out of memory\n");
+    return 1;
+  }
+
+  printf("Using the %s string routines\n", __string_variant);
+  printf("Calibrating the TSC...\n");
+  uint64_t hz = tsc_hz();
+  printf("TSC runs at %lu MHz\n", hz / 1000000);
+
+  if (max_size != MAX_SIZE)
+    printf("Only got %lu bytes per buffer\n", max_size);
+
+  memset(src, 'a', max_size + 64);
+  memset(dest, 0, max_size + 64);
+
+  for (size_t size = MIN_SIZE; size <= max_size; size *= 2) {
+    size_t iterations = BYTES_PER_RUN / size;
+    if (iterations < 4)
+      iterations = 4;
+
+    uint64_t start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+      memcpy(dest, src, size);
+    print_rate("memcpy", size, iterations, rdtsc() - start, hz);
+
+    start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+      memset(dest, i, size);
+    print_rate("memset", size, iterations, rdtsc() - start, hz);
+
+    src[size] = 0;
+    volatile size_t sink = 0;
+    start = rdtsc();
+    for (size_t i = 0; i < iterations; i++)
+      sink += strlen((char *)src);
+    print_rate("strlen", size, iterations, rdtsc() - start, hz);
+    src[size] = 'a';
+    (void)sink;
+  }
+
+  free(src);
+  free(dest);
+
+  return 0;
+}
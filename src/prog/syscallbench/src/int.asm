@@ -0,0 +1,13 @@
+global int_syscall
+
+; The old way in, for comparison with libc's intsyscall. Takes the same
+; registers as SYSCALL does.
+int_syscall:
+  mov rax, rdi
+  mov rdi, rsi
+  mov rsi, rdx
+  mov rdx, rcx
+  mov r10, r8
+  mov r8, r9
+  int 0x45
+  ret
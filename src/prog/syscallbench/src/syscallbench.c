@@ -0,0 +1,61 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mandelbrot.h>
+#include <unistd.h>
+
+// Times getpid, which does next to nothing in the kernel, through both ways
+// in: SYSCALL as libc does it, and int 0x45 as it used to. What's left is
+// the cost of getting into the kernel and back. libc's getpid doesn't go in
+// at all, it reads the vDSO, and is timed too for comparison.
+// "syscallbench N" makes N calls each way, 1000000 by default.
+
+uint64_t int_syscall(uint64_t id, uint64_t arg_1, uint64_t arg_2,
+                     uint64_t arg_3, uint64_t arg_4, uint64_t arg_5);
+
+static inline uint64_t rdtsc() {
+  uint32_t low, high;
+  asm volatile("rdtsc" : "=a"(low), "=d"(high));
+  return ((uint64_t)high << 32) | low;
+}
+
+int main(int argc, char *argv[]) {
+  size_t calls = (argc > 1) ? (size_t)atoi(argv[1]) : 1000000;
+  if (!calls) {
+    printf("syscallbench: need at least 1 call\n");
+    return 1;
+  }
+
+  // Both once first, so neither pays for a cold cache
+  uint64_t pid = intsyscall(SYSCALL_GETPID, 0, 0, 0, 0, 0);
+  if (int_syscall(SYSCALL_GETPID, 0, 0, 0, 0, 0) != pid) {
+    printf("syscallbench: the two ways in disagree on getpid\n");
+    return 1;
+  }
+  if ((uint64_t)getpid() != pid) {
+    printf("syscallbench: the vDSO disagrees on getpid\n");
+    return 1;
+  }
+
+  uint64_t start = rdtsc();
+  for (size_t i = 0; i < calls; i++)
+    intsyscall(SYSCALL_GETPID, 0, 0, 0, 0, 0);
+  uint64_t fast = rdtsc() - start;
+
+  start = rdtsc();
+  for (size_t i = 0; i < calls; i++)
+    int_syscall(SYSCALL_GETPID, 0, 0, 0, 0, 0);
+  uint64_t slow = rdtsc() - start;
+
+  start = rdtsc();
+  for (size_t i = 0; i < calls; i++)
+    getpid();
+  uint64_t vdso = rdtsc() - start;
+
+  printf("syscall:  %lu cycles per call\n", fast / calls);
+  printf("int 0x45: %lu cycles per call\n", slow / calls);
+  printf("vDSO:     %lu cycles per call\n", vdso / calls);
+
+  return 0;
+}
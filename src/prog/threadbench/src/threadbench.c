@@ -0,0 +1,97 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Times pthread mutexes and condition variables:
+// - lock/unlock with nobody else around, which never leaves userspace
+// - a counter bumped under one mutex by several threads at once
+// - two threads handing a token back and forth through a condition
+// "threadbench N" runs the contended test with N threads, 4 by default.
+
+#define UNCONTENDED_ITERATIONS 10000000
+#define CONTENDED_ITERATIONS 200000
+#define PING_PONG_ROUNDS 20000
+#define MAX_THREADS 64
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static size_t counter = 0;
+static int turn = 0;
+
+static uint64_t now_ns() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static void *contended_thread(void *arg) {
+  (void)arg;
+  for (size_t i = 0; i < CONTENDED_ITERATIONS; i++) {
+    pthread_mutex_lock(&mutex);
+    counter++;
+    pthread_mutex_unlock(&mutex);
+  }
+  return NULL;
+}
+
+// Waits for its turn, then hands it to the other side
+static void *ping_pong_thread(void *arg) {
+  int me = (int)(uintptr_t)arg;
+  for (size_t i = 0; i < PING_PONG_ROUNDS; i++) {
+    pthread_mutex_lock(&mutex);
+    while (turn != me)
+      pthread_cond_wait(&cond, &mutex);
+    turn = !me;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&mutex);
+  }
+  return NULL;
+}
+
+int main(int argc, char *argv[]) {
+  size_t thread_count = (argc > 1) ? (size_t)atoi(argv[1]) : 4;
+  if (!thread_count || thread_count > MAX_THREADS) {
+    printf("threadbench: between 1 and %d threads\n", MAX_THREADS);
+    return 1;
+  }
+
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < UNCONTENDED_ITERATIONS; i++) {
+    pthread_mutex_lock(&mutex);
+    pthread_mutex_unlock(&mutex);
+  }
+  printf("uncontended lock/unlock: %lu ns\n",
+         (now_ns() - start) / UNCONTENDED_ITERATIONS);
+
+  pthread_t threads[MAX_THREADS];
+  start = now_ns();
+  for (size_t i = 0; i < thread_count; i++)
+    if (pthread_create(&threads[i], NULL, contended_thread, NULL)) {
+      printf("threadbench: can't create thread %lu\n", i);
+      return 1;
+    }
+  for (size_t i = 0; i < thread_count; i++)
+    pthread_join(threads[i], NULL);
+  uint64_t elapsed = now_ns() - start;
+
+  if (counter != thread_count * CONTENDED_ITERATIONS) {
+    printf("threadbench: counter is %lu, expected %lu\n", counter,
+           thread_count * CONTENDED_ITERATIONS);
+    return 1;
+  }
+  printf("contended lock/unlock, %lu threads: %lu ns\n", thread_count,
+         elapsed / (thread_count * CONTENDED_ITERATIONS));
+
+  start = now_ns();
+  pthread_create(&threads[0], NULL, ping_pong_thread, (void *)0);
+  pthread_create(&threads[1], NULL, ping_pong_thread, (void *)1);
+  pthread_join(threads[0], NULL);
+  pthread_join(threads[1], NULL);
+  printf("condition ping-pong: %lu ns per handoff\n",
+         (now_ns() - start) / (2 * PING_PONG_ROUNDS));
+
+  return 0;
+}